@@ -0,0 +1,492 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+/*
+ * Scheduler benchmarks
+ *
+ * Runs a set of graphs with 1 to maxThreads workers and reports, for each
+ * run, the wall time, tasks per second, speedup and efficiency with
+ * respect to the run with one worker, and the scheduling overhead per task:
+ * the CPU time of the run (wall time times workers) minus the time of the
+ * same functions called sequentially, divided by the number of tasks.
+ *
+ *   chain-D     D empty instructions in a row
+ *   fanout-W    one instruction feeding W empty instructions, joined by a reduce
+ *   diamond-D   D diamonds (split, two branches, join) in a row
+ *   sinloops    the graph of examples/sinloops.cpp
+ *   mandelbrot  the graph of examples/mandelbrot.cpp, on a smaller image
+ *
+ * Usage: bench [format] [maxThreads] [scale] [filter]
+ *   format      csv (default), json, or table to print the graphs matching
+ *               filter (default sinloops and mandelbrot) in the layout of
+ *               the tables in tex/ (times in ms)
+ *   scale       multiplies the number of items of every graph
+ *   filter      only runs the graphs whose name starts with filter
+ *
+ * The messages of the interpreter are discarded, results go to stdout.
+ */
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <functional>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <cmath>
+
+#include "../mdf/Mdf.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+const double PI = 3.14159265358979323846;
+const int REPETITIONS = 3; // The median time is reported
+
+volatile double sink; // Keeps the sequential baselines from being optimized away
+
+class CountingDrainer {
+
+public:
+
+	size_t results = 0;
+
+	void operator()(mdf::TokenHandle) { ++results; }
+
+};
+
+// Streams items instances, the tokens of the i-th instance are built by make(i)
+class Streamer {
+
+private:
+
+	function<vector<mdf::InputTokenContainer>(size_t)> _make;
+	const size_t _items;
+	size_t _next;
+
+public:
+
+	Streamer(function<vector<mdf::InputTokenContainer>(size_t)> make, size_t items) : _make{make}, _items{items}, _next{0} { }
+
+	vector<mdf::InputTokenContainer> Next()
+	{
+		if (_next < _items)
+			return _make(_next++);
+		return vector<mdf::InputTokenContainer>{};
+	}
+
+};
+
+struct Workload {
+	string name;
+	size_t items;
+	size_t tasksPerItem; // Instructions executed by each instance
+	function<mdf::Graph()> graph;
+	function<vector<mdf::InputTokenContainer>(size_t)> input; // Tokens of an instance
+	function<void()> sequential; // The same computation without the interpreter
+};
+
+struct Result {
+	string workload;
+	size_t threads;
+	size_t items;
+	size_t tasks;
+	double seconds;
+	double sequential;
+	double tasksPerSecond;
+	double overheadNs;
+	double speedup;
+	double efficiency;
+};
+
+template<typename F>
+double Median(F f)
+{
+	vector<double> t;
+	for (int r = 0; r < REPETITIONS; ++r)
+		t.push_back(f());
+	sort(t.begin(), t.end());
+	return t[t.size()/2];
+}
+
+double RunEngine(const Workload& w, size_t tn)
+{
+	mdf::Graph g = w.graph();
+	CountingDrainer *drainer = new CountingDrainer;
+	mdf::Mdf<CountingDrainer> engine{g, tn, unique_ptr<CountingDrainer>{drainer}};
+	unique_ptr<Streamer> streamer{new Streamer{w.input, w.items}};
+	auto t0 = steady_clock::now();
+	streamer = engine.Start(move(streamer));
+	auto t1 = steady_clock::now();
+	assert(drainer->results == w.items);
+	return duration<double>(t1 - t0).count();
+}
+
+double RunSequential(const Workload& w)
+{
+	auto t0 = steady_clock::now();
+	w.sequential();
+	return duration<double>(steady_clock::now() - t0).count();
+}
+
+int Empty(int x) { return x + 1; }
+
+Workload Chain(size_t depth, size_t items)
+{
+	Workload w;
+	w.name = "chain-" + to_string(depth);
+	w.items = items;
+	w.tasksPerItem = depth;
+	w.graph = [depth]() {
+		mdf::Graph g{};
+		mdf::NodeId prev = g.AddInstruction(Empty, mdf::ParamDecl<int>{"x"});
+		for (size_t k = 1; k < depth; ++k) {
+			mdf::NodeId next = g.AddInstruction(Empty, mdf::ParamDecl<int>{"x"});
+			g.Connect(prev, next, "x");
+			prev = next;
+		}
+		return g;
+	};
+	w.input = [](size_t i) {
+		return vector<mdf::InputTokenContainer>{mdf::InputTokenContainer{0, "x", mdf::WrapValue<int>(i)}};
+	};
+	w.sequential = [depth, items]() {
+		int acc = 0;
+		for (size_t i = 0; i < items; ++i) {
+			int x = i;
+			for (size_t k = 0; k < depth; ++k)
+				x = Empty(x);
+			acc += x;
+		}
+		sink = acc;
+	};
+	return w;
+}
+
+// Adds a reduce instruction summing the operands in0 ... in(N-1)
+template<typename... P>
+mdf::NodeId AddSum(mdf::Graph& g, integral_constant<size_t,0>, P... operands)
+{
+	return g.AddReduceInstruction([](int a, int b) -> int { return a + b; }, operands...);
+}
+
+template<size_t N, typename... P>
+mdf::NodeId AddSum(mdf::Graph& g, integral_constant<size_t,N>, P... operands)
+{
+	return AddSum(g, integral_constant<size_t,N-1>{}, mdf::ParamDecl<int>{"in" + to_string(N-1)}, operands...);
+}
+
+template<size_t W>
+Workload FanOut(size_t items)
+{
+	Workload w;
+	w.name = "fanout-" + to_string(W);
+	w.items = items;
+	w.tasksPerItem = W + 2;
+	w.graph = []() {
+		mdf::Graph g{};
+		mdf::NodeId source = g.AddInstruction(Empty, mdf::ParamDecl<int>{"x"});
+		mdf::NodeId sum = AddSum(g, integral_constant<size_t,W>{});
+		for (size_t k = 0; k < W; ++k) {
+			mdf::NodeId branch = g.AddInstruction(Empty, mdf::ParamDecl<int>{"x"});
+			g.Connect(source, branch, "x");
+			g.Connect(branch, sum, "in" + to_string(k));
+		}
+		return g;
+	};
+	w.input = [](size_t i) {
+		return vector<mdf::InputTokenContainer>{mdf::InputTokenContainer{0, "x", mdf::WrapValue<int>(i)}};
+	};
+	w.sequential = [items]() {
+		int acc = 0;
+		for (size_t i = 0; i < items; ++i) {
+			int x = Empty(i);
+			int s = 0;
+			for (size_t k = 0; k < W; ++k)
+				s += Empty(x);
+			acc += s;
+		}
+		sink = acc;
+	};
+	return w;
+}
+
+Workload Diamond(size_t depth, size_t items)
+{
+	Workload w;
+	w.name = "diamond-" + to_string(depth);
+	w.items = items;
+	w.tasksPerItem = 4*depth;
+	w.graph = [depth]() {
+		mdf::Graph g{};
+		mdf::NodeId prev = 0;
+		for (size_t k = 0; k < depth; ++k) {
+			mdf::NodeId split = g.AddInstruction(Empty, mdf::ParamDecl<int>{"x"});
+			mdf::NodeId left = g.AddInstruction(Empty, mdf::ParamDecl<int>{"x"});
+			mdf::NodeId right = g.AddInstruction(Empty, mdf::ParamDecl<int>{"x"});
+			mdf::NodeId join = g.AddInstruction([](int a, int b) -> int { return a + b; },
+					mdf::ParamDecl<int>{"a"}, mdf::ParamDecl<int>{"b"});
+			if (k > 0) g.Connect(prev, split, "x");
+			g.Connect(split, left, "x");
+			g.Connect(split, right, "x");
+			g.Connect(left, join, "a");
+			g.Connect(right, join, "b");
+			prev = join;
+		}
+		return g;
+	};
+	w.input = [](size_t i) {
+		return vector<mdf::InputTokenContainer>{mdf::InputTokenContainer{0, "x", mdf::WrapValue<int>(i)}};
+	};
+	w.sequential = [depth, items]() {
+		int acc = 0;
+		for (size_t i = 0; i < items; ++i) {
+			int x = i;
+			for (size_t k = 0; k < depth; ++k) {
+				int s = Empty(x);
+				x = Empty(s) + Empty(s);
+			}
+			acc += x;
+		}
+		sink = acc;
+	};
+	return w;
+}
+
+// Body of the nodes of the sinloops graph
+double SinLoop(double x, unsigned long n)
+{
+	for (unsigned i = 0; i < n; ++i)
+		x = std::sin(x);
+	return x;
+}
+
+Workload SinLoops(size_t items, unsigned long n)
+{
+	Workload w;
+	w.name = "sinloops";
+	w.items = items;
+	w.tasksPerItem = 6;
+	w.graph = [n]() {
+		mdf::Graph g{};
+		mdf::NodeId i1 = g.AddInstruction("i_1", [n](int in1, double in2) -> double { return SinLoop(in1+in2, n); },
+				mdf::ParamDecl<int>{"input1"}, mdf::ParamDecl<double>{"input2"});
+		mdf::NodeId i2 = g.AddInstruction("i_2", [n](double x) -> double { return SinLoop(x + 1.0, n); }, mdf::ParamDecl<double>{"x"});
+		mdf::NodeId i3 = g.AddInstruction("i_3", [n](double x) -> double { return SinLoop(x + 2.0, n); }, mdf::ParamDecl<double>{"x"});
+		mdf::NodeId i4 = g.AddInstruction("i_4", [n](double x) -> double { return SinLoop(x + 3.0, n); }, mdf::ParamDecl<double>{"x"});
+		mdf::NodeId i5 = g.AddInstruction("i_5", [n](double y1, double y2) -> double { return SinLoop(y1 + y2 + 4.0, n); },
+				mdf::ParamDecl<double>{"y1"}, mdf::ParamDecl<double>{"y2"});
+		mdf::NodeId i6 = g.AddInstruction("i_6",
+				[n](double y, double z, int c) -> pair<int,double> { return make_pair(c, SinLoop(y + z + 5.0, n)); },
+				mdf::ParamDecl<double>{"y"}, mdf::ParamDecl<double>{"z"}, mdf::ParamDecl<int>{"counter"});
+		g.Connect(i1, i2, "x");
+		g.Connect(i1, i3, "x");
+		g.Connect(i1, i4, "x");
+		g.Connect(i2, i5, "y1");
+		g.Connect(i3, i5, "y2");
+		g.Connect(i5, i6, "y");
+		g.Connect(i4, i6, "z");
+		return g;
+	};
+	w.input = [](size_t i) {
+		int item = i + 1;
+		return vector<mdf::InputTokenContainer>{
+			mdf::InputTokenContainer{0, "input1", mdf::WrapValue<int>(item)},
+			mdf::InputTokenContainer{0, "input2", mdf::WrapValue<double>(PI/item)},
+			mdf::InputTokenContainer{5, "counter", mdf::WrapValue<int>(item)}};
+	};
+	w.sequential = [items, n]() {
+		double acc = 0;
+		for (size_t i = 0; i < items; ++i) {
+			int item = i + 1;
+			double x = SinLoop(item + PI/item, n);
+			double y = SinLoop(SinLoop(x + 1.0, n) + SinLoop(x + 2.0, n) + 4.0, n);
+			acc += SinLoop(y + SinLoop(x + 3.0, n) + 5.0, n);
+		}
+		sink = acc;
+	};
+	return w;
+}
+
+const int MANDEL_SIZE = 1<<9;
+const int MANDEL_BLOCK = 1<<6;
+const int MANDEL_LINES = 1<<2;
+const int MANDEL_ITER = 2000;
+
+// Escape iterations of the lines of a block, returns the maximum
+int MandelBlock(mdf::IndexRange lines, int *hst, int x0, int y0)
+{
+	const double re0 = -0.74364396916876561516, w = 0.00000015152607844026;
+	const double im0 = 0.13182588262473313035, h = 0.00000015152607844026;
+	int maxIter = 0;
+	for (size_t k = lines.begin; k < lines.end; ++k) {
+		for (int j = 0; j < MANDEL_BLOCK; ++j) {
+			double reC = re0 + (x0+j)*w/MANDEL_SIZE;
+			double imC = im0 + (y0-(int)k)*h/MANDEL_SIZE;
+			double re = 0.0, im = 0.0;
+			int i = 0;
+			while (i < MANDEL_ITER && re*re + im*im <= 4.0) {
+				double tmpre = re*re - im*im + reC;
+				im = 2.0*re*im + imC;
+				re = tmpre;
+				++i;
+			}
+			hst[(MANDEL_SIZE - 1 - (y0-(int)k))*MANDEL_SIZE + (x0+j)] = i;
+			maxIter = max(maxIter, i);
+		}
+	}
+	return maxIter;
+}
+
+Workload Mandelbrot(shared_ptr<vector<int>> hst)
+{
+	const int perSide = MANDEL_SIZE/MANDEL_BLOCK;
+	Workload w;
+	w.name = "mandelbrot";
+	w.items = perSide*perSide;
+	w.tasksPerItem = 2;
+	w.graph = [hst]() {
+		mdf::Graph g{};
+		mdf::NodeId block = g.AddMapInstruction(MandelBlock, MANDEL_LINES, mdf::ParamDecl<mdf::IndexRange>{"lines"},
+				mdf::ParamDecl<int*>{"hst"}, mdf::ParamDecl<int>{"x0"}, mdf::ParamDecl<int>{"y0"});
+		mdf::NodeId maxNode = g.AddReduceInstruction([](int a, int b) -> int { return a>b ? a : b; }, mdf::ParamDecl<int>{"chunks"});
+		g.Connect(block, maxNode, "chunks");
+		g.BindConstant(block, "hst", hst->data());
+		return g;
+	};
+	w.input = [perSide](size_t i) {
+		int x0 = (i % perSide)*MANDEL_BLOCK;
+		int y0 = MANDEL_SIZE - 1 - (i / perSide)*MANDEL_BLOCK;
+		return vector<mdf::InputTokenContainer>{
+			mdf::InputTokenContainer{0, "lines", mdf::WrapValue<mdf::IndexRange>({0, MANDEL_BLOCK})},
+			mdf::InputTokenContainer{0, "x0", mdf::WrapValue<int>(x0)},
+			mdf::InputTokenContainer{0, "y0", mdf::WrapValue<int>(y0)}};
+	};
+	w.sequential = [hst, perSide]() {
+		int maxIter = 0;
+		for (int i = 0; i < perSide*perSide; ++i)
+			maxIter = max(maxIter, MandelBlock(mdf::IndexRange{0, MANDEL_BLOCK}, hst->data(),
+					(i % perSide)*MANDEL_BLOCK, MANDEL_SIZE - 1 - (i / perSide)*MANDEL_BLOCK));
+		sink = maxIter;
+	};
+	return w;
+}
+
+vector<Workload> Workloads(double scale)
+{
+	auto items = [scale](size_t n) { return max<size_t>(1, n*scale); };
+	return vector<Workload>{
+		Chain(1, items(100000)),
+		Chain(4, items(50000)),
+		Chain(16, items(20000)),
+		Chain(64, items(5000)),
+		FanOut<4>(items(50000)),
+		FanOut<16>(items(20000)),
+		FanOut<64>(items(5000)),
+		Diamond(1, items(50000)),
+		Diamond(16, items(5000)),
+		SinLoops(items(2000), 1000),
+		Mandelbrot(make_shared<vector<int>>(MANDEL_SIZE*MANDEL_SIZE))
+	};
+}
+
+vector<Result> Sweep(const Workload& w, size_t maxThreads)
+{
+	vector<Result> results;
+	double seq = Median([&w]() { return RunSequential(w); });
+	double one = 0;
+	for (size_t tn = 1; tn <= maxThreads; ++tn) {
+		double t = Median([&w, tn]() { return RunEngine(w, tn); });
+		if (tn == 1) one = t;
+		size_t tasks = w.items * w.tasksPerItem;
+		results.push_back(Result{w.name, tn, w.items, tasks, t, seq, tasks / t,
+				(t*tn - seq) * 1e9 / tasks, one / t, one / t / tn});
+	}
+	return results;
+}
+
+void PrintCsvHeader(ostream& os)
+{
+	os << "workload,threads,items,tasks,seconds,sequential_seconds,tasks_per_second,overhead_ns_per_task,speedup,efficiency\n";
+}
+
+void PrintCsv(ostream& os, const Result& r)
+{
+	os << r.workload << "," << r.threads << "," << r.items << "," << r.tasks << "," << r.seconds << "," << r.sequential << ","
+	   << r.tasksPerSecond << "," << r.overheadNs << "," << r.speedup << "," << r.efficiency << "\n";
+}
+
+void PrintJson(ostream& os, const Result& r, bool first)
+{
+	os << (first ? "  " : ",\n  ")
+	   << "{\"workload\":\"" << r.workload << "\",\"threads\":" << r.threads << ",\"items\":" << r.items
+	   << ",\"tasks\":" << r.tasks << ",\"seconds\":" << r.seconds << ",\"sequential_seconds\":" << r.sequential
+	   << ",\"tasks_per_second\":" << r.tasksPerSecond << ",\"overhead_ns_per_task\":" << r.overheadNs
+	   << ",\"speedup\":" << r.speedup << ",\"efficiency\":" << r.efficiency << "}";
+}
+
+// Same layout as tex/*.table: threads, time with one thread, sequential time and time with N threads
+void PrintTable(ostream& os, const vector<Result>& results)
+{
+	os << results.front().workload << "\n";
+	os << "N    TONE      TSEQ      TN\n";
+	for (auto& r : results) {
+		os << r.threads << "    " << results.front().seconds * 1000 << "   " << r.sequential * 1000
+		   << "   " << r.seconds * 1000 << "\n";
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	try {
+
+	string format = (argc>1) ? argv[1] : "csv";
+	size_t maxThreads = (argc>2) ? stoul(argv[2]) : max(1u, thread::hardware_concurrency());
+	double scale = (argc>3) ? stod(argv[3]) : 1.0;
+	string filter = (argc>4) ? argv[4] : "";
+
+	if (format != "csv" && format != "json" && format != "table") {
+		cerr << "Usage: " << argv[0] << " [csv|json|table] [maxThreads] [scale] [filter]" << endl;
+		return -1;
+	}
+
+	// The interpreter prints on std::cout, results go to the original stream buffer
+	ostream results{cout.rdbuf()};
+	cout.rdbuf(nullptr);
+
+	bool first = true;
+	if (format == "csv") PrintCsvHeader(results);
+	if (format == "json") results << "[\n";
+
+	for (auto& w : Workloads(scale)) {
+		bool selected = filter.empty() ? (format != "table" || w.name == "sinloops" || w.name == "mandelbrot")
+				: w.name.compare(0, filter.size(), filter) == 0;
+		if (!selected) continue;
+		vector<Result> sweep = Sweep(w, maxThreads);
+		if (format == "table") {
+			PrintTable(results, sweep);
+			results << "\n";
+		}
+		for (auto& r : sweep) {
+			if (format == "csv") PrintCsv(results, r);
+			if (format == "json") PrintJson(results, r, first);
+			first = false;
+		}
+		results.flush();
+	}
+
+	if (format == "json") results << "\n]\n";
+
+	} catch (std::exception& e) {
+		cerr << e.what() << endl;
+		return -1;
+	}
+
+	return 0;
+}
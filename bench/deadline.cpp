@@ -0,0 +1,124 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+/*
+ * Deadlines under overload
+ *
+ * Measures the capacity of a small graph (three nodes looping on sin) with
+ * tn workers, then offers Poisson loads from 50% to 200% of it. Each load
+ * is run without deadlines, with a latency budget of budget microseconds
+ * and FIFO task selection, and with the same budget and earliest deadline
+ * first (see TaskOrder in mdf/Mdf.hpp). Past the capacity the instances
+ * without a deadline queue up and all of them end up late, while the
+ * instances that cannot make their deadline are cancelled and the workers
+ * are spent on those that can. The goodput (instances drained within the
+ * budget per second), the cancelled and missed instances and the latency
+ * percentiles are printed as CSV.
+ *
+ * Usage: deadline [tn] [n] [arrivals] [budget]
+ */
+
+#include <iostream>
+#include <cmath>
+
+#include "../mdf/Mdf.hpp"
+#include "../mdf/LoadGenerator.hpp"
+
+using namespace std;
+
+class Drainer {
+
+public:
+
+	void operator()(mdf::TokenHandle) { }
+
+};
+
+class Streamer {
+
+private:
+
+	mdf::NodeId _first;
+	int _item;
+
+public:
+
+	explicit Streamer(mdf::NodeId first) : _first{first}, _item{0} { }
+
+	vector<mdf::InputTokenContainer> Next()
+	{
+		return vector<mdf::InputTokenContainer>{mdf::InputTokenContainer{_first, "x", mdf::WrapValue<double>(++_item)}};
+	}
+
+};
+
+void WriteRow(ostream& os, const string& config, double load, double goodput, const mdf::LoadPoint& p)
+{
+	auto us = [](std::chrono::nanoseconds d) { return d.count() / 1000.0; };
+	os << config << "," << load << "," << p.offeredRate << "," << p.achievedRate << "," << goodput << ","
+	   << p.deadlines.cancelled << "," << p.deadlines.missed << "," << us(p.latency.Percentile(0.5)) << ","
+	   << us(p.latency.Percentile(0.99)) << "," << us(p.latency.Max()) << "\n";
+}
+
+int main(int argc, char *argv[])
+{
+	try {
+
+	size_t tn = (argc>1) ? stoul(argv[1]) : 2;
+	unsigned long n = (argc>2) ? stoul(argv[2]) : 1000;
+	size_t arrivals = (argc>3) ? stoul(argv[3]) : 20000;
+	long budget = (argc>4) ? stol(argv[4]) : 5000;
+
+	mdf::Graph g{};
+
+	auto loop = [n](double x) -> double {
+		for (unsigned i = 0; i < n; ++i)
+			x = std::sin(x);
+		return x;
+	};
+
+	mdf::NodeId first = g.AddInstruction("first", loop, mdf::ParamDecl<double>{"x"});
+	mdf::NodeId second = g.AddInstruction("second", loop, mdf::ParamDecl<double>{"x"});
+	mdf::NodeId third = g.AddInstruction("third", loop, mdf::ParamDecl<double>{"x"});
+	g.Connect(first, second, "x");
+	g.Connect(second, third, "x");
+
+	function<unique_ptr<Streamer>()> makeStreamer = [first]() { return unique_ptr<Streamer>{new Streamer{first}}; };
+	function<unique_ptr<Drainer>()> makeDrainer = []() { return unique_ptr<Drainer>{new Drainer}; };
+
+	// The interpreter prints on std::cout, the results go to the original stream buffer
+	ostream results{cout.rdbuf()};
+	cout.rdbuf(nullptr);
+
+	double capacity = mdf::RunOpenLoop<Streamer,Drainer>(g, tn, makeStreamer, makeDrainer,
+			mdf::ArrivalSchedule::Constant(1e12), arrivals / 4).achievedRate;
+	mdf::err.Println("Capacity: ", capacity, " instances/s with ", tn, " threads.");
+
+	chrono::nanoseconds none = chrono::nanoseconds::max();
+	chrono::nanoseconds limit = chrono::microseconds{budget};
+
+	results << "config,load,offered_rate,achieved_rate,goodput,cancelled,missed,p50_us,p99_us,max_us\n";
+	for (double load : {0.5, 0.9, 1.1, 1.5, 2.0}) {
+		mdf::ArrivalSchedule schedule = mdf::ArrivalSchedule::Poisson(load * capacity);
+		mdf::LoadPoint p = mdf::RunOpenLoop<Streamer,Drainer>(g, tn, makeStreamer, makeDrainer, schedule, arrivals, none);
+		WriteRow(results, "none", load, p.achievedRate * p.latency.Fraction(limit), p);
+		p = mdf::RunOpenLoop<Streamer,Drainer>(g, tn, makeStreamer, makeDrainer, schedule, arrivals, limit, mdf::TaskOrder::Fifo);
+		WriteRow(results, "fifo", load, p.goodput, p);
+		p = mdf::RunOpenLoop<Streamer,Drainer>(g, tn, makeStreamer, makeDrainer, schedule, arrivals, limit,
+				mdf::TaskOrder::EarliestDeadlineFirst);
+		WriteRow(results, "edf", load, p.goodput, p);
+	}
+
+	} catch (std::exception& e) {
+		cerr << e.what() << endl;
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,122 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+/*
+ * Elastic pool under bursty load
+ *
+ * Measures the capacity of a small graph (three nodes looping on sin) with
+ * max workers, then offers a bursty open-loop load: periods of on
+ * milliseconds at 80% of the capacity followed by periods of off
+ * milliseconds at 80% / burst of it. The same arrivals are run on a fixed
+ * pool of min workers, a fixed pool of max workers and an elastic pool
+ * between min and max (see ElasticPolicy in mdf/Mdf.hpp), and the latency
+ * percentiles are printed as CSV together with the worker-seconds spent
+ * by each pool.
+ *
+ * Usage: elastic [min] [max] [n] [arrivals] [burst] [on] [off]
+ */
+
+#include <iostream>
+#include <cmath>
+
+#include "../mdf/Mdf.hpp"
+#include "../mdf/LoadGenerator.hpp"
+
+using namespace std;
+
+class Drainer {
+
+public:
+
+	void operator()(mdf::TokenHandle) { }
+
+};
+
+class Streamer {
+
+private:
+
+	mdf::NodeId _first;
+	int _item;
+
+public:
+
+	explicit Streamer(mdf::NodeId first) : _first{first}, _item{0} { }
+
+	vector<mdf::InputTokenContainer> Next()
+	{
+		return vector<mdf::InputTokenContainer>{mdf::InputTokenContainer{_first, "x", mdf::WrapValue<double>(++_item)}};
+	}
+
+};
+
+void WriteRow(ostream& os, const string& config, const mdf::LoadPoint& p)
+{
+	auto us = [](std::chrono::nanoseconds d) { return d.count() / 1000.0; };
+	os << config << "," << p.offeredRate << "," << p.achievedRate << "," << us(p.latency.Percentile(0.5)) << ","
+	   << us(p.latency.Percentile(0.99)) << "," << us(p.latency.Percentile(0.999)) << "," << us(p.latency.Max()) << ","
+	   << p.scaling.workerSeconds << "," << p.scaling.peak << "," << p.scaling.timeline.size() - 1 << "\n";
+}
+
+int main(int argc, char *argv[])
+{
+	try {
+
+	size_t minWorkers = (argc>1) ? stoul(argv[1]) : 1;
+	size_t maxWorkers = (argc>2) ? stoul(argv[2]) : 4;
+	unsigned long n = (argc>3) ? stoul(argv[3]) : 1000;
+	size_t arrivals = (argc>4) ? stoul(argv[4]) : 20000;
+	double burst = (argc>5) ? stod(argv[5]) : 8;
+	long on = (argc>6) ? stol(argv[6]) : 50;
+	long off = (argc>7) ? stol(argv[7]) : 200;
+
+	mdf::Graph g{};
+
+	auto loop = [n](double x) -> double {
+		for (unsigned i = 0; i < n; ++i)
+			x = std::sin(x);
+		return x;
+	};
+
+	mdf::NodeId first = g.AddInstruction("first", loop, mdf::ParamDecl<double>{"x"});
+	mdf::NodeId second = g.AddInstruction("second", loop, mdf::ParamDecl<double>{"x"});
+	mdf::NodeId third = g.AddInstruction("third", loop, mdf::ParamDecl<double>{"x"});
+	g.Connect(first, second, "x");
+	g.Connect(second, third, "x");
+
+	function<unique_ptr<Streamer>()> makeStreamer = [first]() { return unique_ptr<Streamer>{new Streamer{first}}; };
+	function<unique_ptr<Drainer>()> makeDrainer = []() { return unique_ptr<Drainer>{new Drainer}; };
+
+	// The interpreter prints on std::cout, the results go to the original stream buffer
+	ostream results{cout.rdbuf()};
+	cout.rdbuf(nullptr);
+
+	double capacity = mdf::RunOpenLoop<Streamer,Drainer>(g, maxWorkers, makeStreamer, makeDrainer,
+			mdf::ArrivalSchedule::Constant(1e12), arrivals / 4).achievedRate;
+	mdf::err.Println("Capacity: ", capacity, " instances/s with ", maxWorkers, " threads.");
+
+	double peak = 0.8 * capacity;
+	mdf::ArrivalSchedule schedule = mdf::ArrivalSchedule::Bursty(peak / burst, burst,
+			chrono::milliseconds{on}, chrono::milliseconds{off});
+
+	results << "config,offered_rate,achieved_rate,p50_us,p99_us,p999_us,max_us,worker_seconds,peak_workers,resizes\n";
+	WriteRow(results, "fixed-" + to_string(minWorkers), mdf::RunOpenLoop<Streamer,Drainer>(g, minWorkers,
+			makeStreamer, makeDrainer, schedule, arrivals));
+	WriteRow(results, "fixed-" + to_string(maxWorkers), mdf::RunOpenLoop<Streamer,Drainer>(g, maxWorkers,
+			makeStreamer, makeDrainer, schedule, arrivals));
+	WriteRow(results, "elastic-" + to_string(minWorkers) + "-" + to_string(maxWorkers), mdf::RunOpenLoop<Streamer,Drainer>(g,
+			mdf::WorkerPools::Elastic(minWorkers, maxWorkers), makeStreamer, makeDrainer, schedule, arrivals));
+
+	} catch (std::exception& e) {
+		cerr << e.what() << endl;
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,109 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+/*
+ * Latency under load
+ *
+ * Measures the capacity of a small graph (three nodes looping on sin) with
+ * an open-loop run at an unbounded rate, then offers load from 10% to 120%
+ * of that capacity and prints the latency versus throughput curve as CSV
+ * (see mdf/LoadGenerator.hpp). Latencies are measured from the intended
+ * arrival time of each instance.
+ *
+ * Usage: load [tn] [n] [arrivals] [poisson]
+ *   n         iterations of the loop in each node
+ *   arrivals  instances offered at each load level
+ *   poisson   1 for Poisson arrivals (default), 0 for a constant rate
+ */
+
+#include <iostream>
+#include <cmath>
+
+#include "../mdf/Mdf.hpp"
+#include "../mdf/LoadGenerator.hpp"
+
+using namespace std;
+
+class Drainer {
+
+public:
+
+	void operator()(mdf::TokenHandle) { }
+
+};
+
+class Streamer {
+
+private:
+
+	mdf::NodeId _first;
+	int _item;
+
+public:
+
+	explicit Streamer(mdf::NodeId first) : _first{first}, _item{0} { }
+
+	// Never ends, the load generator decides how many instances to read
+	vector<mdf::InputTokenContainer> Next()
+	{
+		return vector<mdf::InputTokenContainer>{mdf::InputTokenContainer{_first, "x", mdf::WrapValue<double>(++_item)}};
+	}
+
+};
+
+int main(int argc, char *argv[])
+{
+	try {
+
+	size_t tn = (argc>1) ? stoul(argv[1]) : 1;
+	unsigned long n = (argc>2) ? stoul(argv[2]) : 1000;
+	size_t arrivals = (argc>3) ? stoul(argv[3]) : 5000;
+	bool poisson = (argc>4) ? stoi(argv[4]) != 0 : true;
+
+	mdf::Graph g{};
+
+	auto loop = [n](double x) -> double {
+		for (unsigned i = 0; i < n; ++i)
+			x = std::sin(x);
+		return x;
+	};
+
+	mdf::NodeId first = g.AddInstruction("first", loop, mdf::ParamDecl<double>{"x"});
+	mdf::NodeId second = g.AddInstruction("second", loop, mdf::ParamDecl<double>{"x"});
+	mdf::NodeId third = g.AddInstruction("third", loop, mdf::ParamDecl<double>{"x"});
+	g.Connect(first, second, "x");
+	g.Connect(second, third, "x");
+
+	function<unique_ptr<Streamer>()> makeStreamer = [first]() { return unique_ptr<Streamer>{new Streamer{first}}; };
+	function<unique_ptr<Drainer>()> makeDrainer = []() { return unique_ptr<Drainer>{new Drainer}; };
+
+	// The interpreter prints on std::cout, the curve goes to the original stream buffer
+	ostream results{cout.rdbuf()};
+	cout.rdbuf(nullptr);
+
+	mdf::ArrivalSchedule schedule = poisson ? mdf::ArrivalSchedule::Poisson(1) : mdf::ArrivalSchedule::Constant(1);
+
+	// Every arrival is already late at an unbounded rate, so the interpreter runs closed-loop
+	double capacity = mdf::RunOpenLoop<Streamer,Drainer>(g, tn, makeStreamer, makeDrainer,
+			schedule.WithRate(1e12), arrivals).achievedRate;
+	mdf::err.Println("Capacity: ", capacity, " instances/s with ", tn, " threads.");
+
+	vector<double> rates;
+	for (int k = 1; k <= 12; ++k)
+		rates.push_back(capacity * k / 10.0);
+
+	mdf::WriteLoadCurve(results, mdf::SweepLoad<Streamer,Drainer>(g, tn, makeStreamer, makeDrainer, schedule, rates, arrivals));
+
+	} catch (std::exception& e) {
+		cerr << e.what() << endl;
+		return -1;
+	}
+
+	return 0;
+}
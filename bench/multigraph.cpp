@@ -0,0 +1,128 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+/*
+ * Graphs sharing a runtime
+ *
+ * Runs a heavy pipeline (three nodes looping n times on sin) and a light
+ * one (looping n/50 times) on one Runtime (see mdf/Runtime.hpp), both
+ * streaming instances for the given number of seconds so that they
+ * compete for the workers the whole time. The run is repeated with the
+ * weights 1:1, 1:3 and 3:1 and the share of execution time of each graph
+ * is printed as CSV next to its share of the weights.
+ *
+ * Usage: multigraph [tn] [seconds] [n]
+ */
+
+#include <iostream>
+#include <cmath>
+#include <atomic>
+#include <thread>
+
+#include "../mdf/Mdf.hpp"
+#include "../mdf/Runtime.hpp"
+
+using namespace std;
+
+class Drainer {
+
+	shared_ptr<atomic<size_t>> _count;
+
+public:
+
+	explicit Drainer(shared_ptr<atomic<size_t>> count) : _count{count} { }
+
+	void operator()(mdf::TokenHandle) { ++*_count; }
+
+};
+
+// Streams instances until the deadline
+class Streamer {
+
+	mdf::NodeId _first;
+	chrono::steady_clock::time_point _deadline;
+	int _item;
+
+public:
+
+	Streamer(mdf::NodeId first, chrono::steady_clock::time_point deadline) : _first{first}, _deadline{deadline}, _item{0} { }
+
+	vector<mdf::InputTokenContainer> Next()
+	{
+		if (chrono::steady_clock::now() >= _deadline)
+			return vector<mdf::InputTokenContainer>{};
+		return vector<mdf::InputTokenContainer>{mdf::InputTokenContainer{_first, "x", mdf::WrapValue<double>(++_item)}};
+	}
+
+};
+
+mdf::Graph Pipeline(unsigned long n)
+{
+	auto loop = [n](double x) -> double {
+		for (unsigned i = 0; i < n; ++i)
+			x = std::sin(x);
+		return x;
+	};
+
+	mdf::Graph g{};
+	mdf::NodeId first = g.AddInstruction("first", loop, mdf::ParamDecl<double>{"x"});
+	mdf::NodeId second = g.AddInstruction("second", loop, mdf::ParamDecl<double>{"x"});
+	mdf::NodeId third = g.AddInstruction("third", loop, mdf::ParamDecl<double>{"x"});
+	g.Connect(first, second, "x");
+	g.Connect(second, third, "x");
+	return g;
+}
+
+int main(int argc, char *argv[])
+{
+	try {
+
+	size_t tn = (argc>1) ? stoul(argv[1]) : 2;
+	double seconds = (argc>2) ? stod(argv[2]) : 1;
+	unsigned long n = (argc>3) ? stoul(argv[3]) : 20000;
+
+	mdf::Graph heavy = Pipeline(n);
+	mdf::Graph light = Pipeline(n / 50 > 0 ? n / 50 : 1);
+
+	// The interpreter prints on std::cout, the results go to the original stream buffer
+	ostream results{cout.rdbuf()};
+	cout.rdbuf(nullptr);
+
+	results << "weights,graph,weight_share,time_share,instances,instances_per_second\n";
+	vector<pair<double,double>> weights{{1, 1}, {1, 3}, {3, 1}};
+	for (auto& w : weights) {
+		mdf::Runtime runtime{tn};
+		auto deadline = chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(seconds));
+		Streamer heavyStreamer{0, deadline};
+		Streamer lightStreamer{0, deadline};
+		auto heavyCount = make_shared<atomic<size_t>>(0);
+		auto lightCount = make_shared<atomic<size_t>>(0);
+		runtime.Add(heavy, unique_ptr<Drainer>{new Drainer{heavyCount}}, heavyStreamer, w.first, "heavy");
+		runtime.Add(light, unique_ptr<Drainer>{new Drainer{lightCount}}, lightStreamer, w.second, "light");
+		runtime.Run();
+
+		mdf::RuntimeReport r = runtime.Report();
+		double busy = 0;
+		for (auto& g : r.graphs)
+			busy += g.busy.count();
+		double elapsed = r.elapsed.count() / 1e9;
+		size_t counts[] = {heavyCount->load(), lightCount->load()};
+		for (size_t k = 0; k < r.graphs.size(); ++k) {
+			results << w.first << ":" << w.second << "," << r.graphs[k].name << "," << r.graphs[k].weight / (w.first + w.second) << ","
+			        << (busy > 0 ? r.graphs[k].busy.count() / busy : 0) << "," << counts[k] << "," << counts[k] / elapsed << "\n";
+		}
+	}
+
+	} catch (std::exception& e) {
+		cerr << e.what() << endl;
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,133 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+/*
+ * Scaling prediction
+ *
+ * Runs the sinloops graph once with one worker to record the cost of each
+ * node, then predicts with the offline simulator (mdf/Simulator.hpp) the
+ * throughput, latency and utilization of the stream with 1 to maxWorkers
+ * workers and each scheduling policy. The scheduling overhead per task is
+ * estimated from the same run.
+ *
+ * Usage: simulate [items] [n] [maxWorkers]
+ *   n  iterations of the loop in each node
+ */
+
+#ifndef MDF_ENABLE_STATS
+#define MDF_ENABLE_STATS
+#endif
+
+#include <iostream>
+#include <chrono>
+#include <cmath>
+
+#include "../mdf/Mdf.hpp"
+#include "../mdf/Simulator.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+const double PI = 3.14159265358979323846;
+
+class Drainer {
+
+public:
+
+	void operator()(mdf::TokenHandle) { }
+
+};
+
+class Streamer {
+
+private:
+
+	mdf::NodeId _i1, _i6;
+	const int _maxItems;
+	int _numItems;
+
+public:
+
+	Streamer(mdf::NodeId i1, mdf::NodeId i6, int maxItems) : _i1{i1}, _i6{i6}, _maxItems{maxItems}, _numItems{0} { }
+
+	vector<mdf::InputTokenContainer> Next()
+	{
+		vector<mdf::InputTokenContainer> input;
+		if (_numItems++ < _maxItems) {
+			input.emplace_back(mdf::InputTokenContainer{_i1, "input1", mdf::WrapValue<int>(_numItems)});
+			input.emplace_back(mdf::InputTokenContainer{_i1, "input2", mdf::WrapValue<double>(PI/_numItems)});
+			input.emplace_back(mdf::InputTokenContainer{_i6, "counter", mdf::WrapValue<int>(_numItems)});
+		}
+		return input;
+	}
+
+};
+
+int main(int argc, char *argv[])
+{
+	try {
+
+	int items = (argc>1) ? stoi(argv[1]) : 2000;
+	unsigned long n = (argc>2) ? stoul(argv[2]) : 1000;
+	size_t maxWorkers = (argc>3) ? stoul(argv[3]) : 16;
+
+	auto loop = [n](double x) -> double {
+		for (unsigned i = 0; i < n; ++i)
+			x = std::sin(x);
+		return x;
+	};
+
+	mdf::Graph g{};
+	mdf::NodeId i1 = g.AddInstruction("i_1", [loop](int in1, double in2) -> double { return loop(in1+in2); },
+			mdf::ParamDecl<int>{"input1"}, mdf::ParamDecl<double>{"input2"});
+	mdf::NodeId i2 = g.AddInstruction("i_2", [loop](double x) -> double { return loop(x + 1.0); }, mdf::ParamDecl<double>{"x"});
+	mdf::NodeId i3 = g.AddInstruction("i_3", [loop](double x) -> double { return loop(x + 2.0); }, mdf::ParamDecl<double>{"x"});
+	mdf::NodeId i4 = g.AddInstruction("i_4", [loop](double x) -> double { return loop(x + 3.0); }, mdf::ParamDecl<double>{"x"});
+	mdf::NodeId i5 = g.AddInstruction("i_5", [loop](double y1, double y2) -> double { return loop(y1 + y2 + 4.0); },
+			mdf::ParamDecl<double>{"y1"}, mdf::ParamDecl<double>{"y2"});
+	mdf::NodeId i6 = g.AddInstruction("i_6", [loop](double y, double z, int c) -> pair<int,double> { return make_pair(c, loop(y + z + 5.0)); },
+			mdf::ParamDecl<double>{"y"}, mdf::ParamDecl<double>{"z"}, mdf::ParamDecl<int>{"counter"});
+	g.Connect(i1, i2, "x");
+	g.Connect(i1, i3, "x");
+	g.Connect(i1, i4, "x");
+	g.Connect(i2, i5, "y1");
+	g.Connect(i3, i5, "y2");
+	g.Connect(i5, i6, "y");
+	g.Connect(i4, i6, "z");
+
+	// Record the node costs with one worker
+	mdf::Mdf<Drainer> engine{g, 1, unique_ptr<Drainer>{new Drainer}};
+	auto t0 = steady_clock::now();
+	engine.Start(unique_ptr<Streamer>{new Streamer{i1, i6, items}});
+	nanoseconds elapsed = duration_cast<nanoseconds>(steady_clock::now() - t0);
+
+	mdf::CostProfile profile = mdf::CostProfile::FromStatistics(engine.Statistics(), items);
+	mdf::GraphAnalysis analysis = mdf::AnalyzeGraph(g, profile);
+	profile.taskOverhead = max(nanoseconds{0}, (elapsed - analysis.work * items) / (items * static_cast<long>(g.N())));
+
+	mdf::out.Println("Measured with 1 worker: ", items / duration<double>(elapsed).count(), " instances/s, overhead ",
+			profile.taskOverhead.count(), " ns per task.");
+	mdf::PrintAnalysis(analysis, g);
+
+	vector<size_t> workers;
+	for (size_t tn = 1; tn <= maxWorkers; ++tn)
+		workers.push_back(tn);
+
+	for (mdf::SimPolicy policy : {mdf::SimPolicy::WorkStealing, mdf::SimPolicy::LifoWorkStealing, mdf::SimPolicy::SharedQueue}) {
+		mdf::SimulationConfig config{1, static_cast<size_t>(items), nanoseconds{0}, policy, 100};
+		mdf::PrintSimulation(mdf::PredictScaling(g, profile, config, workers));
+	}
+
+	} catch (std::exception& e) {
+		cerr << e.what() << endl;
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,139 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+/*
+ * Mdf example with an asynchronous instruction
+ *
+ * Graph topology:
+ *
+ *    prepare -> fetch -> finish
+ *
+ * fetch stands for a request to a remote service that answers after wait
+ * milliseconds. The asynchronous version arms a timer on the reactor and
+ * releases the worker, so the waits of many instances overlap and the
+ * workers keep computing; the blocking version sleeps inside the
+ * instruction and occupies a worker for the whole wait.
+ *
+ * Usage: async [items] [tn] [n] [wait]
+ */
+
+#include <iostream>
+#include <cmath>
+#include <chrono>
+#include <thread>
+
+#include "../mdf/Mdf.hpp"
+#include "../mdf/Reactor.hpp"
+
+using namespace std;
+
+class Drainer {
+
+	size_t _count;
+
+public:
+
+	Drainer() : _count{0} { }
+
+	void operator()(mdf::TokenHandle token)
+	{
+		if (dynamic_pointer_cast<mdf::Value<double>>(token))
+			_count++;
+		else
+			mdf::out.Println("Drainer: downcast failed.");
+	}
+
+	size_t Count() const { return _count; }
+
+};
+
+class Streamer {
+
+	mdf::NodeId _first;
+	int _maxItems;
+	int _numItems;
+
+public:
+
+	Streamer(mdf::NodeId first, int maxItems) : _first{first}, _maxItems{maxItems}, _numItems{0} { }
+
+	vector<mdf::InputTokenContainer> Next()
+	{
+		if (_numItems >= _maxItems)
+			return vector<mdf::InputTokenContainer>{};
+		return vector<mdf::InputTokenContainer>{mdf::InputTokenContainer{_first, "x", mdf::WrapValue<double>(++_numItems)}};
+	}
+
+};
+
+// Runs the graph and returns the elapsed seconds
+double Run(const mdf::Graph& g, mdf::NodeId first, int numItems, size_t tn)
+{
+	mdf::Mdf<Drainer> engine{g, tn, unique_ptr<Drainer>{new Drainer}};
+	auto t0 = chrono::steady_clock::now();
+	engine.Start(unique_ptr<Streamer>{new Streamer{first, numItems}});
+	return chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+}
+
+int main(int argc, char *argv[])
+{
+	try {
+
+	int numItems = (argc>1) ? stoi(argv[1]) : 200;
+	size_t tn = (argc>2) ? stoul(argv[2]) : 1;
+	unsigned long n = (argc>3) ? stoul(argv[3]) : 10000;
+	unsigned long wait = (argc>4) ? stoul(argv[4]) : 10;
+
+	auto loop = [n](double x) -> double {
+		for (unsigned i = 0; i < n; ++i)
+			x = std::sin(x);
+		return x;
+	};
+
+	mdf::Reactor reactor;
+
+	mdf::Graph async{};
+	mdf::NodeId first = async.AddInstruction("prepare", loop, mdf::ParamDecl<double>{"x"});
+	mdf::NodeId fetch = async.AddAsyncInstruction<double>(
+			[&reactor, wait](mdf::Completion<double> done, double x) {
+				reactor.After(chrono::milliseconds{wait}, [done, x]() { done(x + 1.0); });
+			},
+			mdf::ParamDecl<double>{"x"});
+	async.SetLabel(fetch, "fetch");
+	mdf::NodeId last = async.AddInstruction("finish", loop, mdf::ParamDecl<double>{"x"});
+	async.Connect(first, fetch, "x");
+	async.Connect(fetch, last, "x");
+
+	mdf::Graph blocking{};
+	blocking.AddInstruction("prepare", loop, mdf::ParamDecl<double>{"x"});
+	blocking.AddInstruction("fetch",
+			[wait](double x) -> double {
+				this_thread::sleep_for(chrono::milliseconds{wait});
+				return x + 1.0;
+			},
+			mdf::ParamDecl<double>{"x"});
+	blocking.AddInstruction("finish", loop, mdf::ParamDecl<double>{"x"});
+	blocking.Connect(0, 1, "x");
+	blocking.Connect(1, 2, "x");
+
+	mdf::out.Println("Streaming ", numItems, " items, running ", tn, " threads, waiting ", wait, " ms in fetch.");
+
+	double ta = Run(async, first, numItems, tn);
+	double tb = Run(blocking, 0, numItems, tn);
+
+	cout << "Asynchronous fetch: " << ta << " s" << endl;
+	cout << "Blocking fetch: " << tb << " s" << endl;
+
+	} catch (std::exception& e) {
+		cout << e.what() << endl;
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,161 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+/*
+ * Mdf example (shared buffers)
+ * This example uses mdf to compute a stream of matrix vector multiplications
+ * The matrix, the vector and the output of each item live in pooled buffers
+ * that flow through the graph without copies. A map instruction splits the
+ * rows at runtime, and each chunk writes its slice of the output vector and
+ * returns the slices it worked on. The buffers go back to the pool when the
+ * drainer releases the last slice, without any explicit cleanup.
+ *
+ */
+
+#include <cmath>
+
+#include <utility>
+#include <sstream>
+#include <random>
+#include <chrono>
+
+#include "../mdf/Mdf.hpp"
+#include "../mdf/Buffer.hpp"
+#include "../mdf/PrefetchStreamer.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+// Rows of the matrix and of the output vector computed by one chunk
+struct RowBlock {
+	mdf::Buffer<const double> mat;
+	mdf::Buffer<const double> vec;
+	mdf::Buffer<double> out;
+};
+
+class Drainer {
+	
+public:
+
+	void operator()(mdf::TokenHandle token)
+	{
+		mdf::ValueHandle<vector<RowBlock>> result = dynamic_pointer_cast<mdf::Value<vector<RowBlock>>>(token);
+		if (result)	{
+			for (auto& block : result->GetValue()) {
+				size_t dim = block.vec.Size();
+				for (size_t i = 0; i < block.out.Size(); ++i) {
+					double prod = 0;
+					for (size_t j = 0; j < dim; ++j) {
+						prod += sin(block.mat[i*dim+j] * block.vec[j]);
+					}
+					assert(sin(prod) == block.out[i]);
+				}
+			}
+		} else
+			mdf::out.Println("Drainer: downcast failed.");
+	}
+
+};
+
+class Streamer {
+
+private:
+
+	mdf::NodeId _multiply;
+	size_t _dim;
+	const int _maxItems;
+	int _numItems;
+
+public:
+
+	Streamer(mdf::NodeId multiply, size_t dim, int maxItems) : _multiply{multiply}, _dim{dim}, _maxItems{maxItems}, _numItems{0}
+	{
+		assert(_maxItems > 0);
+	}
+
+	vector<mdf::InputTokenContainer> Next()
+	{
+		vector<mdf::InputTokenContainer> input;
+		if (_numItems++ < _maxItems) {
+			mdf::Buffer<double> mat = mdf::AllocateBuffer<double>(_dim*_dim);
+			mdf::Buffer<double> vec = mdf::AllocateBuffer<double>(_dim);
+			for (size_t k = 0; k < _dim*_dim; ++k)
+				mat[k] = k/(double)_numItems;
+			for (size_t k = 0; k < _dim; ++k)
+				vec[k] = 1.0 + (k/(double) _numItems);
+
+			input.emplace_back(mdf::InputTokenContainer{_multiply, "rows", mdf::WrapValue(mdf::IndexRange{0, _dim})});
+			input.emplace_back(mdf::InputTokenContainer{_multiply, "mat", mdf::WrapValue<mdf::Buffer<const double>>(mat)});
+			input.emplace_back(mdf::InputTokenContainer{_multiply, "vec", mdf::WrapValue<mdf::Buffer<const double>>(vec)});
+			input.emplace_back(mdf::InputTokenContainer{_multiply, "out", mdf::WrapValue(mdf::AllocateBuffer<double>(_dim))});
+		}
+
+		return input;
+	}
+
+};
+
+int main(int argc, char *argv[])
+{
+	try {
+	
+	size_t dim = (argc>1) ? stoul(argv[1]) : 10; 
+	size_t tn = (argc>2) ? stoul(argv[2]) : 1; 
+	int numItems = (argc>3) ? stoi(argv[3]) : 100;
+	size_t prefetch = (argc>4) ? stoul(argv[4]) : 0;
+
+	tn = min(tn, dim);
+
+	mdf::out.Println("Streaming ", numItems, " items of dimension ", dim, ", running ", tn, " threads.");
+
+	mdf::Graph g{};
+
+	// Chunks of at least grain rows, split further while some worker is idle
+	size_t grain = max<size_t>(1, dim / (4*tn));
+
+	mdf::NodeId multiply = g.AddMapInstruction(
+			[dim](mdf::IndexRange rows, mdf::Buffer<const double> mat, mdf::Buffer<const double> vec, mdf::Buffer<double> out) -> RowBlock {
+				for (size_t k = rows.begin; k < rows.end; ++k) {
+					double prod = 0;
+					for (size_t i = 0; i < dim; ++i)
+						prod += sin(mat[k*dim+i] * vec[i]);
+					out[k] = sin(prod);
+				}
+				return RowBlock{mat.Slice(rows.begin*dim, rows.Size()*dim), vec, out.Slice(rows.begin, rows.Size())};
+			},
+			grain,
+			mdf::ParamDecl<mdf::IndexRange>{"rows"},
+			mdf::ParamDecl<mdf::Buffer<const double>>{"mat"},
+			mdf::ParamDecl<mdf::Buffer<const double>>{"vec"},
+			mdf::ParamDecl<mdf::Buffer<double>>{"out"});
+
+	unique_ptr<Streamer> streamer{new Streamer{multiply, dim, numItems}};
+
+	mdf::Mdf<Drainer> engine{g, tn, unique_ptr<Drainer>{new Drainer}};
+
+	if (prefetch > 0) {
+		// Generate the matrices on a separate thread, up to prefetch items ahead
+		auto prefetcher = engine.Start(mdf::MakePrefetchStreamer(move(streamer), prefetch));
+		mdf::PrefetchStatistics stats = prefetcher->Statistics();
+		mdf::out.Println("Prefetched ", stats.items, " items, producer waited ", stats.producerWaits, " times (",
+				duration_cast<milliseconds>(stats.producerWaitTime).count(), " ms), interpreter waited ", stats.consumerWaits,
+				" times (", duration_cast<milliseconds>(stats.consumerWaitTime).count(), " ms).");
+		streamer = prefetcher->Release();
+	} else {
+		streamer = engine.Start(move(streamer));
+	}
+
+	} catch (std::exception& e) {
+		cout << e.what() << endl;
+		return -1;
+	}
+
+	return 0;
+}
+
@@ -24,6 +24,7 @@
 #include <chrono>
 
 #include "../mdf/Mdf.hpp"
+#include "../mdf/PrefetchStreamer.hpp"
 
 using namespace std;
 using namespace std::chrono;
@@ -103,7 +104,6 @@ public:
 			input.emplace_back(mdf::InputTokenContainer{_sink, "mat", mdf::WrapValue<double*>(mat)});
 			input.emplace_back(mdf::InputTokenContainer{_sink, "vec", mdf::WrapValue<double*>(vec)});
 			input.emplace_back(mdf::InputTokenContainer{_sink, "out", mdf::WrapValue<double*>(out)});
-			input.emplace_back(mdf::InputTokenContainer{_sink, "dim", mdf::WrapValue<size_t>(_dim)});
 		}
 
 		return input;
@@ -118,6 +118,7 @@ int main(int argc, char *argv[])
 	size_t dim = (argc>1) ? stoul(argv[1]) : 10; 
 	size_t tn = (argc>2) ? stoul(argv[2]) : 1; 
 	int numItems = (argc>3) ? stoi(argv[3]) : 100;
+	size_t prefetch = (argc>4) ? stoul(argv[4]) : 0;
 
 	tn = min(tn, dim);
 
@@ -144,14 +145,15 @@ int main(int argc, char *argv[])
 	}
 
 	mdf::NodeId sink = g.AddInstruction(
-			[dim](double *mat, double *vec, double *out, size_t dim) -> struct cleanup {
+			[](double *mat, double *vec, double *out, size_t dim) -> struct cleanup {
 				return {mat, vec, out, dim}; // Simply forward to the drainer
 			},
 			mdf::ParamDecl<double*>{"mat"},
 			mdf::ParamDecl<double*>{"vec"},
 			mdf::ParamDecl<double*>{"out"},
 			mdf::ParamDecl<size_t>{"dim"});
-		
+
+	g.BindConstant(sink, "dim", dim);
 
 	for (size_t i = 0; i < computeNodes.size(); ++i)
 		g.DeclareDependency(computeNodes[i], sink);
@@ -161,7 +163,17 @@ int main(int argc, char *argv[])
 
 	mdf::Mdf<Drainer> engine{g, tn, unique_ptr<Drainer>{new Drainer}};
 
-	streamer = engine.Start(move(streamer));
+	if (prefetch > 0) {
+		// Generate the matrices on a separate thread, up to prefetch items ahead
+		auto prefetcher = engine.Start(mdf::MakePrefetchStreamer(move(streamer), prefetch));
+		mdf::PrefetchStatistics stats = prefetcher->Statistics();
+		mdf::out.Println("Prefetched ", stats.items, " items, producer waited ", stats.producerWaits, " times (",
+				duration_cast<milliseconds>(stats.producerWaitTime).count(), " ms), interpreter waited ", stats.consumerWaits,
+				" times (", duration_cast<milliseconds>(stats.consumerWaitTime).count(), " ms).");
+		streamer = prefetcher->Release();
+	} else {
+		streamer = engine.Start(move(streamer));
+	}
 
 	} catch (std::exception& e) {
 		cout << e.what() << endl;
@@ -0,0 +1,178 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+/*
+ * Load generator for frame_server.cpp
+ * Opens a number of connections to the server, each one sending frames
+ * of random bytes from one thread and reading the responses from another.
+ * Checks every checksum and reports the throughput and the round trip
+ * latencies.
+ */
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../mdf/Printer.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+uint64_t Checksum(const char *data, size_t size)
+{
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0; i < size; ++i) {
+		h ^= static_cast<unsigned char>(data[i]);
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+int Connect(const string& path)
+{
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+		throw system_error(errno, generic_category(), "Cannot connect to " + path);
+	return fd;
+}
+
+void WriteAll(int fd, const char *data, size_t size)
+{
+	while (size > 0) {
+		ssize_t n = write(fd, data, size);
+		if (n <= 0)
+			throw system_error(errno, generic_category(), "write failed");
+		data += n;
+		size -= n;
+	}
+}
+
+bool ReadAll(int fd, char *data, size_t size)
+{
+	while (size > 0) {
+		ssize_t n = read(fd, data, size);
+		if (n <= 0)
+			return false;
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+struct Client {
+	int fd;
+	vector<uint64_t> expected;
+	vector<steady_clock::time_point> sent;
+	vector<double> latencies; // Microseconds
+	size_t errors;
+};
+
+void Send(Client& c, size_t numFrames, size_t frameSize, unsigned seed)
+{
+	mt19937 rng{seed};
+	vector<char> frame(sizeof(uint32_t) + frameSize);
+	uint32_t len = static_cast<uint32_t>(frameSize);
+	memcpy(frame.data(), &len, sizeof(len));
+	for (size_t i = 0; i < numFrames; ++i) {
+		for (size_t k = 0; k < frameSize; ++k)
+			frame[sizeof(uint32_t) + k] = static_cast<char>(rng());
+		c.expected[i] = Checksum(frame.data() + sizeof(uint32_t), frameSize);
+		c.sent[i] = steady_clock::now();
+		WriteAll(c.fd, frame.data(), frame.size());
+	}
+	shutdown(c.fd, SHUT_WR);
+}
+
+void Receive(Client& c, size_t numFrames)
+{
+	for (size_t i = 0; i < numFrames; ++i) {
+		uint32_t header[2];
+		uint64_t sum;
+		if (!ReadAll(c.fd, reinterpret_cast<char*>(header), sizeof(header)) || header[0] != sizeof(sum)
+				|| !ReadAll(c.fd, reinterpret_cast<char*>(&sum), sizeof(sum)) || header[1] >= numFrames) {
+			c.errors += numFrames - i;
+			return;
+		}
+		c.latencies.push_back(duration_cast<nanoseconds>(steady_clock::now() - c.sent[header[1]]).count() / 1000.0);
+		if (sum != c.expected[header[1]])
+			c.errors++;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	try {
+
+	string path = (argc>1) ? argv[1] : "/tmp/mdf.sock";
+	size_t connections = (argc>2) ? stoul(argv[2]) : 1;
+	size_t numFrames = (argc>3) ? stoul(argv[3]) : 10000;
+	size_t frameSize = (argc>4) ? stoul(argv[4]) : 256;
+
+	mdf::out.Println("Sending ", numFrames, " frames of ", frameSize, " bytes on each of ", connections, " connections.");
+
+	vector<Client> clients(connections);
+	for (auto& c : clients) {
+		c.fd = Connect(path);
+		c.expected.resize(numFrames);
+		c.sent.resize(numFrames);
+		c.latencies.reserve(numFrames);
+		c.errors = 0;
+	}
+
+	auto t0 = steady_clock::now();
+
+	vector<thread> threads;
+	for (size_t i = 0; i < connections; ++i) {
+		threads.emplace_back(Send, ref(clients[i]), numFrames, frameSize, unsigned(i));
+		threads.emplace_back(Receive, ref(clients[i]), numFrames);
+	}
+	for (auto& t : threads)
+		t.join();
+
+	double elapsed = duration_cast<microseconds>(steady_clock::now() - t0).count() / 1e6;
+
+	vector<double> latencies;
+	size_t errors = 0;
+	for (auto& c : clients) {
+		close(c.fd);
+		latencies.insert(latencies.end(), c.latencies.begin(), c.latencies.end());
+		errors += c.errors;
+	}
+	sort(latencies.begin(), latencies.end());
+
+	mdf::out.Println("Received ", latencies.size(), " responses in ", elapsed, " s (", latencies.size() / elapsed, " frames/s), ", errors, " errors.");
+	if (!latencies.empty()) {
+		mdf::out.Println("Latency (us): p50 ", latencies[latencies.size() / 2],
+				", p99 ", latencies[latencies.size() * 99 / 100], ", max ", latencies.back());
+	}
+
+	return errors == 0 ? 0 : 1;
+
+	} catch (std::exception& e) {
+		cout << e.what() << endl;
+		return -1;
+	}
+}
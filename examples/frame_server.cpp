@@ -0,0 +1,68 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+/*
+ * Mdf example (local service)
+ * Serves requests sent over a Unix domain socket by frame_client.cpp: each
+ * request frame becomes a graph instance, and the checksum of its payload
+ * is sent back on the same connection.
+ *
+ * Graph topology:
+ *
+ *     checksum
+ */
+
+#include <iostream>
+#include <cstdint>
+
+#include "../mdf/Mdf.hpp"
+#include "../mdf/FrameStream.hpp"
+
+using namespace std;
+
+// 64-bit FNV-1a, computed directly on the bytes of the receive buffer
+uint64_t Checksum(mdf::FrameView frame)
+{
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0; i < frame.Size(); ++i) {
+		h ^= static_cast<unsigned char>(frame.data[i]);
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+int main(int argc, char *argv[])
+{
+	try {
+
+	string path = (argc>1) ? argv[1] : "/tmp/mdf.sock";
+	size_t tn = (argc>2) ? stoul(argv[2]) : 1;
+	size_t connections = (argc>3) ? stoul(argv[3]) : 1;
+
+	mdf::out.Println("Listening on ", path, ", running ", tn, " threads, serving ", connections, " connections (0 means forever).");
+
+	mdf::Graph g{};
+	mdf::NodeId idChecksum = g.AddInstruction(&Checksum, mdf::ParamDecl<mdf::FrameView>{"frame"});
+
+	using Drainer = mdf::FrameDrainer<uint64_t>;
+
+	auto router = make_shared<mdf::FrameRouter>();
+	unique_ptr<mdf::FrameStreamer> streamer{new mdf::FrameStreamer{router, g.Port(idChecksum, "frame")}};
+	streamer->Listen(path, connections);
+
+	mdf::Mdf<Drainer> engine{g, tn, unique_ptr<Drainer>{new Drainer{router}}};
+	streamer = engine.Start(move(streamer));
+
+	} catch (std::exception& e) {
+		cout << e.what() << endl;
+		return -1;
+	}
+
+	return 0;
+}
@@ -87,8 +87,7 @@ class Streamer {
 
 private:
 
-	vector<mdf::NodeId> _nodes;
-	int *_hptr;
+	mdf::NodeId _node;
 	int _index;
 
 	const int nblocks = (SIZE/BLOCK_SIZE) * (SIZE/BLOCK_SIZE);
@@ -96,7 +95,7 @@ private:
 
 public:
 
-	Streamer(vector<mdf::NodeId> nodes, int *hptr) : _nodes{nodes}, _hptr{hptr}, _index{0}
+	Streamer(mdf::NodeId node) : _node{node}, _index{0}
 	{
 		mdf::out.Println("Streamer will generate ", nblocks, " blocks");
 	}
@@ -106,12 +105,10 @@ public:
 		vector<mdf::InputTokenContainer> input;
 		if (_index < nblocks) {
 			int x0 = (_index % blocks_per_side)*BLOCK_SIZE;
-			int ybase = SIZE - 1 - (_index / blocks_per_side)*BLOCK_SIZE;
-			for (int i = 0; i < BLOCK_SIZE/N_LINES; ++i) {
-				input.emplace_back(mdf::InputTokenContainer{_nodes[i], "hst", mdf::WrapValue<int*>(_hptr)});
-				input.emplace_back(mdf::InputTokenContainer{_nodes[i], "x0", mdf::WrapValue<int>(x0)});
-				input.emplace_back(mdf::InputTokenContainer{_nodes[i], "y0", mdf::WrapValue<int>(ybase-i*N_LINES)});
-			}
+			int y0 = SIZE - 1 - (_index / blocks_per_side)*BLOCK_SIZE;
+			input.emplace_back(mdf::InputTokenContainer{_node, "lines", mdf::WrapValue<mdf::IndexRange>({0, BLOCK_SIZE})});
+			input.emplace_back(mdf::InputTokenContainer{_node, "x0", mdf::WrapValue<int>(x0)});
+			input.emplace_back(mdf::InputTokenContainer{_node, "y0", mdf::WrapValue<int>(y0)});
 			++_index;
 		}
 
@@ -134,61 +131,51 @@ int main(int argc, char *argv[])
 	double h = 0.13182603415081157061 - (0.13182588262473313035);
 
 	mdf::Graph g{};
-	
-	constexpr int nsplits = BLOCK_SIZE / N_LINES;
-
-	vector<vector<mdf::NodeId>> stages;
-
-	stages.emplace_back(vector<mdf::NodeId>{});
-	stages[0].reserve(nsplits);
-
-	for (int i = 0; i < nsplits; ++i) {
-		auto id = g.AddInstruction(
-				[re0, w, im0, h](int *hst, int x0, int y0) -> int {
-					int maxIter = 0;
-					for (int k = 0; k < N_LINES; ++k) {
-						for (int j = 0; j < BLOCK_SIZE; ++j) {
-							double reC = re0 + (x0+j)*w/SIZE;
-							double imC = im0 + (y0-k)*h/SIZE;
-							double re = 0.0, im = 0.0;
-							int i = 0;
-							while (i < MAX_ITER && re*re + im*im <= 4.0) {
-								double tmpre = re*re - im*im + reC;
-								im = 2.0*re*im + imC;
-								re = tmpre;
-								++i;
-							}
-							hst[(SIZE - 1 -(y0-k))*SIZE + (x0+j)] = i;
-							if (maxIter < i) maxIter = i;
+
+	// Each block is split at runtime in chunks of at least N_LINES lines
+	mdf::NodeId block = g.AddMapInstruction(
+			[re0, w, im0, h](mdf::IndexRange lines, int *hst, int x0, int y0) -> int {
+				int maxIter = 0;
+				for (size_t k = lines.begin; k < lines.end; ++k) {
+					for (int j = 0; j < BLOCK_SIZE; ++j) {
+						double reC = re0 + (x0+j)*w/SIZE;
+						double imC = im0 + (y0-(int)k)*h/SIZE;
+						double re = 0.0, im = 0.0;
+						int i = 0;
+						while (i < MAX_ITER && re*re + im*im <= 4.0) {
+							double tmpre = re*re - im*im + reC;
+							im = 2.0*re*im + imC;
+							re = tmpre;
+							++i;
 						}
+						hst[(SIZE - 1 -(y0-(int)k))*SIZE + (x0+j)] = i;
+						if (maxIter < i) maxIter = i;
 					}
-					return maxIter;
-				},
-				mdf::ParamDecl<int*>{"hst"},
-				mdf::ParamDecl<int>{"x0"},
-				mdf::ParamDecl<int>{"y0"});
-		stages[0].push_back(id);
-	}
+				}
+				return maxIter;
+			},
+			N_LINES,
+			mdf::ParamDecl<mdf::IndexRange>{"lines"},
+			mdf::ParamDecl<int*>{"hst"},
+			mdf::ParamDecl<int>{"x0"},
+			mdf::ParamDecl<int>{"y0"});
 
-	for (int s = nsplits >> 1, k = 1; s > 0; s >>= 1, k++) {
-		stages.emplace_back(vector<mdf::NodeId>{});
-		stages[k].reserve(s);
-		for (int i = 0; i < s; ++i) {
-			stages[k].push_back(g.AddInstruction(
-					[](int a, int b) -> int { return a>b ? a : b; },
-					mdf::ParamDecl<int>{"a"},
-					mdf::ParamDecl<int>{"b"}));
-			g.Connect(stages[k-1][i*2], stages[k][i], "a");
-			g.Connect(stages[k-1][i*2+1], stages[k][i], "b");
-		}
-	}
+	// The chunk maxima are combined as soon as each chunk completes
+	mdf::NodeId maxNode = g.AddReduceInstruction(
+			[](int a, int b) -> int { return a>b ? a : b; },
+			mdf::ParamDecl<int>{"chunks"});
+
+	g.Connect(block, maxNode, "chunks");
 
 	Histogram hst{SIZE*SIZE};
 
-	unique_ptr<Streamer> streamer{new Streamer{stages[0], hst.ptr}};
+	unique_ptr<Streamer> streamer{new Streamer{block}};
 
 	mdf::Mdf<Drainer> engine{g, tn, unique_ptr<Drainer>{new Drainer{&hst}}};
 
+	// Every block writes to the same histogram
+	engine.BindConstant(block, "hst", hst.ptr);
+
 	streamer = engine.Start(move(streamer));
 
 	hst.ToPPM("image");
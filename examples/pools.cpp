@@ -0,0 +1,135 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+/*
+ * Mdf example with execution classes
+ *
+ * Graph topology:
+ *
+ *        first
+ *        /   \
+ *     log    second
+ *        \   /
+ *        third
+ *
+ * log appends a line to a shared journal under a mutex and then waits
+ * for wait microseconds, like a synchronous file write. The graph is run
+ * twice with tn compute workers: with log on the compute pool, where it
+ * occupies the workers, and with log in the blocking class, where it runs
+ * on its own worker and the compute nodes keep all the compute workers.
+ *
+ * Usage: pools [items] [tn] [n] [wait]
+ */
+
+#include <iostream>
+#include <sstream>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <mutex>
+
+#include "../mdf/Mdf.hpp"
+
+using namespace std;
+
+class Drainer {
+
+public:
+
+	void operator()(mdf::TokenHandle token)
+	{
+		if (!dynamic_pointer_cast<mdf::Value<double>>(token))
+			mdf::out.Println("Drainer: downcast failed.");
+	}
+
+};
+
+class Streamer {
+
+	mdf::NodeId _first;
+	int _maxItems;
+	int _numItems;
+
+public:
+
+	Streamer(mdf::NodeId first, int maxItems) : _first{first}, _maxItems{maxItems}, _numItems{0} { }
+
+	vector<mdf::InputTokenContainer> Next()
+	{
+		if (_numItems >= _maxItems)
+			return vector<mdf::InputTokenContainer>{};
+		return vector<mdf::InputTokenContainer>{mdf::InputTokenContainer{_first, "x", mdf::WrapValue<double>(++_numItems)}};
+	}
+
+};
+
+struct Journal {
+	mutex mtx;
+	ostringstream lines;
+};
+
+double Run(mdf::ExecutionClass logClass, int numItems, size_t tn, unsigned long n, unsigned long wait, Journal& journal)
+{
+	auto loop = [n](double x) -> double {
+		for (unsigned i = 0; i < n; ++i)
+			x = std::sin(x);
+		return x;
+	};
+
+	mdf::Graph g{};
+	mdf::NodeId first = g.AddInstruction("first", loop, mdf::ParamDecl<double>{"x"});
+	mdf::NodeId log = g.AddInstruction("log", logClass,
+			[&journal, wait](double x) -> double {
+				lock_guard<mutex> lock{journal.mtx};
+				journal.lines << x << "\n";
+				this_thread::sleep_for(chrono::microseconds{wait});
+				return x;
+			},
+			mdf::ParamDecl<double>{"x"});
+	mdf::NodeId second = g.AddInstruction("second", loop, mdf::ParamDecl<double>{"x"});
+	mdf::NodeId third = g.AddInstruction("third",
+			[loop](double logged, double x) -> double { return loop(logged + x); },
+			mdf::ParamDecl<double>{"logged"},
+			mdf::ParamDecl<double>{"x"});
+	g.Connect(first, log, "x");
+	g.Connect(first, second, "x");
+	g.Connect(log, third, "logged");
+	g.Connect(second, third, "x");
+
+	mdf::Mdf<Drainer> engine{g, mdf::WorkerPools{tn}, unique_ptr<Drainer>{new Drainer}};
+	auto t0 = chrono::steady_clock::now();
+	engine.Start(unique_ptr<Streamer>{new Streamer{first, numItems}});
+	return chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+}
+
+int main(int argc, char *argv[])
+{
+	try {
+
+	int numItems = (argc>1) ? stoi(argv[1]) : 1000;
+	size_t tn = (argc>2) ? stoul(argv[2]) : 2;
+	unsigned long n = (argc>3) ? stoul(argv[3]) : 10000;
+	unsigned long wait = (argc>4) ? stoul(argv[4]) : 200;
+
+	mdf::out.Println("Streaming ", numItems, " items, running ", tn, " compute threads, waiting ", wait, " us in log.");
+
+	Journal journal;
+	double shared = Run(mdf::ExecutionClass::Compute, numItems, tn, n, wait, journal);
+	double separate = Run(mdf::ExecutionClass::Blocking, numItems, tn, n, wait, journal);
+
+	cout << "log on the compute pool: " << shared << " s" << endl;
+	cout << "log on the blocking pool: " << separate << " s" << endl;
+
+	} catch (std::exception& e) {
+		cout << e.what() << endl;
+		return -1;
+	}
+
+	return 0;
+}
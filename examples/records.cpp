@@ -0,0 +1,128 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+/*
+ * Mdf example (memory mapped files)
+ * Writes a file of fixed-size records (each one a vector of doubles), then
+ * streams the records straight from the mapping to the graph and stores
+ * the norm of every vector in an output file, at the position of its record.
+ * By default both files are written to $TMPDIR (or /tmp).
+ *
+ * Graph topology:
+ *
+ *     sum of squares
+ *           |
+ *         sqrt
+ */
+
+#include <iostream>
+#include <fstream>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+
+#include "../mdf/Mdf.hpp"
+#include "../mdf/MappedFile.hpp"
+
+using namespace std;
+
+double SumOfSquares(mdf::RecordView record)
+{
+	double s = 0.0;
+	for (size_t off = 0; off + sizeof(double) <= record.Size(); off += sizeof(double)) {
+		double x;
+		memcpy(&x, record.data + off, sizeof(double));
+		s += x*x;
+	}
+	return s;
+}
+
+double Sqrt(double x)
+{
+	return sqrt(x);
+}
+
+void WriteInput(const string& path, size_t numRecords, size_t dim)
+{
+	ofstream f{path, ios::binary};
+	for (size_t i = 0; i < numRecords; ++i) {
+		for (size_t j = 0; j < dim; ++j) {
+			double x = double(i) + double(j) / double(dim);
+			f.write(reinterpret_cast<const char*>(&x), sizeof(double));
+		}
+	}
+	if (!f)
+		throw runtime_error("Cannot write " + path);
+}
+
+string TempPath(const string& name)
+{
+	const char *dir = getenv("TMPDIR");
+	return string{dir && *dir ? dir : "/tmp"} + "/" + name;
+}
+
+int main(int argc, char *argv[])
+{
+	try {
+
+	size_t numRecords = (argc>1) ? stoul(argv[1]) : 10000;
+	size_t dim = (argc>2) ? stoul(argv[2]) : 16;
+	size_t tn = (argc>3) ? stoul(argv[3]) : 1;
+	string inPath = (argc>4) ? argv[4] : TempPath("records.in");
+	string outPath = (argc>5) ? argv[5] : TempPath("records.out");
+
+	mdf::out.Println("Mapping ", numRecords, " records of ", dim, " doubles, running ", tn, " threads.");
+
+	WriteInput(inPath, numRecords, dim);
+
+	mdf::Graph g{};
+	mdf::NodeId idSum = g.AddInstruction(&SumOfSquares, mdf::ParamDecl<mdf::RecordView>{"record"});
+	mdf::NodeId idSqrt = g.AddInstruction(&Sqrt, mdf::ParamDecl<double>{"x"});
+	g.Connect(idSum, idSqrt, "x");
+
+	using Drainer = mdf::MappedResultDrainer<double>;
+
+	unique_ptr<mdf::MappedRecordStreamer> streamer{new mdf::MappedRecordStreamer{
+			inPath, mdf::RecordFormat::Fixed(dim * sizeof(double)), g.Port(idSum, "record")}};
+	if (streamer->CountRecords() != numRecords)
+		throw runtime_error("Unexpected number of records");
+
+	{
+		mdf::Mdf<Drainer> engine{g, tn, unique_ptr<Drainer>{new Drainer{outPath, numRecords}}};
+		streamer = engine.Start(move(streamer));
+		if (engine.GetDrainer().Overflows() > 0)
+			throw runtime_error("Results past the end of the output: " + to_string(engine.GetDrainer().Overflows()));
+	}
+
+	// Check the results against a sequential computation
+	mdf::MappedFile results{outPath};
+	size_t errors = 0;
+	for (size_t i = 0; i < numRecords; ++i) {
+		double s = 0.0;
+		for (size_t j = 0; j < dim; ++j) {
+			double x = double(i) + double(j) / double(dim);
+			s += x*x;
+		}
+		double r;
+		memcpy(&r, results.Data() + i * sizeof(double), sizeof(double));
+		if (r != sqrt(s)) ++errors;
+	}
+	if (errors > 0)
+		mdf::out.Println("Mismatched results: ", errors);
+	else
+		mdf::out.Println("All results match.");
+
+	} catch (std::exception& e) {
+		cout << e.what() << endl;
+		return -1;
+	}
+
+	return 0;
+}
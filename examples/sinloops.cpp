@@ -23,10 +23,12 @@
  */
 
 #include <iostream>
+#include <fstream>
 #include <cmath>
 #include <utility>
 
 #include "../mdf/Mdf.hpp"
+#include "../mdf/Dot.hpp"
 
 const double PI = 3.14159265358979323846;
 
@@ -47,31 +49,78 @@ public:
 
 };
 
+/*
+ * Batch streamer, each call to NextBatch() produces up to CHUNK items.
+ * All the instances of a batch are in flight at once, so large chunks
+ * increase the memory footprint of the interpreter
+ */
 class Streamer {
 
 private:
 
-	mdf::NodeId _i1;
-	mdf::NodeId _i6;
+	static const int CHUNK = 16;
+
+	mdf::PortHandle _input1;
+	mdf::PortHandle _input2;
+	mdf::PortHandle _counter;
 	const int _maxItems;
+	const int _stride;
 	int _numItems;
 
 public:
 
-	Streamer(mdf::NodeId i1, mdf::NodeId i6, int maxItems) : _i1{i1}, _i6{i6}, _maxItems{maxItems}, _numItems{0}
+	// Streams the items first+1, first+1+stride, ... up to maxItems
+	Streamer(const mdf::Graph& g, mdf::NodeId i1, mdf::NodeId i6, int maxItems, int first=0, int stride=1)
+			: _input1(g.Port(i1, "input1")), _input2(g.Port(i1, "input2")), _counter(g.Port(i6, "counter")),
+			  _maxItems{maxItems}, _stride{stride}, _numItems{first}
 	{
-		assert(_maxItems > 0);
+		assert(_maxItems > 0 && _stride > 0);
 	}
 
-	vector<mdf::InputTokenContainer> Next()
+	size_t NextBatch(mdf::InstanceBatch& batch)
 	{
-		vector<mdf::InputTokenContainer> input;
-		if (_numItems++ < _maxItems) {
-			input.emplace_back(mdf::InputTokenContainer{_i1, "input1", mdf::WrapValue<int>(_numItems)});
-			input.emplace_back(mdf::InputTokenContainer{_i1, "input2", mdf::WrapValue<double>(PI/(double)_numItems)});
-			input.emplace_back(mdf::InputTokenContainer{_i6, "counter", mdf::WrapValue<int>(_numItems)});
+		size_t n = 0;
+		for (; n < CHUNK && _numItems < _maxItems; ++n) {
+			int item = _numItems + 1;
+			batch.Add(_input1, mdf::WrapValue<int>(item));
+			batch.Add(_input2, mdf::WrapValue<double>(PI/(double)item));
+			batch.Add(_counter, mdf::WrapValue<int>(item));
+			batch.EndInstance();
+			_numItems += _stride;
 		}
-		return input;
+		return n;
+	}
+
+};
+
+/*
+ * Batch version of the nodes i_2 ... i_5, the loop over the instances is the
+ * innermost one so that the compiler can vectorize it
+ */
+struct SinLoopKernel {
+
+	unsigned long n;
+	double c;
+
+	void operator()(size_t k, const double *x, double *out) const
+	{
+		for (size_t j = 0; j < k; ++j)
+			out[j] = x[j] + c;
+		Loop(k, out);
+	}
+
+	void operator()(size_t k, const double *y1, const double *y2, double *out) const
+	{
+		for (size_t j = 0; j < k; ++j)
+			out[j] = y1[j] + y2[j] + c;
+		Loop(k, out);
+	}
+
+	void Loop(size_t k, double *out) const
+	{
+		for (unsigned i = 0; i < n; ++i)
+			for (size_t j = 0; j < k; ++j)
+				out[j] = std::sin(out[j]);
 	}
 
 };
@@ -83,12 +132,16 @@ int main(int argc, char *argv[])
 	int numItems = (argc>1) ? stoi(argv[1]) : 100;
 	unsigned long tn = (argc>2) ? stoul(argv[2]) : 1;
 	unsigned long n = (argc>3) ? stoul(argv[3]) : 100;
+	size_t batch = (argc>4) ? stoul(argv[4]) : 0;
+	int sources = (argc>5) ? stoi(argv[5]) : 1;
 
 	mdf::out.Println("Streaming ", numItems, " items, running ", tn, " threads, looping ", n, " times in each funcion.");
+	if (batch > 0)
+		mdf::out.Println("Nodes i_2 to i_5 process batches of up to ", batch, " items.");
 
 	mdf::Graph g{};
 
-	mdf::NodeId i1 = g.AddInstruction(
+	mdf::NodeId i1 = g.AddInstruction("i_1",
 			[n](int in1, double in2) -> double {
 				double x = in1+in2;
 				for (unsigned i = 0; i < n; ++i)
@@ -98,44 +151,57 @@ int main(int argc, char *argv[])
 		   	mdf::ParamDecl<int>{"input1"},
 			mdf::ParamDecl<double>{"input2"});
 
-	mdf::NodeId i2 = g.AddInstruction(
-			[n](double x) -> double {
-				double y1 = x + 1.0;
-				for (unsigned i = 0; i < n; ++i)
-					y1 = std::sin(y1);
-				return y1;
-			},
-			mdf::ParamDecl<double>{"x"});
-
-	mdf::NodeId i3 = g.AddInstruction(
-			[n](double x) -> double {
-				double y2 = x + 2.0;
-				for (unsigned i = 0; i < n; ++i)
-					y2 = std::sin(y2);
-				return y2;
-			},
-			mdf::ParamDecl<double>{"x"});
-
-	mdf::NodeId i4 = g.AddInstruction(
-			[n](double x) -> double {
-				double z = x + 3.0;
-				for (unsigned i = 0; i < n; ++i)
-					z = std::sin(z);
-				return z;
-			},
-			mdf::ParamDecl<double>{"x"});
-	
-	mdf::NodeId i5 = g.AddInstruction(
-			[n](double y1, double y2) -> double {
-				double y = y1 + y2 + 4.0;
-				for (unsigned i = 0; i < n; ++i)
-					y = std::sin(y);
-				return y;
-			},
-			mdf::ParamDecl<double>{"y1"},
-			mdf::ParamDecl<double>{"y2"});
+	mdf::NodeId i2, i3, i4, i5;
+
+	if (batch > 0) {
+		i2 = g.AddBatchInstruction<double>(SinLoopKernel{n, 1.0}, batch, mdf::ParamDecl<double>{"x"});
+		i3 = g.AddBatchInstruction<double>(SinLoopKernel{n, 2.0}, batch, mdf::ParamDecl<double>{"x"});
+		i4 = g.AddBatchInstruction<double>(SinLoopKernel{n, 3.0}, batch, mdf::ParamDecl<double>{"x"});
+		i5 = g.AddBatchInstruction<double>(SinLoopKernel{n, 4.0}, batch, mdf::ParamDecl<double>{"y1"}, mdf::ParamDecl<double>{"y2"});
+		g.SetLabel(i2, "i_2");
+		g.SetLabel(i3, "i_3");
+		g.SetLabel(i4, "i_4");
+		g.SetLabel(i5, "i_5");
+	} else {
+		i2 = g.AddInstruction("i_2",
+				[n](double x) -> double {
+					double y1 = x + 1.0;
+					for (unsigned i = 0; i < n; ++i)
+						y1 = std::sin(y1);
+					return y1;
+				},
+				mdf::ParamDecl<double>{"x"});
+
+		i3 = g.AddInstruction("i_3",
+				[n](double x) -> double {
+					double y2 = x + 2.0;
+					for (unsigned i = 0; i < n; ++i)
+						y2 = std::sin(y2);
+					return y2;
+				},
+				mdf::ParamDecl<double>{"x"});
+
+		i4 = g.AddInstruction("i_4",
+				[n](double x) -> double {
+					double z = x + 3.0;
+					for (unsigned i = 0; i < n; ++i)
+						z = std::sin(z);
+					return z;
+				},
+				mdf::ParamDecl<double>{"x"});
+
+		i5 = g.AddInstruction("i_5",
+				[n](double y1, double y2) -> double {
+					double y = y1 + y2 + 4.0;
+					for (unsigned i = 0; i < n; ++i)
+						y = std::sin(y);
+					return y;
+				},
+				mdf::ParamDecl<double>{"y1"},
+				mdf::ParamDecl<double>{"y2"});
+	}
 
-	mdf::NodeId i6 = g.AddInstruction(
+	mdf::NodeId i6 = g.AddInstruction("i_6",
 			[n](double y, double z, int c) -> pair<int,double> {
 				double w = y + z + 5.0;
 				for (unsigned i = 0; i < n; ++i)
@@ -154,11 +220,31 @@ int main(int argc, char *argv[])
 	g.Connect(i5, i6, "y");
 	g.Connect(i4, i6, "z");
 
-	unique_ptr<Streamer> streamer{new Streamer{i1, i6, numItems}};
-
 	mdf::Mdf<Drainer> engine{g, tn, unique_ptr<Drainer>{new Drainer}};
 
-	streamer = engine.Start(move(streamer));
+	if (sources > 1) {
+		// Each source streams one partition of the items
+		vector<unique_ptr<Streamer>> streamers;
+		for (int k = 0; k < sources; ++k)
+			streamers.emplace_back(new Streamer{g, i1, i6, numItems, k, sources});
+		streamers = engine.Start(move(streamers));
+	} else {
+		unique_ptr<Streamer> streamer{new Streamer{g, i1, i6, numItems}};
+		streamer = engine.Start(move(streamer));
+	}
+
+#ifdef MDF_ENABLE_STATS
+	mdf::PrintStatistics(engine.Statistics());
+	ofstream dot{"sinloops.dot"};
+	mdf::WriteDot(dot, g, engine.Statistics());
+#endif
+#ifdef MDF_ENABLE_PERF
+	mdf::PrintPerfCounters(engine.HardwareCounters(), g);
+#endif
+#ifdef MDF_ENABLE_TRACE
+	ofstream trace{"sinloops.trace.json"};
+	engine.WriteTrace(trace);
+#endif
 
 	} catch (std::exception& e) {
 		cout << e.what() << endl;
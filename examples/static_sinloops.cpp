@@ -0,0 +1,153 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+/*
+ * Mdf example (static graph)
+ * Same computation of sinloops.cpp, with the graph topology and the types
+ * of the tokens fixed at compile time.
+ *
+ * Graph topology:
+ *
+ *         i_1
+ *     +----+----+
+ *     |    |    |
+ *    i_2  i_3  i_4
+ *     \   /    /
+ *      i_5    /
+ *        \   /
+ *         i_6
+ */
+
+#include <iostream>
+#include <cmath>
+#include <tuple>
+#include <utility>
+
+#include "../mdf/StaticMdf.hpp"
+
+const double PI = 3.14159265358979323846;
+
+using namespace std;
+
+class Drainer {
+
+public:
+
+	void operator()(const pair<int,double>& result)
+	{
+		(void) result;
+	}
+
+};
+
+class Streamer {
+
+private:
+
+	const int _maxItems;
+	int _numItems;
+
+public:
+
+	Streamer(int maxItems) : _maxItems{maxItems}, _numItems{0}
+	{
+		assert(_maxItems > 0);
+	}
+
+	bool Next(tuple<int,double>& item)
+	{
+		if (_numItems++ < _maxItems) {
+			item = make_tuple(_numItems, PI/(double)_numItems);
+			return true;
+		}
+		return false;
+	}
+
+};
+
+int main(int argc, char *argv[])
+{
+	try {
+
+	int numItems = (argc>1) ? stoi(argv[1]) : 100;
+	unsigned long tn = (argc>2) ? stoul(argv[2]) : 1;
+	unsigned long n = (argc>3) ? stoul(argv[3]) : 100;
+
+	mdf::out.Println("Streaming ", numItems, " items, running ", tn, " threads, looping ", n, " times in each funcion.");
+
+	auto i1 = mdf::MakeStaticInstruction(
+			[n](int in1, double in2) -> double {
+				double x = in1+in2;
+				for (unsigned i = 0; i < n; ++i)
+					x = std::sin(x);
+				return x;
+			},
+			mdf::Input<0>{}, mdf::Input<1>{});
+
+	auto i2 = mdf::MakeStaticInstruction(
+			[n](double x) -> double {
+				double y1 = x + 1.0;
+				for (unsigned i = 0; i < n; ++i)
+					y1 = std::sin(y1);
+				return y1;
+			},
+			mdf::From<0>{});
+
+	auto i3 = mdf::MakeStaticInstruction(
+			[n](double x) -> double {
+				double y2 = x + 2.0;
+				for (unsigned i = 0; i < n; ++i)
+					y2 = std::sin(y2);
+				return y2;
+			},
+			mdf::From<0>{});
+
+	auto i4 = mdf::MakeStaticInstruction(
+			[n](double x) -> double {
+				double z = x + 3.0;
+				for (unsigned i = 0; i < n; ++i)
+					z = std::sin(z);
+				return z;
+			},
+			mdf::From<0>{});
+
+	auto i5 = mdf::MakeStaticInstruction(
+			[n](double y1, double y2) -> double {
+				double y = y1 + y2 + 4.0;
+				for (unsigned i = 0; i < n; ++i)
+					y = std::sin(y);
+				return y;
+			},
+			mdf::From<1>{}, mdf::From<2>{});
+
+	// The counter is the item number, forwarded from i_1's first input
+	auto i6 = mdf::MakeStaticInstruction(
+			[n](double y, double z, int c) -> pair<int,double> {
+				double w = y + z + 5.0;
+				for (unsigned i = 0; i < n; ++i)
+					w = std::sin(w);
+				return make_pair(c,w);
+			},
+			mdf::From<4>{}, mdf::From<3>{}, mdf::Input<0>{});
+
+	auto g = mdf::MakeStaticGraph(mdf::StreamTypes<int,double>{}, i1, i2, i3, i4, i5, i6);
+
+	unique_ptr<Streamer> streamer{new Streamer{numItems}};
+
+	mdf::StaticMdf<decltype(g), Drainer> engine{g, tn, unique_ptr<Drainer>{new Drainer}};
+
+	streamer = engine.Start(move(streamer));
+
+	} catch (std::exception& e) {
+		cout << e.what() << endl;
+		return -1;
+	}
+
+	return 0;
+}
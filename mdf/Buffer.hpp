@@ -0,0 +1,183 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+#ifndef MDF_BUFFER_HPP
+#define MDF_BUFFER_HPP
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <cstddef>
+#include <type_traits>
+#include <cassert>
+
+namespace mdf {
+
+// Memory block of a BufferPool
+struct BufferBlock {
+	char *data;
+	std::size_t capacity;
+};
+
+/*
+ * Pool of memory blocks in power of two size classes, from 64 bytes to
+ * 64 MB. A block goes back to the free list of its class as soon as the
+ * last buffer that refers to it is destroyed, on any thread. Each class
+ * keeps at most MaxFree blocks, larger requests are not pooled
+ */
+class BufferPool : public std::enable_shared_from_this<BufferPool> {
+
+private:
+
+	static constexpr unsigned MinClass = 6;
+	static constexpr unsigned NumClasses = 21;
+	static constexpr std::size_t MaxFree = 64;
+
+	struct SizeClass {
+		std::mutex mtx;
+		std::vector<char*> free;
+	};
+
+	SizeClass _classes[NumClasses];
+
+public:
+
+	BufferPool() { }
+	BufferPool(const BufferPool&) = delete;
+	BufferPool& operator=(const BufferPool&) = delete;
+
+	~BufferPool()
+	{
+		for (auto& c : _classes)
+			for (char *p : c.free)
+				::operator delete(p);
+	}
+
+	// Pool used by AllocateBuffer() when no pool is given
+	static std::shared_ptr<BufferPool> Default()
+	{
+		static std::shared_ptr<BufferPool> pool = std::make_shared<BufferPool>();
+		return pool;
+	}
+
+	std::shared_ptr<BufferBlock> Acquire(std::size_t bytes)
+	{
+		unsigned k = ClassOf(bytes);
+		std::size_t capacity = bytes;
+		char *data = nullptr;
+		if (k < NumClasses) {
+			capacity = std::size_t{1} << (k + MinClass);
+			std::lock_guard<std::mutex> lock{_classes[k].mtx};
+			if (!_classes[k].free.empty()) {
+				data = _classes[k].free.back();
+				_classes[k].free.pop_back();
+			}
+		}
+		if (!data)
+			data = static_cast<char*>(::operator new(capacity));
+
+		std::shared_ptr<BufferPool> pool = shared_from_this();
+		return std::shared_ptr<BufferBlock>{new BufferBlock{data, capacity},
+				[pool] (BufferBlock *b) { pool->Release(b); }};
+	}
+
+private:
+
+	static unsigned ClassOf(std::size_t bytes)
+	{
+		unsigned k = 0;
+		while (k < NumClasses && (std::size_t{1} << (k + MinClass)) < bytes)
+			++k;
+		return k;
+	}
+
+	void Release(BufferBlock *b)
+	{
+		unsigned k = ClassOf(b->capacity);
+		bool pooled = false;
+		if (k < NumClasses) {
+			std::lock_guard<std::mutex> lock{_classes[k].mtx};
+			if (_classes[k].free.size() < MaxFree) {
+				_classes[k].free.push_back(b->data);
+				pooled = true;
+			}
+		}
+		if (!pooled)
+			::operator delete(b->data);
+		delete b;
+	}
+
+};
+
+/*
+ * Reference counted view of size elements of type T stored in a pooled
+ * block. Copies and slices share the block, so passing a buffer in a token
+ * never copies its contents, and the block returns to its pool when the
+ * last view is destroyed. Buffer<const T> is a read-only view, a
+ * Buffer<T> converts to it
+ */
+template<typename T>
+class Buffer {
+
+	template<typename U> friend class Buffer;
+
+private:
+
+	std::shared_ptr<BufferBlock> _block;
+	T *_data;
+	std::size_t _size;
+
+public:
+
+	Buffer() : _block{}, _data{nullptr}, _size{0} { }
+
+	Buffer(std::shared_ptr<BufferBlock> block, T *data, std::size_t size)
+			: _block{std::move(block)}, _data{data}, _size{size} { }
+
+	template<typename U, typename = typename std::enable_if<std::is_same<const U, T>::value>::type>
+	Buffer(const Buffer<U>& other) : _block{other._block}, _data{other._data}, _size{other._size} { }
+
+	T *Data() const { return _data; }
+	std::size_t Size() const { return _size; }
+	bool Empty() const { return _size == 0; }
+
+	T& operator[](std::size_t i) const
+	{
+		assert(i < _size);
+		return _data[i];
+	}
+
+	T *begin() const { return _data; }
+	T *end() const { return _data + _size; }
+
+	// View of count elements starting at offset, sharing the same block
+	Buffer<T> Slice(std::size_t offset, std::size_t count) const
+	{
+		assert(offset + count <= _size);
+		return Buffer<T>{_block, _data + offset, count};
+	}
+
+};
+
+// Allocates an uninitialized buffer of n elements from a pool
+template<typename T>
+Buffer<T> AllocateBuffer(std::size_t n, const std::shared_ptr<BufferPool>& pool = BufferPool::Default())
+{
+	static_assert(std::is_trivially_copyable<T>::value && std::is_trivially_destructible<T>::value,
+			"mdf::AllocateBuffer: buffers hold trivially copyable types");
+	static_assert(alignof(T) <= alignof(std::max_align_t), "mdf::AllocateBuffer: over-aligned types are not supported");
+	std::shared_ptr<BufferBlock> block = pool->Acquire(n * sizeof(T));
+	T *data = reinterpret_cast<T*>(block->data);
+	return Buffer<T>{std::move(block), data, n};
+}
+
+} // mdf namespace
+
+#endif
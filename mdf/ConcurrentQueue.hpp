@@ -12,6 +12,9 @@
 
 #include <mutex>
 #include <deque>
+#include <vector>
+#include <atomic>
+#include <algorithm>
 #include <condition_variable>
 
 namespace mdf {
@@ -22,13 +25,20 @@ class ConcurrentQueue {
 private:
 
 	const std::size_t _capacity; // 0 means unbounded
-	std::mutex _mtx;
+	mutable std::mutex _mtx;
 	std::condition_variable _resume;
 	std::deque<T> _deque;
+#ifdef MDF_ENABLE_STATS
+	std::size_t _highWater; // Largest size reached
+#endif
 
 public:	
 
+#ifdef MDF_ENABLE_STATS
+	ConcurrentQueue(std::size_t capacity=0) : _mtx{}, _deque{}, _capacity{capacity}, _highWater{0} { }
+#else
 	ConcurrentQueue(std::size_t capacity=0) : _mtx{}, _deque{}, _capacity{capacity} { }
+#endif
 	ConcurrentQueue(const ConcurrentQueue<T>& other) = delete;	
 	ConcurrentQueue<T>& operator=(const ConcurrentQueue<T>& other) = delete;
 
@@ -38,12 +48,29 @@ public:
 		return _deque.empty();
 	}
 
+	std::size_t Size() const
+	{
+		std::lock_guard<std::mutex> lock{_mtx};
+		return _deque.size();
+	}
+
 	void Put(const T& v)
 	{
 		std::unique_lock<std::mutex> lock{_mtx};
 		while (_capacity > 0 && _deque.size() > _capacity)
 			_resume.wait(lock);
 		_deque.push_back(v);
+		UpdateHighWater();
+	}
+
+	// Appends all the elements of v acquiring the lock once
+	template<typename C> void PutAll(const C& v)
+	{
+		std::unique_lock<std::mutex> lock{_mtx};
+		while (_capacity > 0 && _deque.size() > _capacity)
+			_resume.wait(lock);
+		_deque.insert(_deque.end(), v.begin(), v.end());
+		UpdateHighWater();
 	}
 
 	bool Get(T& v)
@@ -59,6 +86,76 @@ public:
 		} else return false;
 	}
 
+	std::size_t HighWater() const
+	{
+#ifdef MDF_ENABLE_STATS
+		std::lock_guard<std::mutex> lock{_mtx};
+		return _highWater;
+#else
+		return 0;
+#endif
+	}
+
+private:
+
+	void UpdateHighWater()
+	{
+#ifdef MDF_ENABLE_STATS
+		if (_deque.size() > _highWater) _highWater = _deque.size();
+#endif
+	}
+
+};
+
+/*
+ * Unbounded queue that returns the smallest element according to Less
+ * first. The size is mirrored in an atomic so that polling an empty queue
+ * does not take the lock
+ */
+template <typename T, typename Less>
+class ConcurrentPriorityQueue {
+
+private:
+
+	std::mutex _mtx;
+	std::vector<T> _heap;
+	std::atomic<std::size_t> _size;
+
+	// std heaps keep the largest element on top
+	static bool Greater(const T& a, const T& b) { return Less{}(b, a); }
+
+public:
+
+	ConcurrentPriorityQueue() : _mtx{}, _heap{}, _size{0} { }
+	ConcurrentPriorityQueue(const ConcurrentPriorityQueue<T,Less>& other) = delete;
+	ConcurrentPriorityQueue<T,Less>& operator=(const ConcurrentPriorityQueue<T,Less>& other) = delete;
+
+	bool IsEmpty() const { return _size.load(std::memory_order_relaxed) == 0; }
+
+	std::size_t Size() const { return _size.load(std::memory_order_relaxed); }
+
+	void Put(const T& v)
+	{
+		std::lock_guard<std::mutex> lock{_mtx};
+		_heap.push_back(v);
+		std::push_heap(_heap.begin(), _heap.end(), Greater);
+		_size.store(_heap.size(), std::memory_order_relaxed);
+	}
+
+	bool Get(T& v)
+	{
+		if (IsEmpty())
+			return false;
+		std::lock_guard<std::mutex> lock{_mtx};
+		if (_heap.empty())
+			return false;
+		std::pop_heap(_heap.begin(), _heap.end(), Greater);
+		v = std::move(_heap.back());
+		_heap.pop_back();
+		_size.store(_heap.size(), std::memory_order_relaxed);
+		return true;
+	}
+
 };
 
 } // mdf namespace
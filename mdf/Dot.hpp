@@ -0,0 +1,162 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+#ifndef MDF_DOT_HPP
+#define MDF_DOT_HPP
+
+#include <vector>
+#include <string>
+#include <ostream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "Mdf.hpp"
+#include "Statistics.hpp"
+#include "Simulator.hpp"
+
+namespace mdf {
+
+/*
+ * Graphviz export
+ * Nodes are drawn with their label and kind, data edges (links) as solid
+ * arrows labelled with the destination parameter, control edges (declared
+ * dependencies) as dashed arrows. With statistics the nodes are filled
+ * with a heat color proportional to their share of the total execution
+ * time, annotated with their mean time per task and share, and the nodes
+ * and edges of the critical path are drawn bold. Nodes at the same depth
+ * (see Graph::Finalize) are drawn on the same rank, graphs that fail the
+ * validation are drawn without ranks.
+ */
+
+namespace detail {
+
+inline std::string DotEscape(const std::string& s)
+{
+	std::string r;
+	for (char c : s) {
+		if (c == '"' || c == '\\') r += '\\';
+		r += c;
+	}
+	return r;
+}
+
+inline const char *DotKind(const Instruction& ins)
+{
+	if (ins.IsMap()) return "map";
+	if (ins.IsReduce()) return "reduce";
+	if (ins.IsAsync()) return "async";
+	if (ins.BatchSize() > 0) return "batch";
+	return nullptr;
+}
+
+inline void WriteRanks(std::ostream& os, const Graph& g)
+{
+	Graph checked{g};
+	try {
+		checked.Finalize();
+	} catch (const std::invalid_argument&) {
+		return;
+	}
+	std::vector<std::vector<NodeId>> ranks;
+	for (NodeId id : checked.TopologicalOrder()) {
+		std::size_t d = checked.Depth(id);
+		if (ranks.size() <= d) ranks.resize(d + 1);
+		ranks[d].push_back(id);
+	}
+	for (auto& rank : ranks) {
+		if (rank.size() < 2) continue;
+		os << "\t{rank=same;";
+		for (NodeId id : rank)
+			os << " n" << id << ";";
+		os << "}\n";
+	}
+}
+
+inline void WriteDot(std::ostream& os, const Graph& g, const EngineStatistics *stats)
+{
+	std::vector<double> share(g.N(), 0.0);
+	std::vector<bool> critical(g.N(), false);
+	std::vector<NodeId> path;
+	double maxShare = 0;
+	if (stats && stats->enabled && stats->nodes.size() == g.N()) {
+		std::chrono::nanoseconds total{0};
+		for (auto& n : stats->nodes) total += n.latency.total;
+		for (NodeId id = 0; id < g.N(); ++id) {
+			share[id] = total.count() > 0 ? static_cast<double>(stats->nodes[id].latency.total.count()) / total.count() : 0;
+			maxShare = std::max(maxShare, share[id]);
+		}
+		path = AnalyzeGraph(g, CostProfile::FromStatistics(*stats, 0)).criticalPath;
+		for (NodeId id : path)
+			critical[id] = true;
+	} else {
+		stats = nullptr;
+	}
+
+	auto onPath = [&path](NodeId a, NodeId b) {
+		for (std::size_t i = 1; i < path.size(); ++i)
+			if (path[i-1] == a && path[i] == b) return true;
+		return false;
+	};
+
+	os << "digraph mdf {\n";
+	os << "\tnode [shape=box, style=\"rounded,filled\", fillcolor=white, fontname=\"Helvetica\"];\n";
+	os << "\tedge [fontname=\"Helvetica\", fontsize=10];\n";
+	WriteRanks(os, g);
+	for (NodeId id = 0; id < g.N(); ++id) {
+		std::ostringstream label;
+		label << DotEscape(g.Label(id));
+		const char *kind = DotKind(g.GetNode(id)->GetInstruction());
+		if (kind) label << " (" << kind << ")";
+		os << "\tn" << id << " [label=\"" << label.str();
+		if (stats) {
+			const NodeStatistics& n = stats->nodes[id];
+			os << "\\nmean " << n.latency.Mean().count() / 1000.0 << " us\\n" << static_cast<int>(share[id] * 1000) / 10.0 << "% of time\"";
+			// Hue 0 (red) with a saturation proportional to the share of the hottest node
+			double heat = maxShare > 0 ? share[id] / maxShare : 0;
+			os << ", fillcolor=\"0.000 " << heat << " 1.000\"";
+			if (critical[id]) os << ", penwidth=3";
+		} else {
+			os << "\"";
+		}
+		os << "];\n";
+	}
+	for (NodeId id = 0; id < g.N(); ++id) {
+		auto node = g.GetNode(id);
+		for (auto& l : node->Links()) {
+			os << "\tn" << id << " -> n" << l.nodeId << " [label=\"" << DotEscape(l.paramName) << "\"";
+			if (onPath(id, l.nodeId)) os << ", penwidth=3";
+			os << "];\n";
+		}
+		for (NodeId d : node->DependentNodes()) {
+			os << "\tn" << id << " -> n" << d << " [style=dashed";
+			if (onPath(id, d)) os << ", penwidth=3";
+			os << "];\n";
+		}
+	}
+	os << "}\n";
+}
+
+} // detail namespace
+
+// Writes the structure of the graph in the DOT language
+inline void WriteDot(std::ostream& os, const Graph& g)
+{
+	detail::WriteDot(os, g, nullptr);
+}
+
+// Writes the graph annotated with the statistics of an interpreter built with MDF_ENABLE_STATS
+inline void WriteDot(std::ostream& os, const Graph& g, const EngineStatistics& stats)
+{
+	detail::WriteDot(os, g, &stats);
+}
+
+} // mdf namespace
+
+#endif
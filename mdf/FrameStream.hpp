@@ -0,0 +1,497 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+#ifndef MDF_FRAME_STREAM_HPP
+#define MDF_FRAME_STREAM_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <cassert>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Mdf.hpp"
+#include "ConcurrentMap.hpp"
+#include "Buffer.hpp"
+
+namespace mdf {
+
+/*
+ * Framing used by FrameStreamer and FrameDrainer
+ * Requests are a 32-bit payload length followed by the payload, responses
+ * are a 32-bit payload length, the 32-bit sequence number of the request
+ * on its connection (0 for the first frame) and the payload. All integers
+ * are in native byte order, since both ends run on the same host.
+ * Responses are written in completion order, not in request order. The
+ * response to a request whose instance was cancelled (see Deadline in
+ * Mdf.hpp) has the length FrameCancelled and no payload.
+ */
+
+constexpr std::uint32_t FrameCancelled = 0xFFFFFFFF;
+
+// Payload of a request frame, valid as long as the token that carries it is alive
+struct FrameView {
+	const char *data;
+	std::size_t size;
+
+	std::size_t Size() const { return size; }
+};
+
+// Token carrying a request payload, it pins the pooled receive chunk the payload was read into
+class FrameToken : public Value<FrameView> {
+
+private:
+
+	std::shared_ptr<BufferBlock> _chunk;
+
+public:
+
+	FrameToken(FrameView view, std::shared_ptr<BufferBlock> chunk)
+			: Value<FrameView>{view}, _chunk{std::move(chunk)} { }
+
+};
+
+/*
+ * Endpoint of a client, closed when neither the streamer nor a pending
+ * response refer to it anymore. Sockets use the same descriptor for both
+ * directions, pipes come in pairs
+ */
+class FrameConnection {
+
+private:
+
+	const int _readFd;
+	const int _writeFd;
+	std::atomic<bool> _broken; // A write failed, further responses are dropped
+
+public:
+
+	FrameConnection(int readFd, int writeFd) : _readFd{readFd}, _writeFd{writeFd}, _broken{false} { }
+	FrameConnection(const FrameConnection&) = delete;
+	FrameConnection& operator=(const FrameConnection&) = delete;
+
+	~FrameConnection()
+	{
+		close(_readFd);
+		if (_writeFd != _readFd) close(_writeFd);
+	}
+
+	int ReadFd() const { return _readFd; }
+
+	// Writes a whole response, waiting if the descriptor is full
+	void Write(const char *data, std::size_t size)
+	{
+		while (size > 0 && !_broken) {
+			ssize_t n = send(_writeFd, data, size, MSG_NOSIGNAL);
+			if (n < 0 && errno == ENOTSOCK)
+				n = write(_writeFd, data, size);
+			if (n > 0) {
+				data += n;
+				size -= n;
+			} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				pollfd p{_writeFd, POLLOUT, 0};
+				poll(&p, 1, -1);
+			} else if (n < 0 && errno == EINTR) {
+				continue;
+			} else {
+				_broken = true;
+			}
+		}
+	}
+
+};
+
+/*
+ * Routes the result of an instance back to the connection and sequence
+ * number of the request that created it. It is shared by a FrameStreamer
+ * and the FrameDrainer of the same interpreter
+ */
+class FrameRouter {
+
+public:
+
+	struct Route {
+		std::shared_ptr<FrameConnection> connection;
+		std::uint32_t sequence;
+	};
+
+private:
+
+	ConcurrentMap<std::size_t,Route> _routes;
+
+public:
+
+	FrameRouter() : _routes{1021} { }
+
+	void Insert(std::size_t instanceId, Route route) { _routes.Insert(instanceId, route); }
+
+	// Removes the route of an instance, returns false if it has none
+	bool Take(std::size_t instanceId, Route& route)
+	{
+		auto r = _routes.Get(instanceId);
+		if (!r.second)
+			return false;
+		_routes.Remove(instanceId);
+		route = r.first;
+		return true;
+	}
+
+};
+
+/*
+ * Batch streamer fed by Unix domain socket clients and pipes. Descriptors
+ * are non-blocking and polled with epoll, each ready connection is read
+ * once per round into a pooled receive chunk, and every complete frame
+ * becomes an instance whose FrameToken points into the chunk (only the
+ * incomplete tail of a chunk is ever copied, when it moves to a new one).
+ * The stream ends when no more clients can connect (the listener accepted
+ * its maximum number of connections or Stop() was called) and every
+ * connection reached the end of file.
+ * The routes of the framed requests are registered when the interpreter
+ * assigns the ids of their instances (see Admitted())
+ */
+class FrameStreamer {
+
+private:
+
+	struct Connection {
+		std::shared_ptr<FrameConnection> endpoint;
+		std::shared_ptr<BufferBlock> chunk;
+		std::size_t begin; // First byte not yet framed
+		std::size_t end; // End of the received bytes
+		std::uint32_t sequence;
+	};
+
+	static constexpr int MaxEvents = 64;
+
+	std::shared_ptr<FrameRouter> _router;
+	const PortHandle _port;
+	const std::size_t _maxFrame;
+
+	std::shared_ptr<BufferPool> _pool;
+	const std::size_t _chunkSize;
+
+	int _epoll;
+	int _stopEvent;
+	int _listener;
+	std::string _listenPath;
+	std::size_t _acceptsLeft; // Connections the listener will still accept, 0 for unlimited
+	std::unordered_map<int,Connection> _connections;
+	std::vector<FrameRouter::Route> _pending; // Routes of the instances of the last batch, in batch order
+
+public:
+
+	FrameStreamer(std::shared_ptr<FrameRouter> router, PortHandle port,
+			std::size_t chunkSize = 64*1024, std::size_t maxFrame = 64*1024*1024)
+			: _router{std::move(router)}, _port(port), _maxFrame{maxFrame},
+			  _pool{std::make_shared<BufferPool>()}, _chunkSize{chunkSize},
+			  _epoll{-1}, _stopEvent{-1}, _listener{-1}, _listenPath{}, _acceptsLeft{0},
+			  _connections{}, _pending{}
+	{
+		assert(_router);
+		_epoll = epoll_create1(EPOLL_CLOEXEC);
+		if (_epoll < 0)
+			throw std::system_error(errno, std::generic_category(), "mdf::FrameStreamer: epoll_create1 failed");
+		_stopEvent = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (_stopEvent < 0) {
+			int err = errno;
+			close(_epoll);
+			throw std::system_error(err, std::generic_category(), "mdf::FrameStreamer: eventfd failed");
+		}
+		Watch(_stopEvent);
+	}
+
+	FrameStreamer(const FrameStreamer&) = delete;
+	FrameStreamer& operator=(const FrameStreamer&) = delete;
+
+	~FrameStreamer()
+	{
+		CloseListener();
+		close(_stopEvent);
+		close(_epoll);
+	}
+
+	/*
+	 * Accepts clients on a Unix domain socket bound to path, stopping after
+	 * maxConnections clients (0 means until Stop() is called)
+	 */
+	void Listen(const std::string& path, std::size_t maxConnections = 0)
+	{
+		assert(_listener < 0);
+		sockaddr_un addr;
+		std::memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (path.size() >= sizeof(addr.sun_path))
+			throw std::invalid_argument("mdf::FrameStreamer: socket path too long");
+		std::strcpy(addr.sun_path, path.c_str());
+
+		int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			throw std::system_error(errno, std::generic_category(), "mdf::FrameStreamer: socket failed");
+		unlink(path.c_str());
+		if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 128) != 0) {
+			int err = errno;
+			close(fd);
+			throw std::system_error(err, std::generic_category(), "mdf::FrameStreamer: cannot listen on " + path);
+		}
+		_listener = fd;
+		_listenPath = path;
+		_acceptsLeft = maxConnections;
+		Watch(_listener);
+	}
+
+	// Adds a connection, taking ownership of the descriptors (the same one for sockets)
+	void AddConnection(int readFd, int writeFd)
+	{
+		fcntl(readFd, F_SETFL, fcntl(readFd, F_GETFL) | O_NONBLOCK);
+		if (writeFd != readFd)
+			fcntl(writeFd, F_SETFL, fcntl(writeFd, F_GETFL) | O_NONBLOCK);
+		_connections[readFd] = Connection{std::make_shared<FrameConnection>(readFd, writeFd), nullptr, 0, 0, 0};
+		Watch(readFd);
+	}
+
+	// Stops accepting new clients, can be called from any thread
+	void Stop()
+	{
+		std::uint64_t one = 1;
+		ssize_t n = write(_stopEvent, &one, sizeof(one));
+		(void) n;
+	}
+
+	std::size_t NextBatch(InstanceBatch& batch)
+	{
+		_pending.clear();
+		epoll_event events[MaxEvents];
+		while (batch.Size() == 0 && (_listener >= 0 || !_connections.empty())) {
+			int n = epoll_wait(_epoll, events, MaxEvents, -1);
+			if (n < 0) {
+				if (errno == EINTR) continue;
+				throw std::system_error(errno, std::generic_category(), "mdf::FrameStreamer: epoll_wait failed");
+			}
+			for (int i = 0; i < n; ++i) {
+				int fd = events[i].data.fd;
+				if (fd == _stopEvent) {
+					std::uint64_t count;
+					ssize_t r = read(_stopEvent, &count, sizeof(count));
+					(void) r;
+					CloseListener();
+				}
+				else if (fd == _listener)
+					Accept();
+				else if (_connections.count(fd) > 0)
+					Receive(_connections[fd], batch);
+			}
+		}
+		return batch.Size();
+	}
+
+	// Called by the interpreter with the ids of the instances of the last batch
+	void Admitted(std::size_t firstInstanceId, std::size_t count)
+	{
+		assert(count == _pending.size());
+		for (std::size_t i = 0; i < count; ++i)
+			_router->Insert(firstInstanceId + i, _pending[i]);
+		_pending.clear();
+	}
+
+private:
+
+	void Watch(int fd)
+	{
+		epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.fd = fd;
+		if (epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &ev) != 0)
+			throw std::system_error(errno, std::generic_category(), "mdf::FrameStreamer: epoll_ctl failed");
+	}
+
+	void CloseListener()
+	{
+		if (_listener >= 0) {
+			close(_listener); // Also removes it from the epoll set
+			unlink(_listenPath.c_str());
+			_listener = -1;
+		}
+	}
+
+	void Accept()
+	{
+		while (_listener >= 0) {
+			int fd = accept4(_listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd < 0)
+				return; // EAGAIN, or a client that gave up in the meantime
+			AddConnection(fd, fd);
+			if (_acceptsLeft > 0 && --_acceptsLeft == 0)
+				CloseListener();
+		}
+	}
+
+	// Reads what is available on a connection and frames the complete requests
+	void Receive(Connection& c, InstanceBatch& batch)
+	{
+		Reserve(c);
+		ssize_t n = read(c.endpoint->ReadFd(), c.chunk->data + c.end, c.chunk->capacity - c.end);
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+			return;
+		if (n <= 0) {
+			Drop(c);
+			return;
+		}
+		c.end += n;
+
+		while (c.end - c.begin >= sizeof(std::uint32_t)) {
+			std::uint32_t len = Length(c);
+			if (len > _maxFrame) {
+				Drop(c);
+				return;
+			}
+			if (c.end - c.begin < sizeof(std::uint32_t) + len)
+				break;
+			FrameView view{c.chunk->data + c.begin + sizeof(std::uint32_t), len};
+			_pending.push_back(FrameRouter::Route{c.endpoint, c.sequence++});
+			batch.Add(_port, std::make_shared<FrameToken>(view, c.chunk));
+			batch.EndInstance();
+			c.begin += sizeof(std::uint32_t) + len;
+		}
+	}
+
+	// Makes room for the next read, moving the unframed tail to a new chunk if needed
+	void Reserve(Connection& c)
+	{
+		bool header = false;
+		if (c.chunk) {
+			if (c.begin == c.end && c.chunk.use_count() == 1)
+				c.begin = c.end = 0; // No frame points into the chunk, reuse it from the start
+			header = c.end - c.begin >= sizeof(std::uint32_t);
+			bool fits = !header || c.begin + sizeof(std::uint32_t) + Length(c) <= c.chunk->capacity;
+			if (c.end < c.chunk->capacity && fits)
+				return;
+		}
+
+		std::size_t needed = header ? std::max(_chunkSize, sizeof(std::uint32_t) + Length(c)) : _chunkSize;
+		std::shared_ptr<BufferBlock> chunk = _pool->Acquire(needed);
+		std::size_t tail = c.chunk ? c.end - c.begin : 0;
+		if (tail > 0)
+			std::memcpy(chunk->data, c.chunk->data + c.begin, tail);
+		c.chunk = std::move(chunk);
+		c.begin = 0;
+		c.end = tail;
+	}
+
+	std::uint32_t Length(const Connection& c) const
+	{
+		std::uint32_t len;
+		std::memcpy(&len, c.chunk->data + c.begin, sizeof(len));
+		return len;
+	}
+
+	// Stops reading a connection, it stays open until its pending responses are written
+	void Drop(Connection& c)
+	{
+		int fd = c.endpoint->ReadFd();
+		epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, nullptr);
+		_connections.erase(fd);
+	}
+
+};
+
+namespace detail {
+
+template<typename T>
+inline void AppendBytes(std::vector<char>& buf, const T& val)
+{
+	static_assert(std::is_trivially_copyable<T>::value, "mdf::FrameDrainer: results must be trivially copyable or std::string");
+	const char *p = reinterpret_cast<const char*>(&val);
+	buf.insert(buf.end(), p, p + sizeof(T));
+}
+
+inline void AppendBytes(std::vector<char>& buf, const std::string& val)
+{
+	buf.insert(buf.end(), val.begin(), val.end());
+}
+
+} // detail namespace
+
+/*
+ * Drainer that writes the result of each instance back to the connection
+ * of its request, as a response frame. Results are either trivially
+ * copyable values, sent as their bytes, or strings.
+ * Writes wait for the client to make room, so a client that does not read
+ * its responses eventually stalls the interpreter. Results of instances
+ * without a route (not created by a FrameStreamer) are dropped and
+ * counted, see Unrouted()
+ */
+template<typename T>
+class FrameDrainer {
+
+private:
+
+	std::shared_ptr<FrameRouter> _router;
+	std::vector<char> _buffer;
+	std::size_t _unrouted;
+
+public:
+
+	explicit FrameDrainer(std::shared_ptr<FrameRouter> router) : _router{std::move(router)}, _buffer{}, _unrouted{0}
+	{
+		assert(_router);
+	}
+
+	void operator()(std::size_t instanceId, const TokenHandle& token)
+	{
+		FrameRouter::Route route;
+		if (!_router->Take(instanceId, route)) {
+			++_unrouted;
+			return;
+		}
+
+		_buffer.resize(2 * sizeof(std::uint32_t));
+		detail::AppendBytes(_buffer, std::static_pointer_cast<Value<T>>(token)->GetValue());
+		std::uint32_t header[2] = {static_cast<std::uint32_t>(_buffer.size() - sizeof(header)), route.sequence};
+		std::memcpy(_buffer.data(), header, sizeof(header));
+
+		route.connection->Write(_buffer.data(), _buffer.size());
+	}
+
+	// Answers the request of a cancelled instance, so that its client does not wait forever
+	void Cancelled(std::size_t instanceId)
+	{
+		FrameRouter::Route route;
+		if (!_router->Take(instanceId, route)) {
+			++_unrouted;
+			return;
+		}
+		std::uint32_t header[2] = {FrameCancelled, route.sequence};
+		route.connection->Write(reinterpret_cast<const char*>(header), sizeof(header));
+	}
+
+	// Results dropped because their instance had no route
+	std::size_t Unrouted() const { return _unrouted; }
+
+};
+
+} // mdf namespace
+
+#endif
@@ -10,7 +10,6 @@
 #ifndef MDF_GRAPH_HPP
 #define MDF_GRAPH_HPP
 
-#include "Mdf.hpp"
 #include "Instruction.hpp"
 
 #include <utility>
@@ -19,6 +18,8 @@
 #include <unordered_set>
 #include <functional>
 #include <vector>
+#include <type_traits>
+#include <algorithm>
 
 #include <stdexcept>
 #include <cassert>
@@ -29,10 +30,13 @@ using NodeId = std::size_t;
 
 struct ParameterAddress {
 
+	static const std::size_t npos = std::size_t(-1);
+
 	NodeId nodeId;
 	std::string paramName;
+	std::size_t paramIndex; // Position of the parameter, npos if not resolved yet
 
-	ParameterAddress(NodeId id, std::string pname) : nodeId{id}, paramName{pname} { }
+	ParameterAddress(NodeId id, std::string pname, std::size_t pindex=npos) : nodeId{id}, paramName{pname}, paramIndex{pindex} { }
 
 	bool operator==(const ParameterAddress& other) const
 	{
@@ -41,6 +45,31 @@ struct ParameterAddress {
 
 };
 
+/*
+ * Each execution class runs on its own pool of workers (see WorkerPools),
+ * so that blocking instructions (file writes, contended locks) cannot
+ * stall the compute instructions queued behind them, and latency-critical
+ * instructions do not wait for either
+ */
+enum class ExecutionClass { Compute, Blocking, LatencyCritical };
+
+const std::size_t NumExecutionClasses = 3;
+
+inline const char *ExecutionClassName(ExecutionClass c)
+{
+	switch (c) {
+	case ExecutionClass::Blocking: return "blocking";
+	case ExecutionClass::LatencyCritical: return "latency-critical";
+	default: return "compute";
+	}
+}
+
+// Parameter address resolved once, see Graph::Port()
+struct PortHandle {
+	NodeId nodeId;
+	std::size_t paramIndex;
+};
+
 class Node {
 
 	friend class Graph;
@@ -64,9 +93,20 @@ private:
 	std::unordered_set<NodeId> dependentNodes; // Nodes that depend on 'this'
 	unsigned numDependsOn; // Number of nodes that 'this' depends on
 
+	/*
+	 * Tokens bound to constant parameters, indexed by parameter position.
+	 * The vector is shared by the clones of the node and replaced (never
+	 * modified) when a new constant is bound
+	 */
+	std::shared_ptr<const std::vector<TokenHandle>> constants;
+	unsigned numConstants;
+
+	ExecutionClass executionClass;
+
 public:
 
-	Node(NodeId iid, std::shared_ptr<Instruction> instr) : id(iid), instruction{instr}, links{}, dependentNodes{}, numDependsOn{0} { }
+	Node(NodeId iid, std::shared_ptr<Instruction> instr) : id(iid), instruction{instr}, links{}, dependentNodes{}, numDependsOn{0},
+			constants{}, numConstants{0}, executionClass{ExecutionClass::Compute} { }
 
 	Node(const Node& other) = delete;
 	Node& operator=(const Node& other) = delete;
@@ -74,13 +114,44 @@ public:
 private:
 
 	Node(NodeId i, std::shared_ptr<Instruction> ins, const std::unordered_set<ParameterAddress,AddressHash>& l,
-			const std::unordered_set<NodeId>& d, unsigned ndo) : id(i), instruction{ins}, links{l}, dependentNodes{d}, numDependsOn{ndo} { }
+			const std::unordered_set<NodeId>& d, unsigned ndo, std::shared_ptr<const std::vector<TokenHandle>> c, unsigned nc,
+			ExecutionClass ec)
+			: id(i), instruction{ins}, links{l}, dependentNodes{d}, numDependsOn{ndo}, constants{c}, numConstants{nc}, executionClass{ec} { }
 
 public:
 
 	std::shared_ptr<Node> Clone() const
 	{
-		return std::shared_ptr<Node>(new Node{id, instruction->Clone(), links, dependentNodes, numDependsOn});
+		return std::shared_ptr<Node>(new Node{id, instruction->Clone(), links, dependentNodes, numDependsOn, constants, numConstants,
+				executionClass});
+	}
+
+	// Number of tokens that each instance must receive before the node is fireable
+	std::size_t NumInputs() const
+	{
+		return instruction->Arity() - numConstants;
+	}
+
+	InputTokens Inputs(const TokenHandle *tokens) const
+	{
+		return InputTokens{tokens, constants ? constants->data() : nullptr};
+	}
+
+	// Read-only views of the node, for tools that inspect graphs
+	const Instruction& GetInstruction() const { return *instruction; }
+	const std::unordered_set<ParameterAddress,AddressHash>& Links() const { return links; }
+	const std::unordered_set<NodeId>& DependentNodes() const { return dependentNodes; }
+	ExecutionClass GetExecutionClass() const { return executionClass; }
+
+	// Nodes that receive the result of 'this' or depend on it, without repetitions
+	std::vector<NodeId> Successors() const
+	{
+		std::vector<NodeId> succ{dependentNodes.begin(), dependentNodes.end()};
+		for (auto& l : links) {
+			if (std::find(succ.begin(), succ.end(), l.nodeId) == succ.end())
+				succ.push_back(l.nodeId);
+		}
+		return succ;
 	}
 
 };
@@ -88,12 +159,26 @@ public:
 
 class Graph {
 
+	// Results of Finalize, shared by the clones of the graph (used by the interpreter, the simulator and the DOT export)
+	struct Analysis {
+		std::vector<NodeId> order; // Topological order
+		std::vector<std::size_t> depth; // Longest path from an entry node, in edges
+		std::vector<std::vector<std::size_t>> fanIn; // Links to each parameter of each node
+		std::vector<std::size_t> operands; // Tokens and dependencies that each instance of a node waits for
+		NodeId exit;
+	};
+
 	std::vector<std::shared_ptr<Node>> _instructions;
 
+	// Optional node labels, shared by the clones of the graph and replaced (never modified) by SetLabel
+	std::shared_ptr<const std::vector<std::string>> _labels;
+
+	std::shared_ptr<const Analysis> _analysis; // Null until Finalize, reset by any change to the graph
+
 public:
 
-	Graph() : _instructions{} { }
-	Graph(const Graph& other) : _instructions{}
+	Graph() : _instructions{}, _labels{}, _analysis{} { }
+	Graph(const Graph& other) : _instructions{}, _labels{other._labels}, _analysis{other._analysis}
 	{
 		_instructions.reserve(other._instructions.size());
 		for (std::size_t i = 0; i < other._instructions.size(); ++i)
@@ -104,6 +189,84 @@ public:
 	NodeId AddInstruction(F f, ParamDecl<T>... params)
 	{
 		auto instruction = MakeInstruction(f, params...);
+		_analysis.reset();
+		NodeId id = _instructions.size();
+		_instructions.push_back(std::make_shared<Node>(id, instruction));
+		return id;
+	}
+
+	// Adds an instruction with a human-readable label, used by traces and reports
+	template<typename F, typename... T>
+	NodeId AddInstruction(const std::string& label, F f, ParamDecl<T>... params)
+	{
+		NodeId id = AddInstruction(f, params...);
+		SetLabel(id, label);
+		return id;
+	}
+
+	// Adds a labelled instruction that runs on the worker pool of the execution class c
+	template<typename F, typename... T>
+	NodeId AddInstruction(const std::string& label, ExecutionClass c, F f, ParamDecl<T>... params)
+	{
+		NodeId id = AddInstruction(label, f, params...);
+		SetExecutionClass(id, c);
+		return id;
+	}
+
+	/*
+	 * Adds a batch instruction with result type R that is invoked on the
+	 * inputs of up to batchSize instances at a time (see MakeBatchInstruction)
+	 */
+	template<typename R, typename F, typename... T>
+	NodeId AddBatchInstruction(F f, std::size_t batchSize, ParamDecl<T>... params)
+	{
+		assert(batchSize > 0);
+		auto instruction = MakeBatchInstruction<R>(f, batchSize, params...);
+		_analysis.reset();
+		NodeId id = _instructions.size();
+		_instructions.push_back(std::make_shared<Node>(id, instruction));
+		return id;
+	}
+
+	/*
+	 * Adds a map instruction: f is invoked as f(chunk, args...) on chunks of
+	 * at least grain indices of the range received on the 'range' parameter,
+	 * and the node outputs the std::vector of the chunk results in order
+	 */
+	template<typename F, typename... T>
+	NodeId AddMapInstruction(F f, std::size_t grain, ParamDecl<IndexRange> range, ParamDecl<T>... params)
+	{
+		auto instruction = MakeMapInstruction(f, grain, range, params...);
+		_analysis.reset();
+		NodeId id = _instructions.size();
+		_instructions.push_back(std::make_shared<Node>(id, instruction));
+		return id;
+	}
+
+	/*
+	 * Adds an asynchronous instruction with result type R, f starts the
+	 * operation and returns (see MakeAsyncInstruction and Reactor.hpp)
+	 */
+	template<typename R, typename F, typename... T>
+	NodeId AddAsyncInstruction(F f, ParamDecl<T>... params)
+	{
+		auto instruction = MakeAsyncInstruction<R>(f, params...);
+		_analysis.reset();
+		NodeId id = _instructions.size();
+		_instructions.push_back(std::make_shared<Node>(id, instruction));
+		return id;
+	}
+
+	/*
+	 * Adds a reduce instruction that folds its operands, in arrival order,
+	 * with the associative and commutative function f: T(T,T) and outputs
+	 * the result (see MakeReduceInstruction)
+	 */
+	template<typename F, typename T, typename... P>
+	NodeId AddReduceInstruction(F f, ParamDecl<T> operand, ParamDecl<P>... operands)
+	{
+		auto instruction = MakeReduceInstruction(f, operand, operands...);
+		_analysis.reset();
 		NodeId id = _instructions.size();
 		_instructions.push_back(std::make_shared<Node>(id, instruction));
 		return id;
@@ -112,26 +275,198 @@ public:
 	bool Connect(NodeId src, NodeId dest, std::string pname)
 	{
 		assert(_instructions.size() > src && _instructions.size() > dest);
-		return (_instructions[src]->links).insert(ParameterAddress{dest, pname}).second;
+		std::size_t pindex = _instructions[dest]->instruction->ParamIndex(pname);
+		_analysis.reset();
+		return (_instructions[src]->links).insert(ParameterAddress{dest, pname, pindex}).second;
+	}
+
+	/*
+	 * Binds a token to a parameter of the node once for every graph instance,
+	 * the streamer must not send tokens to constant parameters
+	 */
+	void BindConstant(NodeId id, std::string pname, TokenHandle token)
+	{
+		assert(_instructions.size() > id && token);
+		Node& node = *_instructions[id];
+		std::size_t pindex = node.instruction->ParamIndex(pname);
+		auto constants = node.constants ? std::make_shared<std::vector<TokenHandle>>(*node.constants)
+				: std::make_shared<std::vector<TokenHandle>>(node.instruction->Arity());
+		if (!(*constants)[pindex]) node.numConstants++;
+		_analysis.reset();
+		(*constants)[pindex] = token;
+		node.constants = constants;
+	}
+
+	template<typename T, typename = typename std::enable_if<!std::is_convertible<T,TokenHandle>::value>::type>
+	void BindConstant(NodeId id, std::string pname, T val)
+	{
+		BindConstant(id, pname, TokenHandle{WrapValue<T>(val)});
 	}
 	
 	void DeclareDependency(NodeId src, NodeId dest)
 	{
 		assert(_instructions.size() > src && _instructions.size() > dest);
+		_analysis.reset();
 		auto it = (_instructions[src]->dependentNodes).insert(dest);
 		if (it.second == true) _instructions[dest]->numDependsOn++;
 	}
 
+	void SetLabel(NodeId id, const std::string& label)
+	{
+		assert(_instructions.size() > id);
+		auto labels = _labels ? std::make_shared<std::vector<std::string>>(*_labels) : std::make_shared<std::vector<std::string>>();
+		if (labels->size() <= id) labels->resize(id+1);
+		(*labels)[id] = label;
+		_labels = labels;
+	}
+
+	// Moves the node to the worker pool of the execution class c, the default is ExecutionClass::Compute
+	void SetExecutionClass(NodeId id, ExecutionClass c)
+	{
+		assert(_instructions.size() > id);
+		_instructions[id]->executionClass = c;
+	}
+
+	ExecutionClass GetExecutionClass(NodeId id) const
+	{
+		assert(_instructions.size() > id);
+		return _instructions[id]->executionClass;
+	}
+
+	// Label of the node, "node <id>" if it has none
+	std::string Label(NodeId id) const
+	{
+		if (_labels && id < _labels->size() && !(*_labels)[id].empty())
+			return (*_labels)[id];
+		return "node " + std::to_string(id);
+	}
+
+	// Resolves a parameter address, throws std::invalid_argument if there is no such parameter
+	PortHandle Port(NodeId id, const std::string& pname) const
+	{
+		assert(_instructions.size() > id);
+		return PortHandle{id, _instructions[id]->instruction->ParamIndex(pname)};
+	}
+
 	std::shared_ptr<Node> GetNode(NodeId id)
 	{
 		return _instructions.at(id);
 	}
 
+	std::shared_ptr<const Node> GetNode(NodeId id) const
+	{
+		return _instructions.at(id);
+	}
+
 	std::shared_ptr<Node> operator[](NodeId id)
 	{
 		return _instructions.at(id);
 	}
 
+	/*
+	 * Validates the graph and computes its topological order, the depth of
+	 * the nodes, the fan-in of their parameters and the operands that each
+	 * instance of a node waits for. Throws std::invalid_argument if the
+	 * graph has a cycle, a link between parameters of different types, a
+	 * parameter that is both linked and constant or receives more than one
+	 * link, a node that can never fire (no inputs and no dependencies), or
+	 * not exactly one exit node. Called by the interpreter, graphs that fail
+	 * would hang Start() or overwrite tokens
+	 */
+	void Finalize()
+	{
+		if (_analysis)
+			return;
+		if (_instructions.empty())
+			throw std::invalid_argument("Graph::Finalize: the graph has no instructions");
+
+		const std::size_t n = _instructions.size();
+		std::shared_ptr<Analysis> a = std::make_shared<Analysis>();
+		a->depth.assign(n, 0);
+		a->fanIn.resize(n);
+		a->operands.resize(n);
+		for (NodeId id = 0; id < n; ++id) {
+			a->fanIn[id].assign(_instructions[id]->instruction->Arity(), 0);
+			a->operands[id] = _instructions[id]->NumInputs() + _instructions[id]->numDependsOn;
+		}
+
+		// Links: types, constants and fan-in
+		std::vector<std::size_t> linksTo(n, 0);
+		for (NodeId id = 0; id < n; ++id) {
+			const Node& src = *_instructions[id];
+			for (auto& l : src.links) {
+				const Node& dest = *_instructions[l.nodeId];
+				const Instruction& ins = *dest.instruction;
+				std::size_t p = l.paramIndex != ParameterAddress::npos ? l.paramIndex : ins.ParamIndex(l.paramName);
+				std::type_index out = src.instruction->ResultType();
+				if (src.instruction->IsMap() && ins.IsReduce())
+					out = static_cast<const MapInstruction&>(*src.instruction).ChunkType();
+				std::type_index in = ins.ParamType(p);
+				if (out != typeid(void) && in != typeid(void) && out != in)
+					throw std::invalid_argument("Graph::Finalize: " + Label(id) + " is linked to parameter '" + l.paramName
+							+ "' of " + Label(l.nodeId) + " with a different type");
+				if (dest.constants && (*dest.constants)[p])
+					throw std::invalid_argument("Graph::Finalize: parameter '" + l.paramName + "' of " + Label(l.nodeId)
+							+ " is constant and linked to " + Label(id));
+				if (++a->fanIn[l.nodeId][p] > 1 && !ins.IsReduce())
+					throw std::invalid_argument("Graph::Finalize: parameter '" + l.paramName + "' of " + Label(l.nodeId)
+							+ " is linked to more than one node");
+				++linksTo[l.nodeId];
+			}
+		}
+		for (NodeId id = 0; id < n; ++id) {
+			const Node& node = *_instructions[id];
+			if (node.instruction->IsReduce() && linksTo[id] > node.NumInputs())
+				throw std::invalid_argument("Graph::Finalize: " + Label(id) + " is linked to more nodes than its operands");
+			if (node.NumInputs() == 0 && node.numDependsOn == 0)
+				throw std::invalid_argument("Graph::Finalize: " + Label(id) + " has no inputs and no dependencies, it can never fire");
+		}
+
+		// Topological order and depths
+		std::vector<std::size_t> missing(n, 0);
+		std::vector<std::vector<NodeId>> successors(n);
+		for (NodeId id = 0; id < n; ++id) {
+			successors[id] = _instructions[id]->Successors();
+			for (NodeId s : successors[id])
+				++missing[s];
+		}
+		for (NodeId id = 0; id < n; ++id)
+			if (missing[id] == 0) a->order.push_back(id);
+		for (std::size_t i = 0; i < a->order.size(); ++i) {
+			NodeId id = a->order[i];
+			for (NodeId s : successors[id]) {
+				a->depth[s] = std::max(a->depth[s], a->depth[id] + 1);
+				if (--missing[s] == 0) a->order.push_back(s);
+			}
+		}
+		if (a->order.size() != n) {
+			for (NodeId id = 0; id < n; ++id)
+				if (missing[id] > 0)
+					throw std::invalid_argument("Graph::Finalize: the graph has a cycle through " + Label(id));
+		}
+
+		// Each instance is counted as completed when its exit node is drained
+		std::vector<NodeId> exits;
+		for (NodeId id = 0; id < n; ++id)
+			if (successors[id].empty()) exits.push_back(id);
+		if (exits.size() != 1) {
+			std::string names;
+			for (NodeId id : exits)
+				names += (names.empty() ? "" : ", ") + Label(id);
+			throw std::invalid_argument("Graph::Finalize: the graph must have exactly one exit node, found " + names);
+		}
+		a->exit = exits.front();
+
+		_analysis = a;
+	}
+
+	// The following require a finalized graph
+	const std::vector<NodeId>& TopologicalOrder() const { return Finalized().order; }
+	std::size_t Depth(NodeId id) const { return Finalized().depth.at(id); }
+	NodeId ExitNode() const { return Finalized().exit; }
+	std::size_t FanIn(NodeId id, std::size_t paramIndex) const { return Finalized().fanIn.at(id).at(paramIndex); }
+	std::size_t Operands(NodeId id) const { return Finalized().operands.at(id); }
+
 	std::shared_ptr<Graph> Clone() const
 	{
 		return std::make_shared<Graph>(*this);
@@ -142,6 +477,15 @@ public:
 		return _instructions.size();
 	}
 
+private:
+
+	const Analysis& Finalized() const
+	{
+		if (!_analysis)
+			throw std::logic_error("Graph: the graph is not finalized");
+		return *_analysis;
+	}
+
 };
 
 }
@@ -15,7 +15,18 @@
 #include <memory>
 #include <string>
 #include <tuple>
-#include <unordered_map>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
+#include <typeinfo>
+#include <typeindex>
+#include <stdexcept>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cassert>
 
 namespace mdf {
 
@@ -27,25 +38,189 @@ struct ParamDecl
 	ParamDecl(std::string n) : name(n) { }
 };
 
+/*
+ * The input tokens of an instruction, indexed by parameter position.
+ * Tokens bound to the constant parameters of a node are shared by all the
+ * graph instances and are read directly from the node
+ */
+class InputTokens {
+
+	const TokenHandle *_tokens;
+	const TokenHandle *_constants;
+
+public:
+
+	InputTokens(const TokenHandle *tokens, const TokenHandle *constants=nullptr) : _tokens{tokens}, _constants{constants} { }
+
+	const TokenHandle& operator[](std::size_t i) const
+	{
+		return (_constants && _constants[i]) ? _constants[i] : _tokens[i];
+	}
+
+};
+
+// Half open range of indices [begin, end) processed by a map instruction
+struct IndexRange {
+	std::size_t begin;
+	std::size_t end;
+
+	std::size_t Size() const { return end > begin ? end - begin : 0; }
+};
+
 class Instruction {
 public:
 	Instruction() { }
 
 	virtual ~Instruction() { }
 
-	virtual std::shared_ptr<Token> Execute(const std::unordered_map<std::string,TokenHandle>& inputTokens) const = 0;
+	virtual std::shared_ptr<Token> Execute(const InputTokens& inputTokens) const = 0;
 	virtual std::size_t Arity() const = 0;
 
+	// Position of the parameter, throws std::invalid_argument if there is no such parameter
+	virtual std::size_t ParamIndex(const std::string& name) const = 0;
+
+	/*
+	 * Batched instructions process the inputs of up to BatchSize() graph
+	 * instances with a single call, 0 means that the instruction is scalar.
+	 * The default ExecuteBatch() simply executes each instance in turn
+	 */
+	virtual std::size_t BatchSize() const { return 0; }
+
+	virtual void ExecuteBatch(const std::vector<InputTokens>& inputs, std::vector<TokenHandle>& results) const
+	{
+		for (auto& m : inputs)
+			results.push_back(Execute(m));
+	}
+
+	virtual bool IsMap() const { return false; }
+	virtual bool IsReduce() const { return false; }
+	virtual bool IsAsync() const { return false; }
+
+	// Types of the result and of the parameters, typeid(void) if unknown (see Graph::Finalize)
+	virtual std::type_index ResultType() const { return typeid(void); }
+	virtual std::type_index ParamType(std::size_t) const { return typeid(void); }
+
 	virtual std::shared_ptr<Instruction> Clone() const = 0;
 };
 
+/*
+ * Map instructions split the IndexRange received on their range parameter
+ * into chunks at execution time. Each chunk result is computed separately,
+ * and the results are joined in a single token once every chunk is done
+ */
+class MapInstruction : public Instruction {
+public:
+
+	bool IsMap() const { return true; }
+
+	virtual IndexRange Range(const InputTokens& inputTokens) const = 0;
+	virtual std::size_t Grain() const = 0; // Smallest chunk size worth splitting
+
+	virtual TokenHandle ExecuteChunk(const InputTokens& inputTokens, IndexRange chunk) const = 0;
+
+	// parts holds the chunk results paired with the beginning of each chunk
+	virtual TokenHandle Join(std::vector<std::pair<std::size_t,TokenHandle>>& parts) const = 0;
+
+	// Type of the chunk results, which are folded into the reduce instructions linked to the map
+	virtual std::type_index ChunkType() const { return typeid(void); }
+};
+
+/*
+ * Reduce instructions fold their operands with an associative and
+ * commutative combine function as soon as each of them is available,
+ * rather than waiting for all of them, so operands are combined in
+ * arrival order. An operand connected to a map instruction receives every
+ * chunk result of the map as a separate operand
+ */
+class ReduceInstruction : public Instruction {
+public:
 
+	bool IsReduce() const { return true; }
+
+	virtual TokenHandle Combine(const TokenHandle& a, const TokenHandle& b) const = 0;
+};
+
+/*
+ * Asynchronous instructions start an operation (I/O, a timer, a request to
+ * another process) and return without waiting for it. The operation
+ * completes by calling the continuation with the result, from any thread,
+ * and the interpreter resumes the instance on a worker. The worker that
+ * started the operation is free to run other tasks in the meantime.
+ * Execute() starts the operation and blocks until it completes
+ */
+class AsyncInstruction : public Instruction {
+public:
+
+	using Continuation = std::function<void(TokenHandle)>;
+
+	bool IsAsync() const { return true; }
+
+	virtual void ExecuteAsync(const InputTokens& inputTokens, Continuation done) const = 0;
+
+	std::shared_ptr<Token> Execute(const InputTokens& inputTokens) const
+	{
+		struct Wait {
+			std::mutex mtx;
+			std::condition_variable cv;
+			TokenHandle res;
+			bool done = false;
+		};
+		auto w = std::make_shared<Wait>();
+		ExecuteAsync(inputTokens, [w](TokenHandle res) {
+			std::lock_guard<std::mutex> lock{w->mtx};
+			w->res = res;
+			w->done = true;
+			w->cv.notify_all();
+		});
+		std::unique_lock<std::mutex> lock{w->mtx};
+		w->cv.wait(lock, [&w]() { return w->done; });
+		return w->res;
+	}
+};
+
+/*
+ * Typed handle passed to the function of an asynchronous instruction, the
+ * operation completes when it is called with the result. It can be copied
+ * and called from any thread, but only once
+ */
+template<typename R>
+class Completion {
+
+	AsyncInstruction::Continuation _done;
+	std::shared_ptr<std::atomic<bool>> _called;
+
+public:
+
+	explicit Completion(AsyncInstruction::Continuation done) : _done{std::move(done)}, _called{std::make_shared<std::atomic<bool>>(false)} { }
+
+	void operator()(R value) const
+	{
+		if (_called->exchange(true))
+			throw std::logic_error("Completion: the operation has already completed");
+		_done(std::make_shared<Value<R>>(std::move(value)));
+	}
+
+};
 
 namespace detail {
 
+template<typename... T>
+std::type_index TypeAt(std::size_t i)
+{
+	static const std::vector<std::type_index> types{std::type_index(typeid(T))...};
+	return i < types.size() ? types[i] : std::type_index(typeid(void));
+}
+
+inline std::size_t IndexOf(const std::vector<std::string>& names, const std::string& name)
+{
+	for (std::size_t i = 0; i < names.size(); ++i)
+		if (names[i] == name) return i;
+	throw std::invalid_argument("Instruction: no parameter named '" + name + "'");
+}
+
 /*
  * Recursive template to invoke the instruction code
- * f is the function to call, m is the <Name,Token> map, T is the tuple of parameter
+ * f is the function to call, m holds the input tokens by position, T is the tuple of parameter
  * declarations (each declaration is a ParamDecl<U> struct containing the name of the
  * token linked to the parameter and the type ParamDecl<U>::Type of the parameter)
  * p... is the list of unpacked parameters
@@ -54,17 +229,17 @@ namespace detail {
 template<size_t N> struct Unpack
 {
 	template<typename F, typename T, typename... P>
-	static auto unpack(F f, const std::unordered_map<std::string,TokenHandle> &m, T t, P... p)
-		-> decltype(Unpack<N-1>::unpack(f, m, t, std::static_pointer_cast<Value<typename std::tuple_element<N-1,T>::type::Type>>(m.at(std::get<N-1>(t).name))->GetValue(), p...))
+	static auto unpack(F f, const InputTokens& m, T t, P... p)
+		-> decltype(Unpack<N-1>::unpack(f, m, t, std::static_pointer_cast<Value<typename std::tuple_element<N-1,T>::type::Type>>(m[N-1])->GetValue(), p...))
 	{
-		return Unpack<N-1>::unpack(f, m, t, std::static_pointer_cast<Value<typename std::tuple_element<N-1,T>::type::Type>>(m.at(std::get<N-1>(t).name))->GetValue(), p...);
+		return Unpack<N-1>::unpack(f, m, t, std::static_pointer_cast<Value<typename std::tuple_element<N-1,T>::type::Type>>(m[N-1])->GetValue(), p...);
 	}
 };
 
 template<> struct Unpack<0>
 {
 	template<typename F, typename T, typename... P>
-	static auto unpack(F f, const std::unordered_map<std::string,TokenHandle>& m, T t, P... p)
+	static auto unpack(F f, const InputTokens&, T, P... p)
 		-> decltype(f(p...))
 	{
 		return f(p...);
@@ -72,7 +247,7 @@ template<> struct Unpack<0>
 };
 
 template<typename F, typename... ArgTypes>
-auto Call(F f, const std::unordered_map<std::string,TokenHandle>& m, std::tuple<ArgTypes...> args)
+auto Call(F f, const InputTokens& m, std::tuple<ArgTypes...> args)
 	-> decltype(Unpack<std::tuple_size<decltype(args)>::value>::unpack(f, m, args))
 {
 	return Unpack<std::tuple_size<decltype(args)>::value>::unpack(f, m, args);
@@ -83,16 +258,17 @@ class InstructionImpl : public Instruction {
 
 	F _fct;
 	const std::tuple<ParamDecl<ArgTypes>...> _args;
+	const std::vector<std::string> _names;
 	const std::size_t _n;
 
 public:
 
-	InstructionImpl(F f, ParamDecl<ArgTypes>... args) : _fct{f}, _args{std::make_tuple(args...)},
+	InstructionImpl(F f, ParamDecl<ArgTypes>... args) : _fct{f}, _args{std::make_tuple(args...)}, _names{args.name...},
 		_n{std::tuple_size<std::tuple<ParamDecl<ArgTypes>...>>::value} { }
 	
-	InstructionImpl(const InstructionImpl<F,ArgTypes...>& other) : _fct{other._fct}, _args{other._args}, _n(other._n) { }
+	InstructionImpl(const InstructionImpl<F,ArgTypes...>& other) : _fct{other._fct}, _args{other._args}, _names{other._names}, _n(other._n) { }
 
-	std::shared_ptr<Token> Execute(const std::unordered_map<std::string,TokenHandle>& inputTokens) const
+	std::shared_ptr<Token> Execute(const InputTokens& inputTokens) const
 	{
 		auto r = Call(_fct, inputTokens, _args);
 		return std::make_shared<Value<decltype(r)>>(r);
@@ -103,6 +279,21 @@ public:
 		return _n;
 	}
 
+	std::size_t ParamIndex(const std::string& name) const
+	{
+		return IndexOf(_names, name);
+	}
+
+	std::type_index ResultType() const
+	{
+		return typeid(typename std::decay<decltype(Call(_fct, std::declval<const InputTokens&>(), _args))>::type);
+	}
+
+	std::type_index ParamType(std::size_t i) const
+	{
+		return TypeAt<ArgTypes...>(i);
+	}
+
 	std::shared_ptr<Instruction> Clone() const
 	{
 		return std::make_shared<InstructionImpl<F,ArgTypes...>>(*this);
@@ -110,6 +301,367 @@ public:
 
 };
 
+// Column of bool values, std::vector<bool> is packed and has no data()
+class BoolColumn {
+
+	std::unique_ptr<bool[]> _data;
+	std::size_t _size;
+	std::size_t _capacity;
+
+public:
+
+	BoolColumn() : _data{}, _size{0}, _capacity{0} { }
+
+	void clear() { _size = 0; }
+
+	void resize(std::size_t n)
+	{
+		if (n > _capacity) {
+			std::unique_ptr<bool[]> data{new bool[n]};
+			std::copy(_data.get(), _data.get() + _size, data.get());
+			_data = std::move(data);
+			_capacity = n;
+		}
+		std::fill(_data.get() + std::min(_size, n), _data.get() + n, false);
+		_size = n;
+	}
+
+	void push_back(bool v)
+	{
+		std::size_t i = _size;
+		resize(_size < _capacity ? _size + 1 : std::max<std::size_t>(2 * _capacity, 16));
+		_size = i + 1;
+		_data[i] = v;
+	}
+
+	bool *data() { return _data.get(); }
+	bool *begin() { return _data.get(); }
+	bool *end() { return _data.get() + _size; }
+
+};
+
+// Buffer of the batch values of a parameter or result of type T
+template<typename T>
+using Column = typename std::conditional<std::is_same<T,bool>::value, BoolColumn, std::vector<T>>::type;
+
+/*
+ * Batch instructions take their inputs as structure-of-arrays buffers: the
+ * kernel is invoked as f(n, p1, ..., pk, out) where each pi points to the
+ * n values of the i-th parameter and out points to the n results
+ */
+
+template<size_t N> struct Gather
+{
+	template<typename B, typename T>
+	static void gather(B& buffers, const std::vector<InputTokens>& inputs, const T& t)
+	{
+		auto& column = std::get<N-1>(buffers);
+		column.clear();
+		for (auto& m : inputs)
+			column.push_back(std::static_pointer_cast<Value<typename std::tuple_element<N-1,T>::type::Type>>(m[N-1])->GetValue());
+		Gather<N-1>::gather(buffers, inputs, t);
+	}
+};
+
+template<> struct Gather<0>
+{
+	template<typename B, typename T>
+	static void gather(B&, const std::vector<InputTokens>&, const T&) { }
+};
+
+template<size_t N> struct BatchUnpack
+{
+	template<typename F, typename B, typename R, typename... P>
+	static void unpack(F f, std::size_t n, B& buffers, R* out, P... p)
+	{
+		BatchUnpack<N-1>::unpack(f, n, buffers, out, std::get<N-1>(buffers).data(), p...);
+	}
+};
+
+template<> struct BatchUnpack<0>
+{
+	template<typename F, typename B, typename R, typename... P>
+	static void unpack(F f, std::size_t n, B&, R* out, P... p)
+	{
+		f(n, p..., out);
+	}
+};
+
+template<typename R, typename F, typename... ArgTypes>
+class BatchInstructionImpl : public Instruction {
+
+	F _fct;
+	const std::tuple<ParamDecl<ArgTypes>...> _args;
+	const std::vector<std::string> _names;
+	const std::size_t _n;
+	const std::size_t _batchSize;
+
+public:
+
+	BatchInstructionImpl(F f, std::size_t batchSize, ParamDecl<ArgTypes>... args) : _fct{f}, _args{std::make_tuple(args...)},
+		_names{args.name...}, _n{std::tuple_size<std::tuple<ParamDecl<ArgTypes>...>>::value}, _batchSize{batchSize} { }
+
+	BatchInstructionImpl(const BatchInstructionImpl<R,F,ArgTypes...>& other) : _fct{other._fct}, _args{other._args},
+		_names{other._names}, _n(other._n), _batchSize{other._batchSize} { }
+
+	std::shared_ptr<Token> Execute(const InputTokens& inputTokens) const
+	{
+		std::vector<TokenHandle> results;
+		ExecuteBatch(std::vector<InputTokens>{inputTokens}, results);
+		return results.front();
+	}
+
+	void ExecuteBatch(const std::vector<InputTokens>& inputs, std::vector<TokenHandle>& results) const
+	{
+		// The columns are reused across calls to avoid reallocating them for each batch
+		static thread_local std::tuple<Column<ArgTypes>...> buffers;
+		static thread_local Column<R> out;
+
+		Gather<sizeof...(ArgTypes)>::gather(buffers, inputs, _args);
+		out.resize(inputs.size());
+		BatchUnpack<sizeof...(ArgTypes)>::unpack(_fct, inputs.size(), buffers, out.data());
+		for (auto& r : out)
+			results.push_back(std::make_shared<Value<R>>(r));
+	}
+
+	std::size_t Arity() const
+	{
+		return _n;
+	}
+
+	std::size_t ParamIndex(const std::string& name) const
+	{
+		return IndexOf(_names, name);
+	}
+
+	std::size_t BatchSize() const
+	{
+		return _batchSize;
+	}
+
+	std::type_index ResultType() const
+	{
+		return typeid(R);
+	}
+
+	std::type_index ParamType(std::size_t i) const
+	{
+		return TypeAt<ArgTypes...>(i);
+	}
+
+	std::shared_ptr<Instruction> Clone() const
+	{
+		return std::make_shared<BatchInstructionImpl<R,F,ArgTypes...>>(*this);
+	}
+
+};
+
+template<typename F, typename... ArgTypes>
+class MapInstructionImpl : public MapInstruction {
+
+	using R = typename std::result_of<F(IndexRange, ArgTypes...)>::type;
+
+	F _fct;
+	const std::tuple<ParamDecl<IndexRange>, ParamDecl<ArgTypes>...> _args;
+	const std::vector<std::string> _names;
+	const std::size_t _n;
+	const std::size_t _grain;
+
+public:
+
+	MapInstructionImpl(F f, std::size_t grain, ParamDecl<IndexRange> range, ParamDecl<ArgTypes>... args) : _fct{f},
+		_args{std::make_tuple(range, args...)}, _names{range.name, args.name...}, _n{1 + sizeof...(ArgTypes)},
+		_grain{grain > 0 ? grain : 1} { }
+
+	MapInstructionImpl(const MapInstructionImpl<F,ArgTypes...>& other) : _fct{other._fct}, _args{other._args},
+		_names{other._names}, _n(other._n), _grain{other._grain} { }
+
+	std::shared_ptr<Token> Execute(const InputTokens& inputTokens) const
+	{
+		std::vector<std::pair<std::size_t,TokenHandle>> parts;
+		IndexRange range = Range(inputTokens);
+		parts.emplace_back(range.begin, ExecuteChunk(inputTokens, range));
+		return Join(parts);
+	}
+
+	IndexRange Range(const InputTokens& inputTokens) const
+	{
+		return std::static_pointer_cast<Value<IndexRange>>(inputTokens[0])->GetValue();
+	}
+
+	std::size_t Grain() const
+	{
+		return _grain;
+	}
+
+	TokenHandle ExecuteChunk(const InputTokens& inputTokens, IndexRange chunk) const
+	{
+		// The range parameter is replaced by the chunk
+		const F& f = _fct;
+		auto r = Call([&f, chunk](IndexRange, ArgTypes... args) { return f(chunk, args...); }, inputTokens, _args);
+		return std::make_shared<Value<R>>(r);
+	}
+
+	TokenHandle Join(std::vector<std::pair<std::size_t,TokenHandle>>& parts) const
+	{
+		std::sort(parts.begin(), parts.end(),
+				[](const std::pair<std::size_t,TokenHandle>& a, const std::pair<std::size_t,TokenHandle>& b) { return a.first < b.first; });
+		std::vector<R> results;
+		results.reserve(parts.size());
+		for (auto& p : parts)
+			results.push_back(std::static_pointer_cast<Value<R>>(p.second)->GetValue());
+		return std::make_shared<Value<std::vector<R>>>(results);
+	}
+
+	std::size_t Arity() const
+	{
+		return _n;
+	}
+
+	std::size_t ParamIndex(const std::string& name) const
+	{
+		return IndexOf(_names, name);
+	}
+
+	std::type_index ResultType() const
+	{
+		return typeid(std::vector<R>);
+	}
+
+	std::type_index ChunkType() const
+	{
+		return typeid(R);
+	}
+
+	std::type_index ParamType(std::size_t i) const
+	{
+		return TypeAt<IndexRange, ArgTypes...>(i);
+	}
+
+	std::shared_ptr<Instruction> Clone() const
+	{
+		return std::make_shared<MapInstructionImpl<F,ArgTypes...>>(*this);
+	}
+
+};
+
+template<typename R, typename F, typename... ArgTypes>
+class AsyncInstructionImpl : public AsyncInstruction {
+
+	F _fct;
+	const std::tuple<ParamDecl<ArgTypes>...> _args;
+	const std::vector<std::string> _names;
+	const std::size_t _n;
+
+public:
+
+	AsyncInstructionImpl(F f, ParamDecl<ArgTypes>... args) : _fct{f}, _args{std::make_tuple(args...)}, _names{args.name...},
+		_n{sizeof...(ArgTypes)} { }
+
+	AsyncInstructionImpl(const AsyncInstructionImpl<R,F,ArgTypes...>& other) : _fct{other._fct}, _args{other._args},
+		_names{other._names}, _n(other._n) { }
+
+	void ExecuteAsync(const InputTokens& inputTokens, Continuation done) const
+	{
+		// The completion is passed in front of the parameters
+		const F& f = _fct;
+		Completion<R> completion{std::move(done)};
+		Call([&f, &completion](ArgTypes... args) { f(completion, args...); }, inputTokens, _args);
+	}
+
+	std::size_t Arity() const
+	{
+		return _n;
+	}
+
+	std::size_t ParamIndex(const std::string& name) const
+	{
+		return IndexOf(_names, name);
+	}
+
+	std::type_index ResultType() const
+	{
+		return typeid(R);
+	}
+
+	std::type_index ParamType(std::size_t i) const
+	{
+		return TypeAt<ArgTypes...>(i);
+	}
+
+	std::shared_ptr<Instruction> Clone() const
+	{
+		return std::make_shared<AsyncInstructionImpl<R,F,ArgTypes...>>(*this);
+	}
+
+};
+
+// Checks that f(b,a) equals r = f(a,b) when T has operator==, results that are not equal to themselves (NaN) pass
+template<typename F, typename T>
+auto Commutes(const F& f, const T& a, const T& b, const T& r, int) -> decltype(r == r)
+{
+	return f(b, a) == r || !(r == r);
+}
+
+template<typename F, typename T>
+bool Commutes(const F&, const T&, const T&, const T&, long) { return true; }
+
+template<typename F, typename T>
+class ReduceInstructionImpl : public ReduceInstruction {
+
+	F _fct;
+	const std::vector<std::string> _operands;
+
+public:
+
+	ReduceInstructionImpl(F f, std::vector<std::string> operands) : _fct{f}, _operands{operands} { }
+
+	ReduceInstructionImpl(const ReduceInstructionImpl<F,T>& other) : _fct{other._fct}, _operands{other._operands} { }
+
+	std::shared_ptr<Token> Execute(const InputTokens& inputTokens) const
+	{
+		TokenHandle acc = inputTokens[0];
+		for (std::size_t i = 1; i < _operands.size(); ++i)
+			acc = Combine(acc, inputTokens[i]);
+		return acc;
+	}
+
+	TokenHandle Combine(const TokenHandle& a, const TokenHandle& b) const
+	{
+		const T& x = std::static_pointer_cast<Value<T>>(a)->GetValue();
+		const T& y = std::static_pointer_cast<Value<T>>(b)->GetValue();
+		T r = _fct(x, y);
+		assert(Commutes(_fct, x, y, r, 0) && "reduce functions must be commutative");
+		return std::make_shared<Value<T>>(r);
+	}
+
+	std::size_t Arity() const
+	{
+		return _operands.size();
+	}
+
+	std::size_t ParamIndex(const std::string& name) const
+	{
+		return IndexOf(_operands, name);
+	}
+
+	std::type_index ResultType() const
+	{
+		return typeid(T);
+	}
+
+	std::type_index ParamType(std::size_t) const
+	{
+		return typeid(T);
+	}
+
+	std::shared_ptr<Instruction> Clone() const
+	{
+		return std::make_shared<ReduceInstructionImpl<F,T>>(*this);
+	}
+
+};
+
 } // detail namespace 
 
 
@@ -120,6 +672,36 @@ std::shared_ptr<Instruction> MakeInstruction(F f, ParamDecl<T>... params)
 	return std::make_shared<detail::InstructionImpl<F, T...>>(f, params...);
 }
 
+template<typename R, typename F, typename... T>
+std::shared_ptr<Instruction> MakeBatchInstruction(F f, std::size_t batchSize, ParamDecl<T>... params)
+{
+	return std::make_shared<detail::BatchInstructionImpl<R, F, T...>>(f, batchSize, params...);
+}
+
+template<typename F, typename... T>
+std::shared_ptr<Instruction> MakeMapInstruction(F f, std::size_t grain, ParamDecl<IndexRange> range, ParamDecl<T>... params)
+{
+	return std::make_shared<detail::MapInstructionImpl<F, T...>>(f, grain, range, params...);
+}
+
+/*
+ * f is invoked as f(done, args...) where done is a Completion<R>, and must
+ * arrange for done(result) to be called once the operation completes
+ */
+template<typename R, typename F, typename... T>
+std::shared_ptr<Instruction> MakeAsyncInstruction(F f, ParamDecl<T>... params)
+{
+	return std::make_shared<detail::AsyncInstructionImpl<R, F, T...>>(f, params...);
+}
+
+// f must be associative and commutative, debug builds check the latter when T has operator==
+template<typename F, typename T, typename... P>
+std::shared_ptr<Instruction> MakeReduceInstruction(F f, ParamDecl<T> operand, ParamDecl<P>... operands)
+{
+	static_assert(std::is_same<std::tuple<T, P...>, std::tuple<P..., T>>::value, "MakeReduceInstruction: all the operands must have the same type");
+	return std::make_shared<detail::ReduceInstructionImpl<F, T>>(f, std::vector<std::string>{operand.name, operands.name...});
+}
+
 } // mdf namespace
 
 #endif 
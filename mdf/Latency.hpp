@@ -0,0 +1,271 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+#ifndef MDF_LATENCY_HPP
+#define MDF_LATENCY_HPP
+
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "Printer.hpp"
+
+namespace mdf {
+
+/*
+ * End-to-end latency of graph instances
+ * When MDF_ENABLE_LATENCY is defined every instance is timestamped when its
+ * input is read from the streamer, when its first instruction starts and
+ * when its result is drained. The total latency is split in queueing delay
+ * (read to first start) and execution time (first start to drain), each
+ * recorded in a log-linear histogram, and the percentiles are printed when
+ * Start() returns.
+ */
+
+/*
+ * Log-linear bucketing in the style of HdrHistogram: values below 2^SubBits
+ * have their own bucket, larger values are split in 2^SubBits buckets per
+ * power of two, so the relative error is below 2^-SubBits (about 3%)
+ */
+struct LatencyBuckets {
+
+	static constexpr unsigned SubBits = 5;
+	static constexpr unsigned SubCount = 1u << SubBits;
+	static constexpr unsigned Count = (64 - SubBits + 1) * SubCount;
+
+	static unsigned Index(std::uint64_t v)
+	{
+		if (v < SubCount)
+			return static_cast<unsigned>(v);
+		unsigned e = 63 - __builtin_clzll(v);
+		return (e - SubBits + 1) * SubCount + static_cast<unsigned>((v >> (e - SubBits)) - SubCount);
+	}
+
+	// Largest value that falls in bucket i
+	static std::uint64_t Highest(unsigned i)
+	{
+		if (i < SubCount)
+			return i;
+		unsigned e = i / SubCount + SubBits - 1;
+		std::uint64_t lowest = std::uint64_t{SubCount + i % SubCount} << (e - SubBits);
+		return lowest + (std::uint64_t{1} << (e - SubBits)) - 1;
+	}
+
+};
+
+// Snapshot of a latency histogram
+class LatencyDistribution {
+
+private:
+
+	std::vector<std::uint64_t> _counts;
+	std::uint64_t _count;
+	std::uint64_t _sum;
+	std::uint64_t _max;
+
+public:
+
+	LatencyDistribution() : _counts(LatencyBuckets::Count), _count{0}, _sum{0}, _max{0} { }
+
+	LatencyDistribution(std::vector<std::uint64_t> counts, std::uint64_t sum, std::uint64_t max)
+			: _counts(std::move(counts)), _count{0}, _sum{sum}, _max{max}
+	{
+		for (auto c : _counts) _count += c;
+	}
+
+	std::uint64_t Count() const { return _count; }
+
+	std::chrono::nanoseconds Mean() const
+	{
+		return std::chrono::nanoseconds{_count > 0 ? static_cast<std::int64_t>(_sum / _count) : 0};
+	}
+
+	std::chrono::nanoseconds Max() const { return std::chrono::nanoseconds{static_cast<std::int64_t>(_max)}; }
+
+	// Value at or below which a fraction p of the samples fall, 0 <= p <= 1
+	std::chrono::nanoseconds Percentile(double p) const
+	{
+		if (_count == 0)
+			return std::chrono::nanoseconds{0};
+		std::uint64_t rank = static_cast<std::uint64_t>(p * _count + 0.5);
+		if (rank == 0) rank = 1;
+		std::uint64_t seen = 0;
+		for (unsigned i = 0; i < _counts.size(); ++i) {
+			seen += _counts[i];
+			if (seen >= rank) {
+				std::uint64_t v = LatencyBuckets::Highest(i);
+				return std::chrono::nanoseconds{static_cast<std::int64_t>(v < _max ? v : _max)};
+			}
+		}
+		return Max();
+	}
+
+	// Fraction of the samples at or below d, to the resolution of the buckets
+	double Fraction(std::chrono::nanoseconds d) const
+	{
+		if (_count == 0)
+			return 0;
+		std::uint64_t within = 0;
+		for (unsigned i = 0; i < _counts.size() && LatencyBuckets::Highest(i) <= static_cast<std::uint64_t>(d.count()); ++i)
+			within += _counts[i];
+		return static_cast<double>(within) / _count;
+	}
+
+};
+
+// Lock-free histogram, any thread can record while another takes snapshots
+class LatencyHistogram {
+
+private:
+
+	std::atomic<std::uint64_t> _counts[LatencyBuckets::Count];
+	std::atomic<std::uint64_t> _sum;
+	std::atomic<std::uint64_t> _max;
+
+public:
+
+	LatencyHistogram() : _sum{0}, _max{0}
+	{
+		for (auto& c : _counts) c.store(0, std::memory_order_relaxed);
+	}
+
+	LatencyHistogram(const LatencyHistogram&) = delete;
+	LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+	void Record(std::uint64_t ns)
+	{
+		_counts[LatencyBuckets::Index(ns)].fetch_add(1, std::memory_order_relaxed);
+		_sum.fetch_add(ns, std::memory_order_relaxed);
+		std::uint64_t max = _max.load(std::memory_order_relaxed);
+		while (ns > max && !_max.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+			;
+	}
+
+	LatencyDistribution Snapshot() const
+	{
+		std::vector<std::uint64_t> counts(LatencyBuckets::Count);
+		for (unsigned i = 0; i < LatencyBuckets::Count; ++i)
+			counts[i] = _counts[i].load(std::memory_order_relaxed);
+		return LatencyDistribution{std::move(counts), _sum.load(std::memory_order_relaxed), _max.load(std::memory_order_relaxed)};
+	}
+
+};
+
+struct LatencyReport {
+	bool enabled;
+	LatencyDistribution total; // From the read of the input to the drain of the result
+	LatencyDistribution queueing; // From the read of the input to the start of the first instruction
+	LatencyDistribution execution; // From the start of the first instruction to the drain of the result
+};
+
+inline void PrintLatency(const LatencyReport& r)
+{
+	if (!r.enabled) {
+		out.Println("Latency tracking disabled (define MDF_ENABLE_LATENCY).");
+		return;
+	}
+	auto us = [](std::chrono::nanoseconds d) { return d.count() / 1000.0; };
+	const char *names[] = {"total", "queueing", "execution"};
+	const LatencyDistribution *dists[] = {&r.total, &r.queueing, &r.execution};
+	out.Println("Latency of ", r.total.Count(), " instances (us):");
+	for (unsigned k = 0; k < 3; ++k) {
+		const LatencyDistribution& d = *dists[k];
+		out.Println("  ", names[k], ": mean ", us(d.Mean()), ", p50 ", us(d.Percentile(0.5)), ", p99 ", us(d.Percentile(0.99)),
+				", p999 ", us(d.Percentile(0.999)), ", max ", us(d.Max()));
+	}
+}
+
+namespace detail {
+
+#ifdef MDF_ENABLE_LATENCY
+
+class LatencyRecorder {
+
+public:
+
+	using Stamp = std::int64_t;
+
+	// Timestamps of an instance
+	struct Marks {
+		Stamp read;
+		std::atomic<Stamp> started; // 0 until the first instruction starts
+
+		explicit Marks(Stamp r) : read{r}, started{0} { }
+	};
+
+private:
+
+	LatencyHistogram _total;
+	LatencyHistogram _queueing;
+	LatencyHistogram _execution;
+
+public:
+
+	static Stamp Now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void Started(Marks& m)
+	{
+		if (m.started.load(std::memory_order_relaxed) == 0) {
+			Stamp expected = 0;
+			m.started.compare_exchange_strong(expected, Now(), std::memory_order_relaxed);
+		}
+	}
+
+	void Drained(const Marks& m)
+	{
+		Stamp now = Now();
+		Stamp started = m.started.load(std::memory_order_relaxed);
+		if (started == 0) started = now;
+		_total.Record(now - m.read);
+		_queueing.Record(started - m.read);
+		_execution.Record(now - started);
+	}
+
+	LatencyReport Report() const
+	{
+		return LatencyReport{true, _total.Snapshot(), _queueing.Snapshot(), _execution.Snapshot()};
+	}
+
+};
+
+#else
+
+// Latency tracking disabled, every hook compiles to nothing
+class LatencyRecorder {
+
+public:
+
+	struct Stamp { };
+
+	struct Marks {
+		explicit Marks(Stamp) { }
+	};
+
+	static Stamp Now() { return Stamp{}; }
+	void Started(Marks&) { }
+	void Drained(const Marks&) { }
+
+	LatencyReport Report() const
+	{
+		return LatencyReport{false, LatencyDistribution{}, LatencyDistribution{}, LatencyDistribution{}};
+	}
+
+};
+
+#endif
+
+} // detail namespace
+
+} // mdf namespace
+
+#endif
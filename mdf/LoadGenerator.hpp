@@ -0,0 +1,334 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+#ifndef MDF_LOAD_GENERATOR_HPP
+#define MDF_LOAD_GENERATOR_HPP
+
+#include <vector>
+#include <memory>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <ostream>
+#include <cstdint>
+#include <cmath>
+
+#include "Mdf.hpp"
+#include "Latency.hpp"
+
+namespace mdf {
+
+/*
+ * Open-loop load generation
+ * Example streamers are closed-loop: the next instance is read as soon as
+ * the interpreter accepts it, so a slow interpreter slows down its own
+ * load and the measured latency hides the queueing that real clients
+ * would see (coordinated omission). OpenLoopStreamer instead releases
+ * instances on a wall-clock schedule, at a constant rate or with Poisson
+ * arrivals, and records for every instance its intended arrival time, the
+ * time it was actually handed to the interpreter and the time its result
+ * was drained. Latencies are measured from the intended arrival, so time
+ * spent waiting for the interpreter to accept an instance counts.
+ * Instances may be given a latency budget: their deadline is then their
+ * intended arrival plus the budget, and the interpreter cancels those that
+ * cannot be drained in time, see Deadline in mdf/Mdf.hpp.
+ */
+
+/*
+ * Arrival times of an open-loop schedule, as offsets from its start.
+ * Bursty schedules alternate periods of on seconds at burst times the
+ * rate and periods of off seconds at the rate
+ */
+class ArrivalSchedule {
+
+private:
+
+	double _rate; // Instances per second
+	bool _poisson;
+	std::uint64_t _seed;
+	double _burst;
+	double _on;
+	double _off;
+	std::mt19937_64 _rng;
+	std::exponential_distribution<double> _gap; // Mean 1, scaled by the current rate
+	double _next; // Seconds
+
+public:
+
+	static ArrivalSchedule Constant(double rate) { return ArrivalSchedule{rate, false, 0, 1, 0, 1}; }
+	static ArrivalSchedule Poisson(double rate, std::uint64_t seed = 1) { return ArrivalSchedule{rate, true, seed, 1, 0, 1}; }
+
+	static ArrivalSchedule Bursty(double rate, double burst, std::chrono::microseconds on, std::chrono::microseconds off,
+			bool poisson = true, std::uint64_t seed = 1)
+	{
+		return ArrivalSchedule{rate, poisson, seed, burst, on.count() / 1e6, off.count() / 1e6};
+	}
+
+	// Mean rate over a burst period
+	double Rate() const { return _rate * (_burst * _on + _off) / (_on + _off); }
+	bool IsPoisson() const { return _poisson; }
+
+	// Same process at a different mean rate
+	ArrivalSchedule WithRate(double rate) const { return ArrivalSchedule{_rate * rate / Rate(), _poisson, _seed, _burst, _on, _off}; }
+
+	std::chrono::nanoseconds Next()
+	{
+		double t = _next;
+		double rate = (_on > 0 && std::fmod(t, _on + _off) < _on) ? _rate * _burst : _rate;
+		_next += _poisson ? _gap(_rng) / rate : 1.0 / rate;
+		return std::chrono::nanoseconds{static_cast<std::int64_t>(t * 1e9)};
+	}
+
+private:
+
+	ArrivalSchedule(double rate, bool poisson, std::uint64_t seed, double burst, double on, double off)
+			: _rate{rate}, _poisson{poisson}, _seed{seed}, _burst{burst}, _on{on}, _off{off}, _rng{seed}, _gap{1.0}, _next{0}
+	{
+		assert(rate > 0 && burst > 0 && on >= 0 && off > 0);
+	}
+
+};
+
+/*
+ * Timestamps of the instances of an open-loop run, indexed by instance id.
+ * Each slot is written once, by the streamer (intended and actual) or by
+ * the drainer (completed), before the results are read
+ */
+class LoadRecorder {
+
+public:
+
+	using Clock = std::chrono::steady_clock;
+
+private:
+
+	std::vector<Clock::time_point> _intended;
+	std::vector<Clock::time_point> _actual;
+	std::vector<Clock::time_point> _completed;
+	std::vector<char> _cancelled;
+	std::size_t _issued;
+
+public:
+
+	explicit LoadRecorder(std::size_t arrivals)
+			: _intended(arrivals), _actual(arrivals), _completed(arrivals), _cancelled(arrivals, 0), _issued{0} { }
+
+	std::size_t Capacity() const { return _intended.size(); }
+	std::size_t Issued() const { return _issued; }
+
+	void Issue(Clock::time_point intended, Clock::time_point actual)
+	{
+		_intended[_issued] = intended;
+		_actual[_issued] = actual;
+		++_issued;
+	}
+
+	void Complete(std::size_t instanceId)
+	{
+		if (instanceId < _completed.size())
+			_completed[instanceId] = Clock::now();
+	}
+
+	void Cancel(std::size_t instanceId)
+	{
+		if (instanceId < _cancelled.size())
+			_cancelled[instanceId] = 1;
+	}
+
+	Clock::time_point Intended(std::size_t i) const { return _intended[i]; }
+	Clock::time_point Actual(std::size_t i) const { return _actual[i]; }
+	Clock::time_point Completed(std::size_t i) const { return _completed[i]; }
+	bool Cancelled(std::size_t i) const { return _cancelled[i] != 0; }
+
+};
+
+/*
+ * Streamer adapter that releases the instances of the wrapped streamer
+ * according to an arrival schedule, up to the capacity of the recorder.
+ * Long waits sleep, the last stretch before an arrival yields. Instances
+ * are never dropped: when the interpreter falls behind, the late instances
+ * are released back to back and their lag is recorded. With a budget,
+ * the deadline of each instance is its intended arrival plus the budget
+ */
+template<typename S>
+class OpenLoopStreamer {
+
+private:
+
+	std::unique_ptr<S> _streamer;
+	ArrivalSchedule _schedule;
+	std::shared_ptr<LoadRecorder> _recorder;
+	LoadRecorder::Clock::time_point _start;
+	bool _started;
+	std::chrono::nanoseconds _budget;
+	mdf::Deadline _deadline;
+
+public:
+
+	OpenLoopStreamer(std::unique_ptr<S> streamer, ArrivalSchedule schedule, std::shared_ptr<LoadRecorder> recorder,
+			std::chrono::nanoseconds budget = std::chrono::nanoseconds::max())
+			: _streamer{std::move(streamer)}, _schedule{schedule}, _recorder{recorder}, _start{}, _started{false}, _budget{budget},
+			  _deadline{mdf::Deadline::max()} { }
+
+	std::vector<InputTokenContainer> Next()
+	{
+		if (_recorder->Issued() >= _recorder->Capacity())
+			return std::vector<InputTokenContainer>{};
+		if (!_started) {
+			_start = LoadRecorder::Clock::now();
+			_started = true;
+		}
+		auto intended = _start + _schedule.Next();
+		auto wait = intended - LoadRecorder::Clock::now();
+		if (wait > std::chrono::microseconds{200})
+			std::this_thread::sleep_until(intended - std::chrono::microseconds{100});
+		while (LoadRecorder::Clock::now() < intended)
+			std::this_thread::yield();
+		std::vector<InputTokenContainer> input = _streamer->Next();
+		if (!input.empty())
+			_recorder->Issue(intended, LoadRecorder::Clock::now());
+		if (_budget != std::chrono::nanoseconds::max())
+			_deadline = intended + std::chrono::duration_cast<LoadRecorder::Clock::duration>(_budget);
+		return input;
+	}
+
+	// Deadline of the instance returned by the last call to Next()
+	mdf::Deadline Deadline() const { return _deadline; }
+
+	std::unique_ptr<S> Release() { return std::move(_streamer); }
+
+};
+
+/*
+ * Drainer adapter that timestamps the completion of each instance before
+ * forwarding the result, and records the cancelled instances
+ */
+template<typename D>
+class OpenLoopDrainer {
+
+private:
+
+	std::unique_ptr<D> _drainer;
+	std::shared_ptr<LoadRecorder> _recorder;
+
+	void Forward(std::size_t instanceId, const TokenHandle& res, std::true_type) { (*_drainer)(instanceId, res); }
+	void Forward(std::size_t, const TokenHandle& res, std::false_type) { (*_drainer)(res); }
+	void ForwardCancelled(std::size_t instanceId, std::true_type) { _drainer->Cancelled(instanceId); }
+	void ForwardCancelled(std::size_t, std::false_type) { }
+
+public:
+
+	OpenLoopDrainer(std::unique_ptr<D> drainer, std::shared_ptr<LoadRecorder> recorder)
+			: _drainer{std::move(drainer)}, _recorder{recorder} { }
+
+	void operator()(std::size_t instanceId, const TokenHandle& res)
+	{
+		_recorder->Complete(instanceId);
+		Forward(instanceId, res, typename detail::IsIndexedDrainer<D>::type{});
+	}
+
+	void Cancelled(std::size_t instanceId)
+	{
+		_recorder->Cancel(instanceId);
+		ForwardCancelled(instanceId, typename detail::HasCancelled<D>::type{});
+	}
+
+};
+
+// One point of a latency versus throughput curve
+struct LoadPoint {
+	double offeredRate; // Instances per second
+	double achievedRate; // Completed instances per second, from the first arrival to the last completion
+	std::size_t instances;
+	LatencyDistribution latency; // From the intended arrival to the drain (corrected for coordinated omission), cancelled instances excluded
+	LatencyDistribution serviceLatency; // From the actual release to the drain
+	LatencyDistribution lag; // From the intended arrival to the actual release
+	ScalingReport scaling; // Size of the compute pool during the run
+	DeadlineReport deadlines; // Empty without a budget
+	double goodput; // Instances drained by their deadline per second, all the completed ones without a budget
+};
+
+/*
+ * Runs the graph on a new interpreter, feeding arrivals instances of the
+ * streamer built by makeStreamer on the given schedule. An instance
+ * completes when the last of its results is drained. With a budget the
+ * instances have a deadline and the workers pick the tasks in the given
+ * order
+ */
+template<typename S, typename D>
+LoadPoint RunOpenLoop(const Graph& g, WorkerPools pools, std::function<std::unique_ptr<S>()> makeStreamer,
+		std::function<std::unique_ptr<D>()> makeDrainer, ArrivalSchedule schedule, std::size_t arrivals,
+		std::chrono::nanoseconds budget = std::chrono::nanoseconds::max(), TaskOrder order = TaskOrder::Fifo)
+{
+	auto recorder = std::make_shared<LoadRecorder>(arrivals);
+	Mdf<OpenLoopDrainer<D>> engine{g, pools, std::unique_ptr<OpenLoopDrainer<D>>{new OpenLoopDrainer<D>{makeDrainer(), recorder}}};
+	engine.SetTaskOrder(order);
+	std::unique_ptr<OpenLoopStreamer<S>> streamer{new OpenLoopStreamer<S>{makeStreamer(), schedule, recorder, budget}};
+	streamer = engine.Start(std::move(streamer));
+
+	LatencyHistogram latency, service, lag;
+	std::size_t n = recorder->Issued();
+	std::size_t completed = 0;
+	auto first = n > 0 ? recorder->Intended(0) : LoadRecorder::Clock::time_point{};
+	auto last = first;
+	auto ns = [](LoadRecorder::Clock::duration d) { return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()); };
+	for (std::size_t i = 0; i < n; ++i) {
+		lag.Record(ns(recorder->Actual(i) - recorder->Intended(i)));
+		if (recorder->Cancelled(i))
+			continue;
+		latency.Record(ns(recorder->Completed(i) - recorder->Intended(i)));
+		service.Record(ns(recorder->Completed(i) - recorder->Actual(i)));
+		if (recorder->Completed(i) > last) last = recorder->Completed(i);
+		++completed;
+	}
+	double elapsed = std::chrono::duration<double>(last - first).count();
+	DeadlineReport deadlines = engine.Deadlines();
+	double onTime = budget != std::chrono::nanoseconds::max() ? deadlines.met : completed;
+	return LoadPoint{schedule.Rate(), elapsed > 0 ? completed / elapsed : 0, n, latency.Snapshot(), service.Snapshot(), lag.Snapshot(),
+			engine.Scaling(), deadlines, elapsed > 0 ? onTime / elapsed : 0};
+}
+
+template<typename S, typename D>
+LoadPoint RunOpenLoop(const Graph& g, std::size_t tn, std::function<std::unique_ptr<S>()> makeStreamer,
+		std::function<std::unique_ptr<D>()> makeDrainer, ArrivalSchedule schedule, std::size_t arrivals,
+		std::chrono::nanoseconds budget = std::chrono::nanoseconds::max(), TaskOrder order = TaskOrder::Fifo)
+{
+	return RunOpenLoop<S,D>(g, WorkerPools{tn}, makeStreamer, makeDrainer, schedule, arrivals, budget, order);
+}
+
+// Runs the graph at each offered rate, with the arrival process of schedule
+template<typename S, typename D>
+std::vector<LoadPoint> SweepLoad(const Graph& g, std::size_t tn, std::function<std::unique_ptr<S>()> makeStreamer,
+		std::function<std::unique_ptr<D>()> makeDrainer, ArrivalSchedule schedule, const std::vector<double>& rates,
+		std::size_t arrivals)
+{
+	std::vector<LoadPoint> curve;
+	for (double rate : rates)
+		curve.push_back(RunOpenLoop<S,D>(g, tn, makeStreamer, makeDrainer, schedule.WithRate(rate), arrivals));
+	return curve;
+}
+
+// Writes a latency versus throughput curve as CSV, latencies in microseconds
+inline void WriteLoadCurve(std::ostream& os, const std::vector<LoadPoint>& curve)
+{
+	auto us = [](std::chrono::nanoseconds d) { return d.count() / 1000.0; };
+	os << "offered_rate,achieved_rate,instances,p50_us,p99_us,p999_us,max_us,service_p50_us,service_p99_us,lag_p99_us\n";
+	for (auto& p : curve) {
+		os << p.offeredRate << "," << p.achievedRate << "," << p.instances << ","
+		   << us(p.latency.Percentile(0.5)) << "," << us(p.latency.Percentile(0.99)) << ","
+		   << us(p.latency.Percentile(0.999)) << "," << us(p.latency.Max()) << ","
+		   << us(p.serviceLatency.Percentile(0.5)) << "," << us(p.serviceLatency.Percentile(0.99)) << ","
+		   << us(p.lag.Percentile(0.99)) << "\n";
+	}
+}
+
+} // mdf namespace
+
+#endif
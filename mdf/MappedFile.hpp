@@ -0,0 +1,322 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+#ifndef MDF_MAPPED_FILE_HPP
+#define MDF_MAPPED_FILE_HPP
+
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <cassert>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Mdf.hpp"
+
+namespace mdf {
+
+/*
+ * Memory mapped file, either read-only or read-write. Mappings larger than
+ * a huge page are placed at a huge page aligned address, so that the kernel
+ * can back them with huge pages where the filesystem supports it
+ */
+class MappedFile {
+
+private:
+
+	static constexpr std::size_t HugePageSize = std::size_t{2} << 20;
+
+	char *_data;
+	std::size_t _size;
+	bool _writable;
+
+public:
+
+	// Maps an existing file for reading
+	explicit MappedFile(const std::string& path) : _data{nullptr}, _size{0}, _writable{false}
+	{
+		int fd = Open(path, O_RDONLY);
+		struct stat st;
+		if (fstat(fd, &st) != 0) {
+			int err = errno;
+			close(fd);
+			throw std::system_error(err, std::generic_category(), "mdf::MappedFile: cannot stat " + path);
+		}
+		_size = static_cast<std::size_t>(st.st_size);
+		Map(fd, path);
+		close(fd);
+
+		if (_data) {
+			madvise(_data, _size, MADV_SEQUENTIAL);
+		}
+	}
+
+	// Creates (or truncates) a file of the given size and maps it for writing
+	MappedFile(const std::string& path, std::size_t size) : _data{nullptr}, _size{size}, _writable{true}
+	{
+		int fd = Open(path, O_RDWR | O_CREAT | O_TRUNC);
+		if (ftruncate(fd, static_cast<off_t>(_size)) != 0) {
+			int err = errno;
+			close(fd);
+			throw std::system_error(err, std::generic_category(), "mdf::MappedFile: cannot resize " + path);
+		}
+		Map(fd, path);
+		close(fd);
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile()
+	{
+		if (_data) munmap(_data, _size);
+	}
+
+	const char *Data() const { return _data; }
+	char *MutableData() { assert(_writable); return _data; }
+	std::size_t Size() const { return _size; }
+
+	// Flushes the written pages to the file
+	void Sync()
+	{
+		if (_data && _writable && msync(_data, _size, MS_SYNC) != 0)
+			throw std::system_error(errno, std::generic_category(), "mdf::MappedFile: msync failed");
+	}
+
+private:
+
+	static int Open(const std::string& path, int flags)
+	{
+		int fd = open(path.c_str(), flags | O_CLOEXEC, 0644);
+		if (fd < 0)
+			throw std::system_error(errno, std::generic_category(), "mdf::MappedFile: cannot open " + path);
+		return fd;
+	}
+
+	void Map(int fd, const std::string& path)
+	{
+		if (_size == 0)
+			return; // Nothing to map, Data() is null
+
+		int prot = _writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+		void *addr = MAP_FAILED;
+
+		if (_size >= HugePageSize) {
+			// Reserve enough address space to align the start of the mapping
+			std::size_t span = _size + HugePageSize;
+			void *reserved = mmap(nullptr, span, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (reserved != MAP_FAILED) {
+				std::uintptr_t base = reinterpret_cast<std::uintptr_t>(reserved);
+				std::uintptr_t aligned = (base + HugePageSize - 1) & ~(HugePageSize - 1);
+				addr = mmap(reinterpret_cast<void*>(aligned), _size, prot, MAP_SHARED | MAP_FIXED, fd, 0);
+				if (addr == MAP_FAILED) {
+					munmap(reserved, span);
+				} else {
+					std::size_t tail = (base + span) - (aligned + _size);
+					if (aligned > base) munmap(reserved, aligned - base);
+					if (tail > 0) munmap(reinterpret_cast<void*>(aligned + _size), tail);
+				}
+			}
+		}
+
+		if (addr == MAP_FAILED)
+			addr = mmap(nullptr, _size, prot, MAP_SHARED, fd, 0);
+		if (addr == MAP_FAILED)
+			throw std::system_error(errno, std::generic_category(), "mdf::MappedFile: cannot map " + path);
+
+		_data = static_cast<char*>(addr);
+#ifdef MADV_HUGEPAGE
+		if (_size >= HugePageSize)
+			madvise(_data, _size, MADV_HUGEPAGE); // Only a hint, unsupported filesystems ignore it
+#endif
+	}
+
+};
+
+// Bytes of a record, valid as long as the token that carries it is alive
+struct RecordView {
+	const char *data;
+	std::size_t size;
+
+	std::size_t Size() const { return size; }
+};
+
+/*
+ * Token carrying a view into a mapped file, it keeps the mapping alive so
+ * that the record is never copied. Instructions declare a
+ * ParamDecl<RecordView> parameter to receive it
+ */
+class RecordToken : public Value<RecordView> {
+
+private:
+
+	std::shared_ptr<const MappedFile> _file;
+
+public:
+
+	RecordToken(RecordView view, std::shared_ptr<const MappedFile> file)
+			: Value<RecordView>{view}, _file{std::move(file)} { }
+
+};
+
+/*
+ * Layout of the records of a file: either records of a fixed number of
+ * bytes, or records preceded by their length as a 32-bit unsigned integer
+ * in native byte order
+ */
+struct RecordFormat {
+	std::size_t recordSize; // 0 for length-prefixed records
+
+	static RecordFormat Fixed(std::size_t size)
+	{
+		if (size == 0)
+			throw std::invalid_argument("mdf::RecordFormat: fixed records cannot be empty");
+		return RecordFormat{size};
+	}
+
+	static RecordFormat LengthPrefixed() { return RecordFormat{0}; }
+};
+
+/*
+ * Batch streamer that hands every record of a mapped file to a port of the
+ * graph as a RecordToken, chunk records at a time. Records are streamed in
+ * file order, so with a single streamer the instance ids match the record
+ * indices. A file of fixed records whose size is not a multiple of the
+ * record size is rejected by the constructor, a truncated length-prefixed
+ * record is reported with std::runtime_error when it is read
+ */
+class MappedRecordStreamer {
+
+private:
+
+	std::shared_ptr<const MappedFile> _file;
+	const RecordFormat _format;
+	const PortHandle _port;
+	const std::size_t _chunk;
+	std::size_t _offset;
+
+public:
+
+	MappedRecordStreamer(std::shared_ptr<const MappedFile> file, RecordFormat format, PortHandle port, std::size_t chunk = 16)
+			: _file{std::move(file)}, _format(format), _port(port), _chunk{chunk > 0 ? chunk : 1}, _offset{0}
+	{
+		assert(_file);
+		if (_format.recordSize > 0 && _file->Size() % _format.recordSize != 0)
+			throw std::runtime_error("mdf::MappedRecordStreamer: file size is not a multiple of the record size");
+	}
+
+	MappedRecordStreamer(const std::string& path, RecordFormat format, PortHandle port, std::size_t chunk = 16)
+			: MappedRecordStreamer{std::make_shared<MappedFile>(path), format, port, chunk} { }
+
+	std::size_t NextBatch(InstanceBatch& batch)
+	{
+		batch.Reserve(_chunk, _chunk);
+		RecordView view;
+		while (batch.Size() < _chunk && NextRecord(view)) {
+			batch.Add(_port, std::make_shared<RecordToken>(view, _file));
+			batch.EndInstance();
+		}
+		return batch.Size();
+	}
+
+	// Number of records in the file, scanning the length prefixes if needed
+	std::size_t CountRecords() const
+	{
+		if (_format.recordSize > 0)
+			return _file->Size() / _format.recordSize;
+		std::size_t n = 0;
+		for (std::size_t offset = 0; offset < _file->Size(); ++n)
+			offset += sizeof(std::uint32_t) + PrefixAt(offset);
+		return n;
+	}
+
+private:
+
+	std::uint32_t PrefixAt(std::size_t offset) const
+	{
+		if (_file->Size() - offset < sizeof(std::uint32_t))
+			throw std::runtime_error("mdf::MappedRecordStreamer: truncated record length");
+		std::uint32_t len;
+		std::memcpy(&len, _file->Data() + offset, sizeof(len));
+		return len;
+	}
+
+	bool NextRecord(RecordView& view)
+	{
+		std::size_t left = _file->Size() - _offset;
+		if (left == 0)
+			return false;
+
+		std::size_t header = 0;
+		std::size_t size = _format.recordSize;
+		if (size == 0) {
+			header = sizeof(std::uint32_t);
+			size = PrefixAt(_offset);
+		}
+		if (left - header < size)
+			throw std::runtime_error("mdf::MappedRecordStreamer: truncated record at offset " + std::to_string(_offset));
+
+		view = RecordView{_file->Data() + _offset + header, size};
+		_offset += header + size;
+		return true;
+	}
+
+};
+
+/*
+ * Drainer that stores the result of instance i at offset i*sizeof(T) of an
+ * output file sized for numRecords results, so results can be written in
+ * any completion order. T must be trivially copyable. Results of instances
+ * past the end of the output are dropped and counted, see Overflows()
+ */
+template<typename T>
+class MappedResultDrainer {
+
+	static_assert(std::is_trivially_copyable<T>::value, "mdf::MappedResultDrainer: results must be trivially copyable");
+
+private:
+
+	MappedFile _file;
+	const std::size_t _numRecords;
+	std::size_t _overflows;
+
+public:
+
+	MappedResultDrainer(const std::string& path, std::size_t numRecords)
+			: _file{path, numRecords * sizeof(T)}, _numRecords{numRecords}, _overflows{0} { }
+
+	// Called by the workers, must not throw
+	void operator()(std::size_t instanceId, const TokenHandle& token)
+	{
+		if (instanceId >= _numRecords) {
+			++_overflows;
+			return;
+		}
+		T res = std::static_pointer_cast<Value<T>>(token)->GetValue();
+		std::memcpy(_file.MutableData() + instanceId * sizeof(T), &res, sizeof(T));
+	}
+
+	void Sync() { _file.Sync(); }
+
+	// Results dropped because their instance was past the end of the output
+	std::size_t Overflows() const { return _overflows; }
+
+};
+
+} // mdf namespace
+
+#endif
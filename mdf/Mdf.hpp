@@ -17,15 +17,55 @@
 #include <mutex>
 #include <thread>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <stdexcept>
+#include <exception>
+#include <algorithm>
+#include <cstdint>
+#include <cassert>
 
 #include "Graph.hpp"
 #include "Token.hpp"
 #include "ConcurrentQueue.hpp"
 #include "ConcurrentMap.hpp"
 #include "Printer.hpp"
+#include "Statistics.hpp"
+#include "Trace.hpp"
+#include "Latency.hpp"
+#include "PerfCounters.hpp"
 
 namespace mdf {
 
+/*
+ * Instants by which the instances should be drained. Streamers may define
+ * 'Deadline Deadline()', called after each instance returned by Next(),
+ * and batch streamers may pass a deadline to InstanceBatch::EndInstance().
+ * An instance still running when its deadline expires is cancelled before
+ * its next task runs, and drainers may define
+ * 'void Cancelled(std::size_t instanceId)' to be notified
+ */
+using Deadline = std::chrono::steady_clock::time_point;
+
+// Order in which the workers pick the ready tasks
+enum class TaskOrder {
+	Fifo, // Local queue, then the global queue and stealing
+	EarliestDeadlineFirst // The tasks of instances with a deadline first, earliest deadline first
+};
+
+// Instances with a deadline, see Mdf::Deadlines()
+struct DeadlineReport {
+	std::uint64_t instances;
+	std::uint64_t met; // Drained by their deadline
+	std::uint64_t missed; // Drained after their deadline
+	std::uint64_t cancelled; // Cancelled when their deadline expired
+};
+
+inline void PrintDeadlines(const DeadlineReport& r)
+{
+	out.Println("Deadlines: ", r.instances, " instances, ", r.met, " met, ", r.missed, " missed, ", r.cancelled, " cancelled");
+}
+
 struct InputTokenContainer {
 
 	ParameterAddress destination;
@@ -36,11 +76,228 @@ struct InputTokenContainer {
 
 };
 
+/*
+ * Reusable buffer filled by batch streamers. Batch streamers define a
+ * 'std::size_t NextBatch(InstanceBatch& batch)' method that appends any
+ * number of instances to the (cleared) batch and returns how many were
+ * added, 0 meaning the end of the stream. The tokens are addressed with
+ * port handles resolved in advance with Graph::Port().
+ * Streamers that need the ids of their instances (the ones passed to
+ * indexed drainers) may define
+ * 'void Admitted(std::size_t firstInstanceId, std::size_t count)', called
+ * on the ingestion thread after each non-empty Next() or NextBatch(),
+ * before any of the instances runs. Their ids are consecutive
+ */
+class InstanceBatch {
+
+	std::vector<std::pair<PortHandle,TokenHandle>> _tokens;
+	std::vector<std::size_t> _ends; // Offset past the last token of each instance
+	std::vector<Deadline> _deadlines;
+
+public:
+
+	InstanceBatch() : _tokens{}, _ends{}, _deadlines{} { }
+
+	void Clear()
+	{
+		_tokens.clear();
+		_ends.clear();
+		_deadlines.clear();
+	}
+
+	void Reserve(std::size_t instances, std::size_t tokens)
+	{
+		_ends.reserve(instances);
+		_deadlines.reserve(instances);
+		_tokens.reserve(tokens);
+	}
+
+	// Adds a token to the instance being filled
+	void Add(PortHandle port, TokenHandle token)
+	{
+		_tokens.emplace_back(port, std::move(token));
+	}
+
+	// Terminates the instance being filled, by default it has no deadline
+	void EndInstance(Deadline deadline = Deadline::max())
+	{
+		_ends.push_back(_tokens.size());
+		_deadlines.push_back(deadline);
+	}
+
+	std::size_t Size() const { return _ends.size(); }
+
+	std::size_t Begin(std::size_t i) const { return i > 0 ? _ends[i-1] : 0; }
+	std::size_t End(std::size_t i) const { return _ends[i]; }
+	const std::pair<PortHandle,TokenHandle>& Token(std::size_t k) const { return _tokens[k]; }
+	Deadline DeadlineOf(std::size_t i) const { return _deadlines[i]; }
+
+};
+
+namespace detail {
+
+template<typename S> struct IsBatchStreamer
+{
+	template<typename U> static std::true_type Test(decltype(std::declval<U&>().NextBatch(std::declval<InstanceBatch&>()))*);
+	template<typename U> static std::false_type Test(...);
+
+	using type = decltype(Test<S>(nullptr));
+};
+
+// Drainers may define 'void operator()(std::size_t instanceId, TokenHandle result)' to receive the instance id
+template<typename D> struct IsIndexedDrainer
+{
+	template<typename U> static std::true_type Test(decltype(std::declval<U&>()(std::size_t{}, std::declval<TokenHandle>()))*);
+	template<typename U> static std::false_type Test(...);
+
+	using type = decltype(Test<D>(nullptr));
+};
+
+template<typename S> struct HasDeadline
+{
+	template<typename U> static std::true_type Test(decltype(std::declval<U&>().Deadline())*);
+	template<typename U> static std::false_type Test(...);
+
+	using type = decltype(Test<S>(nullptr));
+};
+
+template<typename S> struct HasAdmitted
+{
+	template<typename U> static std::true_type Test(decltype(std::declval<U&>().Admitted(std::size_t{}, std::size_t{}))*);
+	template<typename U> static std::false_type Test(...);
+
+	using type = decltype(Test<S>(nullptr));
+};
+
+template<typename D> struct HasCancelled
+{
+	template<typename U> static std::true_type Test(decltype(std::declval<U&>().Cancelled(std::size_t{}))*);
+	template<typename U> static std::false_type Test(...);
+
+	using type = decltype(Test<D>(nullptr));
+};
+
+/*
+ * An engine whose tasks are run by the workers of a Runtime instead of its
+ * own threads (see Runtime.hpp). Worker indices are shared by the engines
+ */
+class HostedEngine {
+public:
+	virtual ~HostedEngine() { }
+
+	virtual void Open() = 0; // Before the stream is read
+	virtual void Attach(std::size_t worker) = 0; // On the thread of a worker, before it runs any task
+	virtual void SetIdle(bool idle) = 0; // A worker found no task in any engine, or found one again
+	virtual bool TryRunOne(std::size_t worker) = 0; // Runs one ready task, false if there is none
+	virtual void Detach(std::size_t worker) = 0; // On the thread of a worker, after its last task
+	virtual bool Finished() const = 0; // The stream has ended and every instance has been drained
+	virtual void Close() = 0; // After the workers have stopped, rethrows the exception of the streamer if any
+};
+
+} // detail namespace
+
+class Runtime;
+
+/*
+ * Elastic compute pool: the interpreter starts all the workers but only
+ * lets min of them run. Every period a controller thread looks at the
+ * ready tasks queued in the compute pool, the idle workers and the
+ * instances in flight: after growAfter consecutive periods with no idle
+ * worker and either more queued tasks than running workers or a growing
+ * number of instances in flight, one more worker is unparked; after
+ * shrinkAfter consecutive periods with idle workers and no queued task,
+ * the worker with the highest index is parked. Parked workers wait on a
+ * condition variable and do not consume CPU time
+ */
+struct ElasticPolicy {
+	std::size_t min;
+	std::chrono::microseconds period;
+	unsigned growAfter;
+	unsigned shrinkAfter;
+};
+
+// Size of the compute pool over a run, see Mdf::Scaling()
+struct ScalingReport {
+	std::vector<std::pair<double,std::size_t>> timeline; // Seconds from the start and running compute workers, at each change
+	double workerSeconds; // Running compute workers integrated over the run
+	std::size_t peak;
+};
+
+/*
+ * Number of workers of each execution class. Each pool has its own queue,
+ * workers steal only from the workers of the same pool, and a task whose
+ * node belongs to another class is handed over to the queue of that pool.
+ * Auto gives one worker to each class other than compute that the graph
+ * uses, the nodes of a class without workers run on the compute pool
+ */
+struct WorkerPools {
+
+	static const std::size_t Auto = std::size_t(-1);
+
+	std::size_t compute; // Maximum number of compute workers when elastic
+	std::size_t blocking;
+	std::size_t latencyCritical;
+	ElasticPolicy elastic; // Fixed size when elastic.min == compute
+
+	explicit WorkerPools(std::size_t c, std::size_t b = Auto, std::size_t l = Auto)
+			: compute{c}, blocking{b}, latencyCritical{l}, elastic{c, std::chrono::microseconds{1000}, 2, 100} { }
+
+	// Between min and max compute workers
+	static WorkerPools Elastic(std::size_t min, std::size_t max, std::size_t b = Auto, std::size_t l = Auto)
+	{
+		WorkerPools p{max, b, l};
+		p.elastic.min = min > 0 ? std::min(min, max) : 1;
+		return p;
+	}
+
+	bool IsElastic() const { return elastic.min < compute; }
+
+	std::size_t Size(ExecutionClass c) const
+	{
+		switch (c) {
+		case ExecutionClass::Blocking: return blocking;
+		case ExecutionClass::LatencyCritical: return latencyCritical;
+		default: return compute;
+		}
+	}
+
+	std::size_t Total() const { return compute + blocking + latencyCritical; }
+
+	// Replaces Auto with the number of workers needed by the graph
+	WorkerPools Resolve(const Graph& g) const
+	{
+		bool used[NumExecutionClasses] = {true, false, false};
+		for (NodeId id = 0; id < g.N(); ++id)
+			used[static_cast<unsigned>(g.GetExecutionClass(id))] = true;
+		WorkerPools p{compute, blocking == Auto ? std::size_t(used[1]) : blocking,
+				latencyCritical == Auto ? std::size_t(used[2]) : latencyCritical};
+		p.elastic = elastic;
+		return p;
+	}
+
+};
+
 template<typename D>
-class Mdf {
+class Mdf : private detail::HostedEngine {
+
+	friend class Runtime;
 
 private:
 
+	// Per-worker partial results of a reduce instruction
+	struct ReduceState {
+
+		struct Partial {
+			std::mutex mtx;
+			TokenHandle value;
+		};
+
+		std::unique_ptr<Partial[]> partials;
+		std::atomic<long> remaining; // Operands and dependencies still missing
+
+		ReduceState(std::size_t slots, long n) : partials{new Partial[slots]}, remaining{n} { }
+	};
+
 	class InstructionState {
 	
 	private:
@@ -51,7 +308,9 @@ private:
 
 		bool fired;
 		unsigned resolvedDependencies;
-		std::unordered_map<std::string,TokenHandle> tokens;
+		unsigned receivedTokens;
+		std::vector<TokenHandle> tokens; // Indexed by parameter position
+		std::unique_ptr<ReduceState> reduce;
 
 		void lock() { _mtx.lock(); }
 		void unlock() { _mtx.unlock(); }
@@ -62,26 +321,116 @@ private:
 		const std::size_t instanceId;
 		std::shared_ptr<Graph> graph;
 		mdf::ConcurrentMap<NodeId,std::shared_ptr<InstructionState>> states;
+		detail::LatencyRecorder::Marks marks;
+		const Deadline deadline;
+		std::atomic<bool> settled; // Set once by the thread that drains or cancels the instance
+
+		GraphHandle(std::size_t iid, std::shared_ptr<Graph> g, detail::LatencyRecorder::Stamp read, Deadline d)
+				: instanceId{iid}, graph{g}, states{}, marks{read}, deadline{d}, settled{false} { }
+	};
+
+	using HandleBatch = std::vector<std::shared_ptr<GraphHandle>>;
 
-		GraphHandle(std::size_t iid, std::shared_ptr<Graph> g) : instanceId{iid}, graph{g}, states{} { } 
+	// Chunks of a map instruction that are still running
+	struct MapState {
+		std::mutex mtx;
+		std::vector<std::pair<std::size_t,TokenHandle>> parts;
+		std::atomic<unsigned> pending;
+
+		MapState() : mtx{}, parts{}, pending{1} { }
+	};
+
+	// Input of new instances read by an ingestion thread, either the tokens of one instance or a batch
+	struct Ingestion {
+		std::size_t instanceId;
+		std::vector<InputTokenContainer> tokens;
+		InstanceBatch batch;
+		detail::LatencyRecorder::Stamp read;
+		Deadline deadline;
 	};
 
+	/*
+	 * A task is either a single fireable instruction of the instance gh,
+	 * a batch of instances in which the batch instruction id is fireable,
+	 * a chunk of the range of the map instruction id, the creation of a
+	 * new instance from the tokens read by an ingestion thread, or the
+	 * result of the asynchronous instruction id to be propagated
+	 */
 	struct TaskData {
 		std::shared_ptr<GraphHandle> gh;
 		NodeId id;
+		std::shared_ptr<HandleBatch> batch;
+		std::shared_ptr<MapState> map;
+		IndexRange chunk;
+		std::shared_ptr<Ingestion> input;
+		detail::Tracer::Stamp enqueued; // Empty unless MDF_ENABLE_TRACE is defined
+		TokenHandle result;
 	};
 
 	using TaskQueue = mdf::ConcurrentQueue<TaskData>;
 
+	/*
+	 * The worker running a task and its pool, Start() uses the index _tn
+	 * and the global queue of the compute pool. When scheduled is set new
+	 * tasks are collected there and queued all at once by the caller
+	 */
+	struct Context {
+		std::size_t index;
+		TaskQueue& tasks;
+		std::vector<TaskData> *scheduled;
+		ExecutionClass pool;
+
+		void Push(TaskData t)
+		{
+			t.enqueued = detail::Tracer::Now();
+			if (scheduled)
+				scheduled->push_back(std::move(t));
+			else
+				tasks.Put(t);
+		}
+	};
+
+	struct LaterDeadline {
+		bool operator()(const TaskData& a, const TaskData& b) const { return a.gh->deadline < b.gh->deadline; }
+	};
+
+	using DeadlineQueue = mdf::ConcurrentPriorityQueue<TaskData,LaterDeadline>;
+
+	// Instances waiting for a batch instruction to fill up
+	struct BatchBuffer {
+		std::mutex mtx;
+		HandleBatch handles;
+	};
+
 	std::unique_ptr<Graph> _model;
+	const WorkerPools _pools;
 
-	std::size_t _tn; // Number of active threads
-	TaskQueue _tasks;
+	std::size_t _tn; // Number of active threads, the workers of each pool have consecutive indices
+	TaskQueue _tasks; // Global queue of the compute pool, also receives the new instances
 	std::vector<std::thread> _threads;
 	std::vector<std::unique_ptr<TaskQueue>> _localTasks;
+	std::vector<std::unique_ptr<TaskQueue>> _poolTasks; // Global queues of the other pools, unbounded (indexed by class)
+	std::vector<ExecutionClass> _route; // Pool that runs each node, indexed by NodeId
+	TaskQueue _resumed; // Completed asynchronous instructions, unbounded so that completions never block
+	std::atomic<long> _pendingAsync; // Asynchronous operations not completed yet
+
+	TaskOrder _order;
+	std::vector<std::unique_ptr<DeadlineQueue>> _deadlineTasks; // Used by EarliestDeadlineFirst, indexed by class
+	std::atomic<std::uint64_t> _deadlineInstances;
+	std::atomic<std::uint64_t> _metDeadlines;
+	std::atomic<std::uint64_t> _missedDeadlines;
+	std::atomic<std::uint64_t> _cancelledInstances;
+
+	std::vector<std::unique_ptr<BatchBuffer>> _batches; // Indexed by NodeId, null for scalar instructions
+	std::vector<NodeId> _batchedNodes;
 
 	std::atomic<long> _numInstances; // Number of active graph instances
 	std::atomic<bool> _endOfStream;
+	std::atomic<unsigned> _idleWorkers[NumExecutionClasses]; // Idle workers of each pool, parked compute workers excluded
+	std::atomic<std::size_t> _nextInstanceId;
+	std::atomic<std::size_t> _activeSources; // Ingestion threads still reading their streamer
+	std::exception_ptr _streamError; // First exception thrown by a streamer, guarded by _streamErrorMutex
+	std::mutex _streamErrorMutex;
 
 	/*
 	 * During the execution we acquire unique ownership
@@ -91,54 +440,477 @@ private:
 	std::unique_ptr<D> _drainer;
 	std::mutex _drainerMutex;
 
+	detail::StatsCollector _stats; // Empty unless MDF_ENABLE_STATS is defined
+	detail::Tracer _tracer; // Empty unless MDF_ENABLE_TRACE is defined
+	detail::LatencyRecorder _latency; // Empty unless MDF_ENABLE_LATENCY is defined
+	detail::PerfCollector _perf; // Empty unless MDF_ENABLE_PERF is defined
+
+	// Compute workers with an index past _runningCompute are parked (see ElasticPolicy)
+	std::atomic<std::size_t> _runningCompute;
+	std::mutex _parkMutex;
+	std::condition_variable _unpark;
+	std::thread _controller;
+	ScalingReport _scaling;
+	std::chrono::steady_clock::time_point _scalingStart;
+	std::chrono::steady_clock::time_point _lastScaling;
+
 public:
 
+	Mdf(std::unique_ptr<Graph> model, WorkerPools pools, std::unique_ptr<D> drainer);
 	Mdf(std::unique_ptr<Graph> model, std::size_t tn, std::unique_ptr<D> drainer);
+	Mdf(const Graph& model, WorkerPools pools, std::unique_ptr<D> drainer);
 	Mdf(const Graph& model, std::size_t tn, std::unique_ptr<D> drainer);
 	Mdf(const Mdf& other) = delete;
 	Mdf& operator=(const Mdf& other) = delete;
 
+	/*
+	 * Reads the stream and runs every instance. If the streamer throws, the
+	 * instances already read are drained and the exception is rethrown
+	 */
 	template<typename S>
 		std::unique_ptr<S> Start(std::unique_ptr<S> streamer);
 
+	/*
+	 * Reads the streamers concurrently, each from its own ingestion thread.
+	 * Ingestion threads only call Next(), the instances are created by the
+	 * workers. The stream ends when every streamer is exhausted or has
+	 * thrown, the first exception is rethrown after the workers are joined
+	 */
+	template<typename S>
+		std::vector<std::unique_ptr<S>> Start(std::vector<std::unique_ptr<S>> streamers);
+
+	// Snapshot of the runtime statistics, can be taken while Start() runs (see Statistics.hpp)
+	EngineStatistics Statistics() const;
+
+	/*
+	 * Writes the events recorded by the workers as a Chrome trace (see
+	 * Trace.hpp), to be called after Start() returns. Without
+	 * MDF_ENABLE_TRACE the trace is empty
+	 */
+	void WriteTrace(std::ostream& os) const { WriteChromeTrace(os, _tracer.Events(), *_model, _tn); }
+
+	// Percentiles of the end-to-end latency of the instances (see Latency.hpp)
+	LatencyReport Latency() const { return _latency.Report(); }
+
+	// Hardware counters of each node, see PerfCounters.hpp
+	PerfReport HardwareCounters() const { return _perf.Report(); }
+
+	// Number of workers of each execution class, with Auto resolved
+	const WorkerPools& Pools() const { return _pools; }
+
+	// Compute workers that are not parked
+	std::size_t RunningComputeWorkers() const { return _runningCompute; }
+
+	// Changes of the size of the compute pool during the last run, to be called after Start() returns
+	const ScalingReport& Scaling() const { return _scaling; }
+
+	// Must be called before Start, the default is TaskOrder::Fifo
+	void SetTaskOrder(TaskOrder order) { _order = order; }
+
+	// Outcome of the instances with a deadline
+	DeadlineReport Deadlines() const
+	{
+		return DeadlineReport{_deadlineInstances.load(), _metDeadlines.load(), _missedDeadlines.load(), _cancelledInstances.load()};
+	}
+
+	// The drainer, its results are complete once Start returns
+	const D& GetDrainer() const { return *_drainer; }
+
+	// Binds a constant parameter of the model, see Graph::BindConstant (must be called before Start, which validates the graph again)
+	template<typename T>
+		void BindConstant(NodeId id, std::string pname, T val) { _model->BindConstant(id, pname, val); }
+
 private:
 
+	void Reset();
+	void StartWorkers();
+	void JoinWorkers();
+	void RethrowStreamError();
+	void Open();
+	void Attach(std::size_t worker) { _perf.Open(worker); }
+	void SetIdle(bool idle) { idle ? ++IdleWorkers(ExecutionClass::Compute) : --IdleWorkers(ExecutionClass::Compute); }
+	bool TryRunOne(std::size_t worker);
+	void Detach(std::size_t worker) { _perf.Close(worker); }
+	bool Finished() const { return _endOfStream && _numInstances == 0 && _pendingAsync == 0; }
+	void Close();
+	template<typename S>
+		void Ingestor(S& streamer);
+	template<typename S>
+		bool Read(S& streamer, Context& ctx, std::false_type);
+	template<typename S>
+		bool Read(S& streamer, Context& ctx, std::true_type);
+	template<typename S>
+		bool Read(S& streamer, std::false_type);
+	template<typename S>
+		bool Read(S& streamer, std::true_type);
+	void InstantiateBatch(const InstanceBatch& batch, std::size_t firstId, detail::LatencyRecorder::Stamp read, Context& ctx);
+
 	void Worker(std::size_t index);
+	void Run(TaskData& t, detail::TaskSource source, Context& ctx);
+	void Park(std::size_t index);
+	void Scale();
+	void Resize(std::size_t running);
 	bool Steal(TaskData& t, std::size_t shuffle);
-	void ScheduleIfFireable(std::shared_ptr<GraphHandle> gh, NodeId id, TaskQueue& queue);
+	bool NextTask(TaskData& t, std::size_t index, detail::TaskSource& source);
+	bool FlushBatch(TaskData& t, std::size_t shuffle);
+	void ScheduleIfFireable(std::shared_ptr<GraphHandle> gh, NodeId id, Context& ctx);
+	void Dispatch(NodeId id, TaskData t, Context& ctx);
+	ExecutionClass PoolOf(std::size_t index) const;
+	std::atomic<unsigned>& IdleWorkers(ExecutionClass c) { return _idleWorkers[static_cast<unsigned>(c)]; }
+	std::size_t PoolBegin(ExecutionClass c) const;
+	TaskQueue& PoolTasks(ExecutionClass c) { return c == ExecutionClass::Compute ? _tasks : *_poolTasks[static_cast<unsigned>(c)]; }
+	void Execute(TaskData& t, Context& ctx);
+	void ExecuteBatch(TaskData& t, Context& ctx);
+	void ExecuteChunk(TaskData& t, Context& ctx);
+	void Resume(std::shared_ptr<GraphHandle> gh, NodeId id, TokenHandle res);
+	void Instantiate(TaskData& t, Context& ctx);
+	void Propagate(const std::shared_ptr<GraphHandle>& gh, const std::shared_ptr<Node>& node, TokenHandle res, Context& ctx);
+	void Drain(std::size_t instanceId, TokenHandle res, std::true_type) { (*_drainer)(instanceId, res); }
+	void Drain(std::size_t, TokenHandle res, std::false_type) { (*_drainer)(res); }
+	void NotifyCancelled(std::size_t instanceId, std::true_type) { _drainer->Cancelled(instanceId); }
+	void NotifyCancelled(std::size_t, std::false_type) { }
+	template<typename S>
+		void NotifyAdmitted(S& streamer, std::size_t firstId, std::size_t n, std::true_type) { streamer.Admitted(firstId, n); }
+	template<typename S>
+		void NotifyAdmitted(S&, std::size_t, std::size_t, std::false_type) { }
+	template<typename S>
+		Deadline ReadDeadline(S& streamer, std::true_type) { return streamer.Deadline(); }
+	template<typename S>
+		Deadline ReadDeadline(S&, std::false_type) { return Deadline::max(); }
+	std::shared_ptr<GraphHandle> NewInstance(std::size_t instanceId, detail::LatencyRecorder::Stamp read, Deadline deadline);
+	bool Expired(const std::shared_ptr<GraphHandle>& gh);
+	void Cancel(const std::shared_ptr<GraphHandle>& gh);
+	void Deliver(const std::shared_ptr<GraphHandle>& gh, const ParameterAddress& destination, TokenHandle token, Context& ctx);
+	void Deliver(const std::shared_ptr<GraphHandle>& gh, PortHandle port, TokenHandle token, Context& ctx);
+	std::shared_ptr<InstructionState> GetState(const std::shared_ptr<GraphHandle>& gh, NodeId id);
+	void Fold(const std::shared_ptr<GraphHandle>& gh, NodeId id, TokenHandle token, Context& ctx);
+	void Arrive(const std::shared_ptr<GraphHandle>& gh, NodeId id, Context& ctx);
 	
 };
 
 template<typename D>
-inline Mdf<D>::Mdf(std::unique_ptr<Graph> model, std::size_t tn, std::unique_ptr<D> drainer)
+inline Mdf<D>::Mdf(std::unique_ptr<Graph> model, WorkerPools pools, std::unique_ptr<D> drainer)
 		: _model{std::move(model)},
-		  _tn{tn},
+		  _pools{pools.Resolve(*_model)},
+		  _tn{_pools.Total()},
 		  _tasks{100},
 		  _threads{},
 		  _localTasks{},
+		  _poolTasks{},
+		  _route{},
+		  _resumed{},
+		  _pendingAsync{0},
+		  _order{TaskOrder::Fifo},
+		  _deadlineTasks{},
+		  _deadlineInstances{0},
+		  _metDeadlines{0},
+		  _missedDeadlines{0},
+		  _cancelledInstances{0},
+		  _batches{},
+		  _batchedNodes{},
 		  _numInstances{0},
 		  _endOfStream{true},
+		  _nextInstanceId{0},
+		  _activeSources{0},
+		  _streamError{},
+		  _streamErrorMutex{},
 		  _drainer{std::move(drainer)},
-		  _drainerMutex{}
+		  _drainerMutex{},
+		  _stats{_tn, _model->N()},
+		  _tracer{_tn},
+		  _latency{},
+		  _perf{_tn, _model->N()},
+		  _runningCompute{_pools.compute},
+		  _parkMutex{},
+		  _unpark{},
+		  _controller{},
+		  _scaling{},
+		  _scalingStart{},
+		  _lastScaling{}
 {
+	_model->Finalize();
+	if (_pools.compute == 0)
+		throw std::invalid_argument("Mdf: the compute pool needs at least one worker");
+
 	_threads.reserve(_tn);
 	_localTasks.reserve(_tn);
 
 	for (std::size_t i = 0; i < _tn; ++i) {
 		_localTasks.emplace_back(std::unique_ptr<TaskQueue>(new TaskQueue{}));
 	}
+
+	for (std::size_t c = 0; c < NumExecutionClasses; ++c) {
+		_poolTasks.emplace_back(c > 0 ? new TaskQueue{} : nullptr);
+		_deadlineTasks.emplace_back(new DeadlineQueue{});
+		_idleWorkers[c] = 0;
+	}
+
+	// Nodes of a class without workers run on the compute pool
+	_route.resize(_model->N());
+	for (NodeId id = 0; id < _model->N(); ++id) {
+		ExecutionClass c = _model->GetExecutionClass(id);
+		_route[id] = _pools.Size(c) > 0 ? c : ExecutionClass::Compute;
+	}
+
+	_batches.resize(_model->N());
+	for (NodeId id = 0; id < _model->N(); ++id) {
+		if (_model->GetNode(id)->instruction->BatchSize() > 0) {
+			_batches[id].reset(new BatchBuffer);
+			_batchedNodes.push_back(id);
+		}
+	}
+}
+
+template<typename D>
+inline Mdf<D>::Mdf(std::unique_ptr<Graph> model, std::size_t tn, std::unique_ptr<D> drainer)
+		: Mdf{std::move(model), WorkerPools{tn}, std::move(drainer)}
+{
+}
+
+template<typename D>
+inline Mdf<D>::Mdf(const Graph& model, WorkerPools pools, std::unique_ptr<D> drainer)
+		: Mdf{std::move(std::unique_ptr<Graph>{new Graph{model}}), pools, std::move(drainer)}
+{
 }
 
 template<typename D>
 inline Mdf<D>::Mdf(const Graph& model, std::size_t tn, std::unique_ptr<D> drainer)
-		: Mdf{std::move(std::unique_ptr<Graph>{new Graph{model}}), tn, std::move(drainer)}
+		: Mdf{std::move(std::unique_ptr<Graph>{new Graph{model}}), WorkerPools{tn}, std::move(drainer)}
 {
 }
 
+template<typename D>
+inline EngineStatistics Mdf<D>::Statistics() const
+{
+	EngineStatistics s = _stats.Snapshot(_tn, _numInstances.load());
+	if (s.enabled) {
+		s.globalQueueHighWater = _tasks.HighWater();
+		for (std::size_t i = 0; i < _tn; ++i)
+			s.workers[i].queueHighWater = _localTasks[i]->HighWater();
+	}
+	return s;
+}
+
 template<typename D> template<typename S>
 inline std::unique_ptr<S> Mdf<D>::Start(std::unique_ptr<S> streamer)
 {
+	StartWorkers();
+
+	Context ctx{_tn, _tasks, nullptr, ExecutionClass::Compute};
+
+	try {
+		while (!_endOfStream) {
+			if (!Read(*streamer, ctx, typename detail::IsBatchStreamer<S>::type{}))
+				_endOfStream = true;
+		}
+	} catch (...) {
+		_endOfStream = true;
+		JoinWorkers();
+		throw;
+	}
+
+	JoinWorkers();
+
+	return streamer;
+}
+
+template<typename D> template<typename S>
+inline std::vector<std::unique_ptr<S>> Mdf<D>::Start(std::vector<std::unique_ptr<S>> streamers)
+{
+	StartWorkers();
+
+	_activeSources = streamers.size();
+	if (streamers.empty())
+		_endOfStream = true;
+
+	std::vector<std::thread> ingestors;
+	ingestors.reserve(streamers.size());
+	for (auto& streamer : streamers)
+		ingestors.emplace_back(std::thread{&Mdf::Ingestor<S>, this, std::ref(*streamer)});
+
+	for (auto& t : ingestors)
+		t.join();
+
+	JoinWorkers();
+	RethrowStreamError();
+
+	return streamers;
+}
+
+// Reads one instance and creates it, returns false at the end of the stream
+template<typename D> template<typename S>
+inline bool Mdf<D>::Read(S& streamer, Context& ctx, std::false_type)
+{
+	std::vector<InputTokenContainer> inputTokens = streamer.Next();
+	if (inputTokens.size() > 0) {
+		Deadline deadline = ReadDeadline(streamer, typename detail::HasDeadline<S>::type{});
+		_stats.InFlight(++_numInstances);
+		std::size_t id = _nextInstanceId++;
+		NotifyAdmitted(streamer, id, 1, typename detail::HasAdmitted<S>::type{});
+		std::shared_ptr<GraphHandle> gh = NewInstance(id, detail::LatencyRecorder::Now(), deadline);
+		if (!Expired(gh)) {
+			for (auto& itc : inputTokens)
+				Deliver(gh, itc.destination, itc.token, ctx);
+		}
+		return true;
+	}
+	return false;
+}
+
+// Reads a batch of instances, creates them and queues their tasks at once
+template<typename D> template<typename S>
+inline bool Mdf<D>::Read(S& streamer, Context& ctx, std::true_type)
+{
+	static thread_local InstanceBatch batch;
+	static thread_local std::vector<TaskData> scheduled;
+
+	batch.Clear();
+	std::size_t n = streamer.NextBatch(batch);
+	if (n > 0) {
+		auto read = detail::LatencyRecorder::Now();
+		assert(n == batch.Size());
+		_stats.InFlight(_numInstances += n);
+		Context bulk{ctx.index, ctx.tasks, &scheduled, ctx.pool};
+		std::size_t firstId = _nextInstanceId.fetch_add(n);
+		NotifyAdmitted(streamer, firstId, n, typename detail::HasAdmitted<S>::type{});
+		InstantiateBatch(batch, firstId, read, bulk);
+		ctx.tasks.PutAll(scheduled);
+		scheduled.clear();
+		return true;
+	}
+	return false;
+}
+
+/*
+ * The instance counter is incremented before the ingestion task is queued,
+ * and the last ingestion thread to finish signals the end of the stream,
+ * so the workers cannot exit while an instance is still being created
+ */
+template<typename D> template<typename S>
+inline void Mdf<D>::Ingestor(S& streamer)
+{
+	try {
+		while (Read(streamer, typename detail::IsBatchStreamer<S>::type{}))
+			;
+	} catch (...) {
+		std::lock_guard<std::mutex> lock{_streamErrorMutex};
+		if (!_streamError)
+			_streamError = std::current_exception();
+	}
+
+	if (--_activeSources == 0)
+		_endOfStream = true;
+}
+
+template<typename D> template<typename S>
+inline bool Mdf<D>::Read(S& streamer, std::false_type)
+{
+	std::vector<InputTokenContainer> inputTokens = streamer.Next();
+	if (inputTokens.size() > 0) {
+		Deadline deadline = ReadDeadline(streamer, typename detail::HasDeadline<S>::type{});
+		std::shared_ptr<Ingestion> input{new Ingestion{_nextInstanceId++, std::move(inputTokens), InstanceBatch{}, detail::LatencyRecorder::Now(),
+				deadline}};
+		NotifyAdmitted(streamer, input->instanceId, 1, typename detail::HasAdmitted<S>::type{});
+		_stats.InFlight(++_numInstances);
+		TaskData t;
+		t.input = input;
+		t.enqueued = detail::Tracer::Now();
+		_tasks.Put(t);
+		return true;
+	}
+	return false;
+}
+
+template<typename D> template<typename S>
+inline bool Mdf<D>::Read(S& streamer, std::true_type)
+{
+	std::shared_ptr<Ingestion> input{new Ingestion{0, std::vector<InputTokenContainer>{}, InstanceBatch{}, detail::LatencyRecorder::Stamp{},
+			Deadline::max()}};
+	std::size_t n = streamer.NextBatch(input->batch);
+	if (n > 0) {
+		input->read = detail::LatencyRecorder::Now();
+		assert(n == input->batch.Size());
+		input->instanceId = _nextInstanceId.fetch_add(n);
+		NotifyAdmitted(streamer, input->instanceId, n, typename detail::HasAdmitted<S>::type{});
+		_stats.InFlight(_numInstances += n);
+		TaskData t;
+		t.input = input;
+		t.enqueued = detail::Tracer::Now();
+		_tasks.Put(t);
+		return true;
+	}
+	return false;
+}
+
+template<typename D>
+inline void Mdf<D>::InstantiateBatch(const InstanceBatch& batch, std::size_t firstId, detail::LatencyRecorder::Stamp read, Context& ctx)
+{
+	for (std::size_t i = 0; i < batch.Size(); ++i) {
+		std::shared_ptr<GraphHandle> gh = NewInstance(firstId + i, read, batch.DeadlineOf(i));
+		if (Expired(gh))
+			continue;
+		for (std::size_t k = batch.Begin(i); k < batch.End(i); ++k)
+			Deliver(gh, batch.Token(k).first, batch.Token(k).second, ctx);
+	}
+}
+
+template<typename D>
+inline std::shared_ptr<typename Mdf<D>::GraphHandle> Mdf<D>::NewInstance(std::size_t instanceId, detail::LatencyRecorder::Stamp read,
+		Deadline deadline)
+{
+	if (deadline != Deadline::max())
+		++_deadlineInstances;
+	return std::make_shared<GraphHandle>(instanceId, _model->Clone(), read, deadline);
+}
+
+/*
+ * True if the instance has been drained or cancelled, or if its deadline
+ * has expired, in which case it is cancelled. The tasks of expired
+ * instances are dropped
+ */
+template<typename D>
+inline bool Mdf<D>::Expired(const std::shared_ptr<GraphHandle>& gh)
+{
+	if (gh->settled.load(std::memory_order_relaxed))
+		return true;
+	if (gh->deadline == Deadline::max() || std::chrono::steady_clock::now() <= gh->deadline)
+		return false;
+	Cancel(gh);
+	return true;
+}
+
+template<typename D>
+inline void Mdf<D>::Cancel(const std::shared_ptr<GraphHandle>& gh)
+{
+	if (gh->settled.exchange(true))
+		return;
+	{
+		std::lock_guard<std::mutex> lock{_drainerMutex};
+		NotifyCancelled(gh->instanceId, typename detail::HasCancelled<D>::type{});
+	}
+	++_cancelledInstances;
+	int n = --_numInstances;
+	assert(n >= 0);
+}
+
+template<typename D>
+inline void Mdf<D>::Reset()
+{
+	_model->Finalize(); // Validates again after BindConstant
+
 	_endOfStream = false;
+	for (auto& idle : _idleWorkers)
+		idle = 0;
+
+	_runningCompute = _pools.elastic.min;
+	_scalingStart = _lastScaling = std::chrono::steady_clock::now();
+	_scaling = ScalingReport{{std::make_pair(0.0, _runningCompute.load())}, 0, _runningCompute};
+}
+
+template<typename D>
+inline void Mdf<D>::StartWorkers()
+{
+	Reset();
 
 	out.Println("Starting threads...");
 
@@ -146,109 +918,594 @@ inline std::unique_ptr<S> Mdf<D>::Start(std::unique_ptr<S> streamer)
 		_threads.emplace_back(std::thread{&Mdf::Worker, this, i});
 	}
 
-	std::size_t count = 0;
-
-	while (!_endOfStream) {
+	if (_pools.IsElastic())
+		_controller = std::thread{&Mdf::Scale, this};
+}
 
-		std::vector<InputTokenContainer> inputTokens = streamer->Next();
-		if (inputTokens.size() > 0) {
-			std::shared_ptr<GraphHandle> gh = std::make_shared<GraphHandle>(count++, _model->Clone());
-			++_numInstances;
-			for (auto& itc : inputTokens) {
-				auto pair = gh->states.Get(itc.destination.nodeId);
-				auto state = pair.second ? pair.first : gh->states.Insert(itc.destination.nodeId, std::make_shared<InstructionState>()).first;
-				std::lock_guard<InstructionState> lock{*state};
-				state->tokens[itc.destination.paramName] = itc.token;
-				ScheduleIfFireable(gh, itc.destination.nodeId, _tasks);
-			}
-		} else {
-			_endOfStream = true;
-		}
-	}
+template<typename D>
+inline void Mdf<D>::RethrowStreamError()
+{
+	std::exception_ptr error;
+	std::swap(error, _streamError);
+	if (error)
+		std::rethrow_exception(error);
+}
 
+template<typename D>
+inline void Mdf<D>::JoinWorkers()
+{
 	out.Println("Joining threads...");
 
-	for (std::size_t i = 0; i < _tn; ++i) {
+	for (std::size_t i = 0; i < _threads.size(); ++i) {
 		if (_threads[i].joinable()) _threads[i].join();
 	}
+	_threads.clear();
+	if (_controller.joinable())
+		_controller.join();
+	Resize(_runningCompute); // Accounts for the time since the last change
 
 	out.Println("Finished.");
 
-	return streamer;
+#ifdef MDF_ENABLE_LATENCY
+	PrintLatency(Latency());
+#endif
 }
 
 template <typename D>
-inline void Mdf<D>::ScheduleIfFireable(std::shared_ptr<GraphHandle> gh, NodeId id, TaskQueue& queue)
+inline void Mdf<D>::ScheduleIfFireable(std::shared_ptr<GraphHandle> gh, NodeId id, Context& ctx)
 {
 	auto state = gh->states.Get(id).first;
 	auto node = gh->graph->GetNode(id);
-	if (state->resolvedDependencies == node->numDependsOn && state->tokens.size() == node->instruction->Arity()
+	if (state->resolvedDependencies == node->numDependsOn && state->receivedTokens == node->NumInputs()
 			&& state->fired == false) {
 		state->fired = true;
-		queue.Put(TaskData{gh, id});
+		if (_batches[id]) {
+			BatchBuffer& buffer = *_batches[id];
+			std::lock_guard<std::mutex> lock{buffer.mtx};
+			buffer.handles.push_back(gh);
+			if (buffer.handles.size() >= node->instruction->BatchSize()) {
+				auto batch = std::make_shared<HandleBatch>(std::move(buffer.handles));
+				buffer.handles.clear();
+				Dispatch(id, TaskData{nullptr, id, batch, nullptr, IndexRange{0, 0}}, ctx);
+			}
+		} else {
+			Dispatch(id, TaskData{gh, id, nullptr, nullptr, IndexRange{0, 0}}, ctx);
+		}
 	}
 }
 
+// Queues the task of the node id on the current worker, or hands it over to the pool of its execution class
+template<typename D>
+inline void Mdf<D>::Dispatch(NodeId id, TaskData t, Context& ctx)
+{
+	ExecutionClass c = _route[id];
+	if (_order == TaskOrder::EarliestDeadlineFirst && t.gh && t.gh->deadline != Deadline::max()) {
+		t.enqueued = detail::Tracer::Now();
+		_deadlineTasks[static_cast<unsigned>(c)]->Put(t);
+	} else if (c == ctx.pool) {
+		ctx.Push(std::move(t));
+	} else {
+		t.enqueued = detail::Tracer::Now();
+		PoolTasks(c).Put(t);
+	}
+}
 
+template<typename D>
+inline std::size_t Mdf<D>::PoolBegin(ExecutionClass c) const
+{
+	std::size_t begin = 0;
+	for (unsigned k = 0; k < static_cast<unsigned>(c); ++k)
+		begin += _pools.Size(static_cast<ExecutionClass>(k));
+	return begin;
+}
+
+template<typename D>
+inline ExecutionClass Mdf<D>::PoolOf(std::size_t index) const
+{
+	for (unsigned k = 0; k < NumExecutionClasses; ++k) {
+		ExecutionClass c = static_cast<ExecutionClass>(k);
+		if (index < _pools.Size(c)) return c;
+		index -= _pools.Size(c);
+	}
+	return ExecutionClass::Compute;
+}
+
+/*
+ * Partially filled batches are only dispatched by idle workers of the pool
+ * of the batch instruction, so that batches grow as large as possible
+ * while the workers are busy
+ */
+template<typename D>
+inline bool Mdf<D>::FlushBatch(TaskData& t, std::size_t shuffle)
+{
+	ExecutionClass pool = PoolOf(shuffle);
+	for (std::size_t i = 0; i < _batchedNodes.size(); ++i) {
+		NodeId id = _batchedNodes[(shuffle+i)%_batchedNodes.size()];
+		if (_route[id] != pool)
+			continue;
+		BatchBuffer& buffer = *_batches[id];
+		std::unique_lock<std::mutex> lock{buffer.mtx, std::try_to_lock};
+		if (lock.owns_lock() && buffer.handles.size() > 0) {
+			t = TaskData{nullptr, id, std::make_shared<HandleBatch>(std::move(buffer.handles)), nullptr, IndexRange{0, 0},
+					nullptr, detail::Tracer::Now()};
+			buffer.handles.clear();
+			return true;
+		}
+	}
+	return false;
+}
+
+
+// Steals from the workers of the same pool
 template<typename D>
 inline bool Mdf<D>::Steal(TaskData& t, std::size_t shuffle)
 {
-	for (std::size_t i = 0; i < _tn; ++i) {
-		std::size_t idx = (shuffle+i+1)%_tn;
+	ExecutionClass pool = PoolOf(shuffle);
+	std::size_t begin = PoolBegin(pool);
+	std::size_t n = _pools.Size(pool);
+	for (std::size_t i = 0; i < n; ++i) {
+		std::size_t idx = begin + (shuffle-begin+i+1)%n;
 		if (_localTasks[idx]->Get(t)) return true;
 	}
+	_stats.FailedSteal(shuffle);
 	return false;
 }
 
 template<typename D>
 inline void Mdf<D>::Worker(std::size_t index)
 {
-	out.Println("Worker running with index ", index);
+	ExecutionClass pool = PoolOf(index);
+	if (pool == ExecutionClass::Compute)
+		out.Println("Worker running with index ", index);
+	else
+		out.Println("Worker running with index ", index, " (", ExecutionClassName(pool), ")");
 	TaskQueue& localTasks = *_localTasks[index];
+	Context ctx{index, localTasks, nullptr, pool};
 	TaskData t;
+	detail::TaskSource source;
+	bool idle = false;
+	auto idleSince = _stats.Now();
+	_perf.Open(index);
 	while (true) {
-		if (localTasks.Get(t) || _tasks.Get(t) || Steal(t, index)) {
-			auto node = t.gh->graph->GetNode(t.id);
-			auto state = t.gh->states.Get(t.id).first;
-			assert(state);
-
-			auto res = node->instruction->Execute(state->tokens);
-
-			if (node->links.size() == 0 && node->dependentNodes.size() == 0) {
-				{
-					std::lock_guard<std::mutex> lock{_drainerMutex};
-					(*_drainer)(res);
-				}
-				int n = --_numInstances;
-				assert(n >= 0);
-			} else {
-				// Count dependencies and fire instructions that do not require the result
-				for (auto& dependentId : node->dependentNodes) {
-					auto pair = t.gh->states.Get(dependentId);
-					auto state = pair.second ? pair.first : t.gh->states.Insert(dependentId, std::make_shared<InstructionState>()).first;
-					std::lock_guard<InstructionState> lock{*state};
-					state->resolvedDependencies++;
-					ScheduleIfFireable(t.gh, dependentId, localTasks);
-				}
-
-				// Move the result and create tasks for any new fireable instruction
-				for (auto& target : node->links) {
-					auto pair = t.gh->states.Get(target.nodeId);
-					auto state = pair.second ? pair.first : t.gh->states.Insert(target.nodeId, std::make_shared<InstructionState>()).first;
-					std::lock_guard<InstructionState> lock{*state};
-					state->tokens[target.paramName] = res;
-					ScheduleIfFireable(t.gh, target.nodeId, localTasks);
-				}
+		if (NextTask(t, index, source)) {
+			if (idle) {
+				--IdleWorkers(pool);
+				idle = false;
+				_stats.Idle(index, idleSince);
 			}
+			Run(t, source, ctx);
 		} else {
-			if (!_endOfStream || _numInstances > 0) {
+			if (!idle) {
+				++IdleWorkers(pool);
+				idle = true;
+				idleSince = _stats.Now();
+			}
+			if (Finished()) {
+				_stats.Idle(index, idleSince);
+				_perf.Close(index);
+				return;
+			} else if (pool == ExecutionClass::Compute && index >= _runningCompute) {
+				Park(index);
+			} else {
 				std::this_thread::yield();
 			}
-			else return;
 		}
 	}
 }
 
+template<typename D>
+inline void Mdf<D>::Run(TaskData& t, detail::TaskSource source, Context& ctx)
+{
+	if (t.gh && Expired(t.gh)) {
+		t.gh.reset();
+		t.map.reset();
+		t.result.reset();
+		return;
+	}
+	auto t0 = _stats.Now();
+	auto event = _tracer.Begin(ctx.index, t, source);
+	if (t.input)
+		Instantiate(t, ctx);
+	else if (t.result)
+		Propagate(t.gh, t.gh->graph->GetNode(t.id), std::move(t.result), ctx);
+	else if (t.batch)
+		ExecuteBatch(t, ctx);
+	else if (t.map)
+		ExecuteChunk(t, ctx);
+	else
+		Execute(t, ctx);
+	_tracer.End(ctx.index, event);
+	_stats.Task(ctx.index, source, t0);
+}
+
+/*
+ * Hosted mode, see Runtime.hpp. The stream is read by one ingestion
+ * thread of the runtime, and the engine has one compute worker slot for
+ * each worker of the runtime. Runtime workers count as idle for every
+ * engine while they find no task in any of them, and the hardware
+ * counters of each engine also count the tasks of the other engines
+ */
+template<typename D>
+inline void Mdf<D>::Open()
+{
+	Reset();
+	_activeSources = 1;
+}
+
+template<typename D>
+inline bool Mdf<D>::TryRunOne(std::size_t worker)
+{
+	TaskData t;
+	detail::TaskSource source;
+	if (!NextTask(t, worker, source))
+		return false;
+	Context ctx{worker, *_localTasks[worker], nullptr, ExecutionClass::Compute};
+	Run(t, source, ctx);
+	return true;
+}
+
+template<typename D>
+inline void Mdf<D>::Close()
+{
+	Resize(_runningCompute);
+#ifdef MDF_ENABLE_LATENCY
+	PrintLatency(Latency());
+#endif
+	RethrowStreamError();
+}
+
+/*
+ * Parked workers are not counted as idle, the timeout lets them notice
+ * the end of the stream. Compute workers have the lowest indices
+ */
+template<typename D>
+inline void Mdf<D>::Park(std::size_t index)
+{
+	--IdleWorkers(ExecutionClass::Compute);
+	{
+		std::unique_lock<std::mutex> lock{_parkMutex};
+		_unpark.wait_for(lock, _pools.elastic.period,
+				[this, index]() { return index < _runningCompute || Finished(); });
+	}
+	++IdleWorkers(ExecutionClass::Compute);
+}
+
+// Controller of the elastic compute pool, see ElasticPolicy
+template<typename D>
+inline void Mdf<D>::Scale()
+{
+	const ElasticPolicy& policy = _pools.elastic;
+	unsigned busyPeriods = 0;
+	unsigned idlePeriods = 0;
+	long lastInFlight = _numInstances;
+	while (!Finished()) {
+		std::this_thread::sleep_for(policy.period);
+		std::size_t running = _runningCompute;
+		std::size_t queued = _tasks.Size() + _resumed.Size() + _deadlineTasks[static_cast<unsigned>(ExecutionClass::Compute)]->Size();
+		for (std::size_t i = 0; i < _pools.compute; ++i)
+			queued += _localTasks[i]->Size();
+		long inFlight = _numInstances;
+		if (IdleWorkers(ExecutionClass::Compute) == 0 && (queued > running || inFlight > lastInFlight)) {
+			idlePeriods = 0;
+			if (++busyPeriods >= policy.growAfter && running < _pools.compute) {
+				Resize(running + 1);
+				busyPeriods = 0;
+			}
+		} else if (IdleWorkers(ExecutionClass::Compute) > 0 && queued == 0) {
+			busyPeriods = 0;
+			if (++idlePeriods >= policy.shrinkAfter && running > policy.min) {
+				Resize(running - 1);
+				idlePeriods = 0;
+			}
+		} else {
+			busyPeriods = idlePeriods = 0;
+		}
+		lastInFlight = inFlight;
+	}
+}
+
+// Sets the number of running compute workers and updates the scaling report
+template<typename D>
+inline void Mdf<D>::Resize(std::size_t running)
+{
+	auto now = std::chrono::steady_clock::now();
+	std::size_t previous = _runningCompute;
+	_scaling.workerSeconds += previous * std::chrono::duration<double>(now - _lastScaling).count();
+	_lastScaling = now;
+	if (running != previous) {
+		{
+			std::lock_guard<std::mutex> lock{_parkMutex};
+			_runningCompute = running;
+		}
+		_unpark.notify_all();
+		_scaling.timeline.emplace_back(std::chrono::duration<double>(now - _scalingStart).count(), running);
+		if (running > _scaling.peak) _scaling.peak = running;
+	}
+}
+
+/*
+ * Takes a task from the local queue, the completed asynchronous
+ * instructions, the global queue of the pool, another worker of the pool
+ * or a pending batch. With TaskOrder::EarliestDeadlineFirst the tasks of
+ * the instances with a deadline come first
+ */
+template<typename D>
+inline bool Mdf<D>::NextTask(TaskData& t, std::size_t index, detail::TaskSource& source)
+{
+	if (_order == TaskOrder::EarliestDeadlineFirst && _deadlineTasks[static_cast<unsigned>(PoolOf(index))]->Get(t))
+		source = detail::TaskSource::Global;
+	else if (_localTasks[index]->Get(t))
+		source = detail::TaskSource::Local;
+	else if (_resumed.Get(t) || PoolTasks(PoolOf(index)).Get(t))
+		source = detail::TaskSource::Global;
+	else if (Steal(t, index))
+		source = detail::TaskSource::Stolen;
+	else if (FlushBatch(t, index))
+		source = detail::TaskSource::Flushed;
+	else
+		return false;
+	return true;
+}
+
+template<typename D>
+inline void Mdf<D>::Instantiate(TaskData& t, Context& ctx)
+{
+	if (t.input->batch.Size() > 0) {
+		InstantiateBatch(t.input->batch, t.input->instanceId, t.input->read, ctx);
+	} else {
+		std::shared_ptr<GraphHandle> gh = NewInstance(t.input->instanceId, t.input->read, t.input->deadline);
+		if (!Expired(gh)) {
+			for (auto& itc : t.input->tokens)
+				Deliver(gh, itc.destination, itc.token, ctx);
+		}
+	}
+	t.input.reset();
+}
+
+template<typename D>
+inline void Mdf<D>::Execute(TaskData& t, Context& ctx)
+{
+	_latency.Started(t.gh->marks);
+	auto node = t.gh->graph->GetNode(t.id);
+	auto state = t.gh->states.Get(t.id).first;
+	assert(state);
+
+	if (node->instruction->IsMap()) {
+		auto& instruction = static_cast<const MapInstruction&>(*node->instruction);
+		t.map = std::make_shared<MapState>();
+		t.chunk = instruction.Range(node->Inputs(state->tokens.data()));
+		ExecuteChunk(t, ctx);
+	} else if (node->instruction->IsAsync()) {
+		// Only the start of the operation is measured, the instance counts as active until it completes
+		auto& instruction = static_cast<const AsyncInstruction&>(*node->instruction);
+		auto gh = t.gh;
+		NodeId id = t.id;
+		auto t0 = _stats.Now();
+		auto counters = _perf.Begin(ctx.index);
+		++_pendingAsync;
+		instruction.ExecuteAsync(node->Inputs(state->tokens.data()), [this, gh, id](TokenHandle res) { Resume(gh, id, res); });
+		_perf.End(ctx.index, t.id, counters);
+		_stats.Executed(ctx.index, t.id, 1, t0);
+	} else {
+		auto t0 = _stats.Now();
+		auto counters = _perf.Begin(ctx.index);
+		auto res = node->instruction->Execute(node->Inputs(state->tokens.data()));
+		_perf.End(ctx.index, t.id, counters);
+		_stats.Executed(ctx.index, t.id, 1, t0);
+		Propagate(t.gh, node, res, ctx);
+	}
+}
+
+// Called by the thread that completes an asynchronous instruction, a worker propagates the result
+template<typename D>
+inline void Mdf<D>::Resume(std::shared_ptr<GraphHandle> gh, NodeId id, TokenHandle res)
+{
+	_resumed.Put(TaskData{std::move(gh), id, nullptr, nullptr, IndexRange{0, 0}, nullptr, detail::Tracer::Now(), std::move(res)});
+	--_pendingAsync; // The interpreter may stop once the result is queued
+}
+
+/*
+ * Map chunks are split lazily: as long as some worker of the pool of the
+ * map instruction is idle the chunk
+ * is halved and the upper half is pushed on the local queue, where it
+ * can be stolen (and split again). The last chunk to complete joins the
+ * results and fires the successors of the map instruction. Chunk results
+ * are folded directly into the reduce instructions linked to the map
+ */
+template<typename D>
+inline void Mdf<D>::ExecuteChunk(TaskData& t, Context& ctx)
+{
+	auto node = t.gh->graph->GetNode(t.id);
+	auto state = t.gh->states.Get(t.id).first;
+	auto& instruction = static_cast<const MapInstruction&>(*node->instruction);
+
+	IndexRange chunk = t.chunk;
+	while (chunk.Size() >= 2*instruction.Grain() && IdleWorkers(_route[t.id]) > 0) {
+		std::size_t mid = chunk.begin + chunk.Size()/2;
+		++t.map->pending;
+		ctx.tasks.Put(TaskData{t.gh, t.id, nullptr, t.map, IndexRange{mid, chunk.end}, nullptr, detail::Tracer::Now()});
+		chunk.end = mid;
+	}
+
+	auto t0 = _stats.Now();
+	auto counters = _perf.Begin(ctx.index);
+	auto res = instruction.ExecuteChunk(node->Inputs(state->tokens.data()), chunk);
+	_perf.End(ctx.index, t.id, counters);
+	_stats.Executed(ctx.index, t.id, 1, t0);
+	{
+		std::lock_guard<std::mutex> lock{t.map->mtx};
+		t.map->parts.emplace_back(chunk.begin, res);
+	}
+	for (auto& target : node->links) {
+		if (t.gh->graph->GetNode(target.nodeId)->instruction->IsReduce())
+			Fold(t.gh, target.nodeId, res, ctx);
+	}
+
+	if (--t.map->pending == 0) {
+		TokenHandle joined;
+		{
+			std::lock_guard<std::mutex> lock{t.map->mtx};
+			joined = instruction.Join(t.map->parts);
+		}
+		Propagate(t.gh, node, joined, ctx);
+	}
+	t.map.reset();
+}
+
+template<typename D>
+inline void Mdf<D>::ExecuteBatch(TaskData& t, Context& ctx)
+{
+	HandleBatch& handles = *t.batch;
+	handles.erase(std::remove_if(handles.begin(), handles.end(), [this](const std::shared_ptr<GraphHandle>& gh) { return Expired(gh); }),
+			handles.end());
+	if (handles.empty())
+		return;
+
+	std::vector<InputTokens> inputs;
+	inputs.reserve(handles.size());
+	for (auto& gh : handles) {
+		_latency.Started(gh->marks);
+		auto state = gh->states.Get(t.id).first;
+		assert(state);
+		inputs.push_back(gh->graph->GetNode(t.id)->Inputs(state->tokens.data()));
+	}
+
+	std::vector<TokenHandle> results;
+	results.reserve(handles.size());
+	auto t0 = _stats.Now();
+	auto counters = _perf.Begin(ctx.index);
+	_model->GetNode(t.id)->instruction->ExecuteBatch(inputs, results);
+	_perf.End(ctx.index, t.id, counters);
+	_stats.Executed(ctx.index, t.id, handles.size(), t0);
+	assert(results.size() == handles.size());
+
+	for (std::size_t i = 0; i < handles.size(); ++i)
+		Propagate(handles[i], handles[i]->graph->GetNode(t.id), results[i], ctx);
+}
+
+template<typename D>
+inline void Mdf<D>::Propagate(const std::shared_ptr<GraphHandle>& gh, const std::shared_ptr<Node>& node, TokenHandle res, Context& ctx)
+{
+	if (node->links.size() == 0 && node->dependentNodes.size() == 0) {
+		if (gh->settled.exchange(true))
+			return; // Cancelled while the exit node ran
+		{
+			std::lock_guard<std::mutex> lock{_drainerMutex};
+			Drain(gh->instanceId, res, typename detail::IsIndexedDrainer<D>::type{});
+			_latency.Drained(gh->marks);
+		}
+		if (gh->deadline != Deadline::max()) {
+			if (std::chrono::steady_clock::now() <= gh->deadline)
+				++_metDeadlines;
+			else
+				++_missedDeadlines;
+		}
+		int n = --_numInstances;
+		assert(n >= 0);
+	} else {
+		// Count dependencies and fire instructions that do not require the result
+		for (auto& dependentId : node->dependentNodes) {
+			if (gh->graph->GetNode(dependentId)->instruction->IsReduce()) {
+				Arrive(gh, dependentId, ctx);
+			} else {
+				auto state = GetState(gh, dependentId);
+				std::lock_guard<InstructionState> lock{*state};
+				state->resolvedDependencies++;
+				ScheduleIfFireable(gh, dependentId, ctx);
+			}
+		}
+
+		// Move the result and create tasks for any new fireable instruction
+		for (auto& target : node->links) {
+			if (node->instruction->IsMap() && gh->graph->GetNode(target.nodeId)->instruction->IsReduce())
+				Arrive(gh, target.nodeId, ctx); // The chunks have already been folded
+			else
+				Deliver(gh, target, res, ctx);
+		}
+	}
+}
+
+template<typename D>
+inline void Mdf<D>::Deliver(const std::shared_ptr<GraphHandle>& gh, const ParameterAddress& destination, TokenHandle token, Context& ctx)
+{
+	std::size_t pindex = destination.paramIndex;
+	if (pindex == ParameterAddress::npos)
+		pindex = gh->graph->GetNode(destination.nodeId)->instruction->ParamIndex(destination.paramName);
+	Deliver(gh, PortHandle{destination.nodeId, pindex}, std::move(token), ctx);
+}
+
+template<typename D>
+inline void Mdf<D>::Deliver(const std::shared_ptr<GraphHandle>& gh, PortHandle port, TokenHandle token, Context& ctx)
+{
+	auto node = gh->graph->GetNode(port.nodeId);
+	// Links to constants are rejected by Graph::Finalize, so only a streamer can get here
+	assert(!(node->constants && (*node->constants)[port.paramIndex]) && "token sent to a constant parameter");
+	if (node->instruction->IsReduce()) {
+		Fold(gh, port.nodeId, token, ctx);
+		Arrive(gh, port.nodeId, ctx);
+	} else {
+		auto state = GetState(gh, port.nodeId);
+		std::lock_guard<InstructionState> lock{*state};
+		if (!state->tokens[port.paramIndex]) state->receivedTokens++;
+		state->tokens[port.paramIndex] = token;
+		ScheduleIfFireable(gh, port.nodeId, ctx);
+	}
+}
+
+template<typename D>
+inline std::shared_ptr<typename Mdf<D>::InstructionState> Mdf<D>::GetState(const std::shared_ptr<GraphHandle>& gh, NodeId id)
+{
+	auto pair = gh->states.Get(id);
+	if (pair.second)
+		return pair.first;
+
+	auto state = std::make_shared<InstructionState>();
+	auto node = gh->graph->GetNode(id);
+	if (node->instruction->IsReduce())
+		state->reduce.reset(new ReduceState{_tn+1, long(gh->graph->Operands(id))});
+	else
+		state->tokens.resize(node->instruction->Arity());
+	return gh->states.Insert(id, state).first;
+}
+
+/*
+ * Reduce instructions are never scheduled: each operand is combined into
+ * the partial result of the worker that produced it, and the thread that
+ * delivers the last operand combines the partial results and propagates
+ * the reduction
+ */
+template<typename D>
+inline void Mdf<D>::Fold(const std::shared_ptr<GraphHandle>& gh, NodeId id, TokenHandle token, Context& ctx)
+{
+	auto& instruction = static_cast<const ReduceInstruction&>(*gh->graph->GetNode(id)->instruction);
+	auto& partial = GetState(gh, id)->reduce->partials[ctx.index];
+	std::lock_guard<std::mutex> lock{partial.mtx};
+	partial.value = partial.value ? instruction.Combine(partial.value, token) : token;
+}
+
+template<typename D>
+inline void Mdf<D>::Arrive(const std::shared_ptr<GraphHandle>& gh, NodeId id, Context& ctx)
+{
+	auto state = GetState(gh, id);
+	if (--state->reduce->remaining == 0) {
+		auto node = gh->graph->GetNode(id);
+		auto& instruction = static_cast<const ReduceInstruction&>(*node->instruction);
+		TokenHandle res;
+		for (std::size_t i = 0; i <= _tn; ++i) {
+			auto& partial = state->reduce->partials[i];
+			std::lock_guard<std::mutex> lock{partial.mtx};
+			if (partial.value)
+				res = res ? instruction.Combine(res, partial.value) : partial.value;
+		}
+		if (node->constants) {
+			for (auto& c : *node->constants) {
+				if (c) res = res ? instruction.Combine(res, c) : c;
+			}
+		}
+		Propagate(gh, node, res, ctx);
+	}
+}
+
 } // mdf namespace
 
 #endif
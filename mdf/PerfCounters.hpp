@@ -0,0 +1,323 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+#ifndef MDF_PERF_COUNTERS_HPP
+#define MDF_PERF_COUNTERS_HPP
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+#if defined(MDF_ENABLE_PERF) && defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <cerrno>
+#endif
+
+#include "Graph.hpp"
+#include "Printer.hpp"
+
+namespace mdf {
+
+/*
+ * Hardware performance counters
+ * When MDF_ENABLE_PERF is defined (Linux only) every worker opens a group of
+ * perf_event_open counters on its own thread and reads it around each
+ * instruction it executes, attributing the deltas to the node. Whatever the
+ * worker counts outside instructions (scheduling, token delivery, idle
+ * spinning) is reported as runtime overhead. Counters the kernel refuses
+ * (perf_event_paranoid, containers, virtual machines without a PMU) are
+ * simply reported as unavailable. Each read is a system call, so timings
+ * taken in this mode are inflated.
+ */
+
+enum class PerfEvent : unsigned { Cycles, Instructions, CacheMisses, BranchMisses };
+
+struct PerfValues {
+	static constexpr unsigned NumEvents = 4;
+
+	std::uint64_t values[NumEvents];
+
+	PerfValues() : values{} { }
+
+	std::uint64_t operator[](PerfEvent e) const { return values[static_cast<unsigned>(e)]; }
+};
+
+struct NodePerfCounters {
+	std::uint64_t tasks;
+	PerfValues counters;
+};
+
+struct PerfReport {
+	bool enabled;
+	bool available[PerfValues::NumEvents]; // Events that could be opened by every worker
+	std::string error; // Why some events are missing
+	PerfValues runtime; // Counted by the workers outside instructions
+	std::vector<NodePerfCounters> nodes; // Indexed by NodeId
+};
+
+inline const char *PerfEventName(PerfEvent e)
+{
+	switch (e) {
+	case PerfEvent::Cycles: return "cycles";
+	case PerfEvent::Instructions: return "instructions";
+	case PerfEvent::CacheMisses: return "LLC misses";
+	default: return "branch misses";
+	}
+}
+
+inline void PrintPerfCounters(const PerfReport& r, const Graph& g)
+{
+	if (!r.enabled) {
+		out.Println("Hardware counters disabled (define MDF_ENABLE_PERF, Linux only).");
+		return;
+	}
+	if (!r.error.empty())
+		out.Println("Hardware counters: ", r.error);
+	bool any = false;
+	for (bool a : r.available) any = any || a;
+	if (!any)
+		return;
+
+	auto print = [&r](std::string line, const PerfValues& v) {
+		for (unsigned k = 0; k < PerfValues::NumEvents; ++k) {
+			if (r.available[k])
+				line += ", " + std::to_string(v.values[k]) + " " + PerfEventName(static_cast<PerfEvent>(k));
+		}
+		if (r.available[static_cast<unsigned>(PerfEvent::Cycles)] && r.available[static_cast<unsigned>(PerfEvent::Instructions)]
+				&& v[PerfEvent::Cycles] > 0)
+			line += ", IPC " + std::to_string(static_cast<double>(v[PerfEvent::Instructions]) / v[PerfEvent::Cycles]);
+		if (r.available[static_cast<unsigned>(PerfEvent::CacheMisses)] && r.available[static_cast<unsigned>(PerfEvent::Instructions)]
+				&& v[PerfEvent::Instructions] > 0)
+			line += ", LLC MPKI " + std::to_string(1000.0 * v[PerfEvent::CacheMisses] / v[PerfEvent::Instructions]);
+		out.Println(line);
+	};
+
+	for (NodeId id = 0; id < r.nodes.size(); ++id) {
+		if (r.nodes[id].tasks > 0)
+			print(g.Label(id) + ": " + std::to_string(r.nodes[id].tasks) + " tasks", r.nodes[id].counters);
+	}
+	print("runtime outside instructions", r.runtime);
+}
+
+namespace detail {
+
+#if defined(MDF_ENABLE_PERF) && defined(__linux__)
+
+class PerfCollector {
+
+public:
+
+	using Sample = PerfValues;
+
+private:
+
+	struct WorkerCounters {
+		int fds[PerfValues::NumEvents]; // -1 if the event could not be opened
+		int positions[PerfValues::NumEvents]; // Position of each event in a group read
+		int leader;
+		int opened;
+		PerfValues last;
+		std::atomic<std::uint64_t> runtime[PerfValues::NumEvents];
+		std::unique_ptr<std::atomic<std::uint64_t>[]> nodes; // (1 + NumEvents) counters per node
+		char pad[64];
+
+		WorkerCounters() : leader{-1}, opened{0}, last{}, nodes{}
+		{
+			for (unsigned k = 0; k < PerfValues::NumEvents; ++k) {
+				fds[k] = -1;
+				positions[k] = -1;
+				runtime[k].store(0, std::memory_order_relaxed);
+			}
+		}
+	};
+
+	const std::size_t _tn;
+	const std::size_t _numNodes;
+	std::unique_ptr<WorkerCounters[]> _workers;
+	std::atomic<unsigned> _missing; // Bit k set if event k failed to open on some worker
+	std::atomic<int> _error; // errno of the first failed open, 0 if none
+
+	static void Add(std::atomic<std::uint64_t>& c, std::uint64_t v)
+	{
+		c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+	}
+
+	static int OpenEvent(PerfEvent e, int group)
+	{
+		static const std::uint64_t configs[PerfValues::NumEvents] = {
+			PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+		};
+		perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = configs[static_cast<unsigned>(e)];
+		attr.read_format = PERF_FORMAT_GROUP;
+		attr.exclude_kernel = 1; // Allowed with the default perf_event_paranoid
+		attr.exclude_hv = 1;
+		return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+	}
+
+	bool Read(const WorkerCounters& w, PerfValues& v) const
+	{
+		std::uint64_t buf[1 + PerfValues::NumEvents];
+		if (w.leader < 0 || read(w.leader, buf, sizeof(buf)) < static_cast<ssize_t>(sizeof(std::uint64_t) * (1 + w.opened)))
+			return false;
+		for (unsigned k = 0; k < PerfValues::NumEvents; ++k)
+			v.values[k] = w.positions[k] >= 0 ? buf[1 + w.positions[k]] : 0;
+		return true;
+	}
+
+	void Failed(unsigned k)
+	{
+		_missing.fetch_or(1u << k);
+		int expected = 0;
+		_error.compare_exchange_strong(expected, errno);
+	}
+
+public:
+
+	PerfCollector(std::size_t tn, std::size_t numNodes)
+			: _tn{tn}, _numNodes{numNodes}, _workers{new WorkerCounters[tn]}, _missing{0}, _error{0}
+	{
+		for (std::size_t i = 0; i < tn; ++i) {
+			_workers[i].nodes.reset(new std::atomic<std::uint64_t>[numNodes * (1 + PerfValues::NumEvents)]);
+			for (std::size_t j = 0; j < numNodes * (1 + PerfValues::NumEvents); ++j)
+				_workers[i].nodes[j].store(0, std::memory_order_relaxed);
+		}
+	}
+
+	~PerfCollector()
+	{
+		for (std::size_t i = 0; i < _tn; ++i)
+			Close(i);
+	}
+
+	// Opens the counters of the calling thread, events that fail are skipped
+	void Open(std::size_t worker)
+	{
+		WorkerCounters& w = _workers[worker];
+		for (unsigned k = 0; k < PerfValues::NumEvents; ++k) {
+			int fd = OpenEvent(static_cast<PerfEvent>(k), w.leader);
+			if (fd < 0) {
+				Failed(k);
+				continue;
+			}
+			if (w.leader < 0) w.leader = fd;
+			w.fds[k] = fd;
+			w.positions[k] = w.opened++;
+		}
+		if (!Read(w, w.last))
+			w.last = PerfValues{};
+	}
+
+	// Charges what was counted since the last read to the runtime and closes the counters
+	void Close(std::size_t worker)
+	{
+		WorkerCounters& w = _workers[worker];
+		Sample s;
+		if (Read(w, s)) {
+			for (unsigned k = 0; k < PerfValues::NumEvents; ++k)
+				Add(w.runtime[k], s.values[k] - w.last.values[k]);
+		}
+		for (unsigned k = 0; k < PerfValues::NumEvents; ++k) {
+			if (w.fds[k] >= 0) close(w.fds[k]);
+			w.fds[k] = -1;
+			w.positions[k] = -1;
+		}
+		w.leader = -1;
+		w.opened = 0;
+	}
+
+	// Reads the counters before an instruction, the delta since the last read goes to the runtime
+	Sample Begin(std::size_t worker)
+	{
+		WorkerCounters& w = _workers[worker];
+		Sample s;
+		if (Read(w, s)) {
+			for (unsigned k = 0; k < PerfValues::NumEvents; ++k)
+				Add(w.runtime[k], s.values[k] - w.last.values[k]);
+		}
+		return s;
+	}
+
+	void End(std::size_t worker, NodeId id, const Sample& begin)
+	{
+		WorkerCounters& w = _workers[worker];
+		if (!Read(w, w.last))
+			return;
+		std::atomic<std::uint64_t> *n = &w.nodes[id * (1 + PerfValues::NumEvents)];
+		Add(n[0], 1);
+		for (unsigned k = 0; k < PerfValues::NumEvents; ++k)
+			Add(n[1 + k], w.last.values[k] - begin.values[k]);
+	}
+
+	PerfReport Report() const
+	{
+		PerfReport r{true, {}, std::string{}, PerfValues{}, std::vector<NodePerfCounters>(_numNodes)};
+		unsigned missing = _missing.load();
+		for (unsigned k = 0; k < PerfValues::NumEvents; ++k)
+			r.available[k] = (missing & (1u << k)) == 0;
+		for (std::size_t i = 0; i < _tn; ++i) {
+			const WorkerCounters& w = _workers[i];
+			for (unsigned k = 0; k < PerfValues::NumEvents; ++k)
+				r.runtime.values[k] += w.runtime[k].load(std::memory_order_relaxed);
+			for (NodeId id = 0; id < _numNodes; ++id) {
+				const std::atomic<std::uint64_t> *n = &w.nodes[id * (1 + PerfValues::NumEvents)];
+				r.nodes[id].tasks += n[0].load(std::memory_order_relaxed);
+				for (unsigned k = 0; k < PerfValues::NumEvents; ++k)
+					r.nodes[id].counters.values[k] += n[1 + k].load(std::memory_order_relaxed);
+			}
+		}
+		int error = _error.load();
+		if (error != 0) {
+			r.error = std::string{"some events could not be opened ("} + std::strerror(error) + ")";
+			if (missing == (1u << PerfValues::NumEvents) - 1)
+				r.error = std::string{"not available ("} + std::strerror(error) + ")";
+		}
+		return r;
+	}
+
+};
+
+#else
+
+// Hardware counters disabled, every hook compiles to nothing
+class PerfCollector {
+
+public:
+
+	struct Sample { };
+
+	PerfCollector(std::size_t, std::size_t) { }
+
+	void Open(std::size_t) { }
+	void Close(std::size_t) { }
+	Sample Begin(std::size_t) { return Sample{}; }
+	void End(std::size_t, NodeId, const Sample&) { }
+
+	PerfReport Report() const
+	{
+		return PerfReport{false, {}, std::string{}, PerfValues{}, std::vector<NodePerfCounters>{}};
+	}
+
+};
+
+#endif
+
+} // detail namespace
+
+} // mdf namespace
+
+#endif
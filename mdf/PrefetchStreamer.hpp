@@ -0,0 +1,166 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+#ifndef MDF_PREFETCH_STREAMER_HPP
+#define MDF_PREFETCH_STREAMER_HPP
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <cassert>
+
+#include "Mdf.hpp"
+
+namespace mdf {
+
+/*
+ * Prefetch counters: if the consumer often waits on an empty buffer the
+ * streamer is the bottleneck, if the producer often waits on a full
+ * buffer the interpreter is the bottleneck
+ */
+struct PrefetchStatistics {
+	std::size_t items;
+	std::size_t producerWaits; // Times the buffer was full
+	std::size_t consumerWaits; // Times the buffer was empty
+	std::chrono::nanoseconds producerWaitTime;
+	std::chrono::nanoseconds consumerWaitTime;
+};
+
+/*
+ * Streamer adapter that calls Next() on the wrapped streamer from a
+ * dedicated producer thread, up to depth items ahead of the interpreter.
+ * The producer stops at the end of the stream (or when the adapter is
+ * destroyed), Release() returns the wrapped streamer
+ */
+template<typename S>
+class PrefetchStreamer {
+
+private:
+
+	using Clock = std::chrono::steady_clock;
+
+	std::unique_ptr<S> _streamer;
+	const std::size_t _depth;
+
+	std::mutex _mtx;
+	std::condition_variable _notFull;
+	std::condition_variable _notEmpty;
+	std::deque<std::vector<InputTokenContainer>> _buffer;
+	bool _done; // The producer has reached the end of the stream
+	bool _stop;
+
+	PrefetchStatistics _stats;
+
+	std::thread _producer;
+
+public:
+
+	PrefetchStreamer(std::unique_ptr<S> streamer, std::size_t depth)
+			: _streamer{std::move(streamer)}, _depth{depth > 0 ? depth : 1}, _mtx{}, _notFull{}, _notEmpty{},
+			  _buffer{}, _done{false}, _stop{false}, _stats{0, 0, 0, std::chrono::nanoseconds{0}, std::chrono::nanoseconds{0}},
+			  _producer{}
+	{
+		assert(_streamer);
+		_producer = std::thread{&PrefetchStreamer::Produce, this};
+	}
+
+	PrefetchStreamer(const PrefetchStreamer&) = delete;
+	PrefetchStreamer& operator=(const PrefetchStreamer&) = delete;
+
+	~PrefetchStreamer()
+	{
+		Stop();
+	}
+
+	std::vector<InputTokenContainer> Next()
+	{
+		std::unique_lock<std::mutex> lock{_mtx};
+		if (_buffer.empty() && !_done) {
+			_stats.consumerWaits++;
+			auto t0 = Clock::now();
+			_notEmpty.wait(lock, [this] { return !_buffer.empty() || _done; });
+			_stats.consumerWaitTime += Clock::now() - t0;
+		}
+		if (_buffer.empty())
+			return std::vector<InputTokenContainer>{};
+
+		std::vector<InputTokenContainer> input = std::move(_buffer.front());
+		_buffer.pop_front();
+		_notFull.notify_one();
+		return input;
+	}
+
+	PrefetchStatistics Statistics()
+	{
+		std::lock_guard<std::mutex> lock{_mtx};
+		return _stats;
+	}
+
+	// Stops the producer and returns the wrapped streamer
+	std::unique_ptr<S> Release()
+	{
+		Stop();
+		return std::move(_streamer);
+	}
+
+private:
+
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock{_mtx};
+			_stop = true;
+		}
+		_notFull.notify_all();
+		if (_producer.joinable()) _producer.join();
+	}
+
+	void Produce()
+	{
+		while (true) {
+			std::vector<InputTokenContainer> input = _streamer->Next();
+
+			std::unique_lock<std::mutex> lock{_mtx};
+			if (input.empty()) {
+				_done = true;
+				_notEmpty.notify_all();
+				return;
+			}
+			if (_buffer.size() >= _depth && !_stop) {
+				_stats.producerWaits++;
+				auto t0 = Clock::now();
+				_notFull.wait(lock, [this] { return _buffer.size() < _depth || _stop; });
+				_stats.producerWaitTime += Clock::now() - t0;
+			}
+			if (_stop) {
+				_done = true;
+				_notEmpty.notify_all();
+				return;
+			}
+			_buffer.push_back(std::move(input));
+			_stats.items++;
+			_notEmpty.notify_one();
+		}
+	}
+
+};
+
+template<typename S>
+std::unique_ptr<PrefetchStreamer<S>> MakePrefetchStreamer(std::unique_ptr<S> streamer, std::size_t depth)
+{
+	return std::unique_ptr<PrefetchStreamer<S>>{new PrefetchStreamer<S>{std::move(streamer), depth}};
+}
+
+} // mdf namespace
+
+#endif
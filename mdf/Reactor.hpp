@@ -0,0 +1,213 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+#ifndef MDF_REACTOR_HPP
+#define MDF_REACTOR_HPP
+
+#include <functional>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <system_error>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <cerrno>
+#endif
+
+#include "Printer.hpp"
+
+namespace mdf {
+
+/*
+ * Event loop for asynchronous instructions
+ * A reactor thread waits on an epoll set and runs a callback when a file
+ * descriptor becomes ready or a timer expires, typically the Completion of
+ * an asynchronous instruction. Each registration fires once. Callbacks run
+ * on the reactor thread and should only hand the result over (completing
+ * an instruction just queues a task), long computations belong in the
+ * graph. Callbacks still pending when the reactor is destroyed are dropped
+ */
+
+#ifdef __linux__
+
+class Reactor {
+
+public:
+
+	using Callback = std::function<void()>;
+
+private:
+
+	struct Watch {
+		int fd;
+		bool owned; // Timer descriptors are closed by the reactor
+		Callback cb;
+	};
+
+	int _epoll;
+	int _wakeup; // Event descriptor used to stop the loop, registered with key 0
+	std::mutex _mtx;
+	std::unordered_map<std::uint64_t,Watch> _watches;
+	std::uint64_t _nextKey;
+	std::atomic<bool> _stop;
+	std::thread _thread;
+
+public:
+
+	Reactor() : _epoll{-1}, _wakeup{-1}, _mtx{}, _watches{}, _nextKey{1}, _stop{false}, _thread{}
+	{
+		_epoll = epoll_create1(EPOLL_CLOEXEC);
+		if (_epoll < 0)
+			throw std::system_error(errno, std::generic_category(), "Reactor: epoll_create1");
+		_wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (_wakeup < 0) {
+			int e = errno;
+			close(_epoll);
+			throw std::system_error(e, std::generic_category(), "Reactor: eventfd");
+		}
+		epoll_event ev{};
+		ev.events = EPOLLIN;
+		ev.data.u64 = 0;
+		epoll_ctl(_epoll, EPOLL_CTL_ADD, _wakeup, &ev);
+		_thread = std::thread{&Reactor::Run, this};
+	}
+
+	Reactor(const Reactor&) = delete;
+	Reactor& operator=(const Reactor&) = delete;
+
+	~Reactor()
+	{
+		_stop = true;
+		std::uint64_t one = 1;
+		ssize_t r = write(_wakeup, &one, sizeof(one));
+		(void) r;
+		_thread.join();
+		for (auto& w : _watches)
+			if (w.second.owned) close(w.second.fd);
+		close(_wakeup);
+		close(_epoll);
+	}
+
+	// Runs cb once delay has elapsed
+	void After(std::chrono::nanoseconds delay, Callback cb)
+	{
+		int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (fd < 0)
+			throw std::system_error(errno, std::generic_category(), "Reactor: timerfd_create");
+		// A zero expiration disarms the timer
+		std::int64_t ns = delay.count() > 0 ? delay.count() : 1;
+		itimerspec spec{};
+		spec.it_value.tv_sec = ns / 1000000000;
+		spec.it_value.tv_nsec = ns % 1000000000;
+		if (timerfd_settime(fd, 0, &spec, nullptr) < 0) {
+			int e = errno;
+			close(fd);
+			throw std::system_error(e, std::generic_category(), "Reactor: timerfd_settime");
+		}
+		Add(fd, EPOLLIN, true, std::move(cb));
+	}
+
+	// Runs cb once fd is readable, a descriptor can be watched by one registration at a time
+	void WhenReadable(int fd, Callback cb) { Add(fd, EPOLLIN, false, std::move(cb)); }
+
+	// Runs cb once fd is writable, a descriptor can be watched by one registration at a time
+	void WhenWritable(int fd, Callback cb) { Add(fd, EPOLLOUT, false, std::move(cb)); }
+
+	// Number of registrations that have not fired yet
+	std::size_t Pending()
+	{
+		std::lock_guard<std::mutex> lock{_mtx};
+		return _watches.size();
+	}
+
+private:
+
+	void Add(int fd, std::uint32_t events, bool owned, Callback cb)
+	{
+		std::lock_guard<std::mutex> lock{_mtx};
+		std::uint64_t key = _nextKey++;
+		_watches.emplace(key, Watch{fd, owned, std::move(cb)});
+		epoll_event ev{};
+		ev.events = events | EPOLLONESHOT;
+		ev.data.u64 = key;
+		if (epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			int e = errno;
+			_watches.erase(key);
+			if (owned) close(fd);
+			throw std::system_error(e, std::generic_category(), "Reactor: epoll_ctl");
+		}
+	}
+
+	void Run()
+	{
+		epoll_event events[64];
+		while (!_stop) {
+			int n = epoll_wait(_epoll, events, 64, -1);
+			if (n < 0) {
+				if (errno == EINTR) continue;
+				err.Println("Reactor: epoll_wait failed (", std::strerror(errno), ")");
+				return;
+			}
+			for (int i = 0; i < n && !_stop; ++i) {
+				if (events[i].data.u64 == 0)
+					continue;
+				Callback cb;
+				{
+					std::lock_guard<std::mutex> lock{_mtx};
+					auto it = _watches.find(events[i].data.u64);
+					if (it == _watches.end())
+						continue;
+					// Removed before the callback so that it can watch the descriptor again
+					epoll_ctl(_epoll, EPOLL_CTL_DEL, it->second.fd, nullptr);
+					if (it->second.owned) close(it->second.fd);
+					cb = std::move(it->second.cb);
+					_watches.erase(it);
+				}
+				try {
+					cb();
+				} catch (std::exception& e) {
+					err.Println("Reactor: callback failed (", e.what(), ")");
+				}
+			}
+		}
+	}
+
+};
+
+#else
+
+class Reactor {
+
+public:
+
+	using Callback = std::function<void()>;
+
+	Reactor() { throw std::runtime_error("Reactor: epoll is only available on Linux"); }
+
+	void After(std::chrono::nanoseconds, Callback) { }
+	void WhenReadable(int, Callback) { }
+	void WhenWritable(int, Callback) { }
+	std::size_t Pending() { return 0; }
+
+};
+
+#endif
+
+} // mdf namespace
+
+#endif
@@ -0,0 +1,240 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+#ifndef MDF_RUNTIME_HPP
+#define MDF_RUNTIME_HPP
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <exception>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <cstdint>
+
+#include "Mdf.hpp"
+#include "Printer.hpp"
+
+namespace mdf {
+
+/*
+ * Multi-graph runtime
+ * Several graphs, each with its own streamer and drainer, share one pool
+ * of workers instead of running one interpreter (and tn threads) each.
+ * Each graph keeps its own queues, and the workers pick the graph to run
+ * with deficit round-robin: at each turn a graph earns quantum times its
+ * weight of execution time and runs tasks until the credit is spent or it
+ * has no ready task, in which case the credit is dropped. Heavy graphs
+ * cannot starve the others, and graphs that are saturated share the
+ * workers in proportion to their weights. Every worker keeps its own
+ * deficits, so the scheduler needs no synchronization
+ */
+
+struct GraphShare {
+	std::string name;
+	double weight;
+	std::uint64_t tasks;
+	std::chrono::nanoseconds busy; // Execution time of the tasks of the graph, over all the workers
+};
+
+struct RuntimeReport {
+	std::size_t workers;
+	std::chrono::nanoseconds elapsed;
+	std::vector<GraphShare> graphs;
+};
+
+class Runtime {
+
+private:
+
+	struct Entry {
+		std::unique_ptr<detail::HostedEngine> engine;
+		std::function<void()> ingest; // Reads the whole stream of the graph
+		std::string name;
+		double weight;
+		std::atomic<std::uint64_t> tasks;
+		std::atomic<std::int64_t> busy;
+	};
+
+	using Clock = std::chrono::steady_clock;
+
+	const std::size_t _tn;
+	const std::chrono::nanoseconds _quantum;
+	std::vector<std::unique_ptr<Entry>> _graphs;
+	std::chrono::nanoseconds _elapsed;
+
+public:
+
+	explicit Runtime(std::size_t tn, std::chrono::nanoseconds quantum = std::chrono::microseconds{100})
+			: _tn{tn}, _quantum{quantum}, _graphs{}, _elapsed{0}
+	{
+		if (_tn == 0)
+			throw std::invalid_argument("Runtime: at least one worker is needed");
+	}
+
+	Runtime(const Runtime&) = delete;
+	Runtime& operator=(const Runtime&) = delete;
+
+	std::size_t Workers() const { return _tn; }
+
+	/*
+	 * Adds a graph that reads its instances from streamer, which must
+	 * outlive Run(). The returned interpreter gives access to the
+	 * statistics of the graph, its execution classes are ignored
+	 */
+	template<typename D, typename S>
+	Mdf<D>& Add(const Graph& g, std::unique_ptr<D> drainer, S& streamer, double weight = 1.0, const std::string& name = "")
+	{
+		if (!(weight > 0))
+			throw std::invalid_argument("Runtime: the weight of a graph must be positive");
+		Mdf<D> *engine = new Mdf<D>{g, WorkerPools{_tn, 0, 0}, std::move(drainer)};
+		std::unique_ptr<Entry> e{new Entry{std::unique_ptr<detail::HostedEngine>{static_cast<detail::HostedEngine*>(engine)},
+				[engine, &streamer]() { engine->Ingestor(streamer); },
+				name.empty() ? "graph " + std::to_string(_graphs.size()) : name, weight, {0}, {0}}};
+		_graphs.push_back(std::move(e));
+		return *engine;
+	}
+
+	/*
+	 * Runs every graph until all the streams end and all the instances are
+	 * drained. A streamer that throws ends its own stream, the first such
+	 * exception is rethrown once every graph is closed
+	 */
+	void Run()
+	{
+		if (_graphs.empty())
+			return;
+
+		auto t0 = Clock::now();
+		for (auto& e : _graphs) {
+			e->engine->Open();
+			e->tasks = 0;
+			e->busy = 0;
+		}
+
+		std::vector<std::thread> threads;
+		threads.reserve(_graphs.size() + _tn);
+		for (auto& e : _graphs)
+			threads.emplace_back(e->ingest);
+		for (std::size_t i = 0; i < _tn; ++i)
+			threads.emplace_back(&Runtime::Worker, this, i);
+		for (auto& t : threads)
+			t.join();
+
+		std::exception_ptr error;
+		for (auto& e : _graphs) {
+			try {
+				e->engine->Close();
+			} catch (...) {
+				if (!error)
+					error = std::current_exception();
+			}
+		}
+		_elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t0);
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+	// Execution time of each graph during the last Run()
+	RuntimeReport Report() const
+	{
+		RuntimeReport r{_tn, _elapsed, {}};
+		for (auto& e : _graphs)
+			r.graphs.push_back(GraphShare{e->name, e->weight, e->tasks.load(), std::chrono::nanoseconds{e->busy.load()}});
+		return r;
+	}
+
+private:
+
+	void Worker(std::size_t index)
+	{
+		const std::size_t n = _graphs.size();
+		std::vector<std::int64_t> deficit(n, 0);
+		std::vector<std::uint64_t> tasks(n, 0);
+		std::vector<std::int64_t> busy(n, 0);
+		std::size_t cursor = index % n; // Workers start their rounds from different graphs
+		bool idle = false; // No task in the last round, the engines split their maps while some worker is idle
+
+		for (auto& e : _graphs)
+			e->engine->Attach(index);
+		while (true) {
+			bool ran = false;
+			for (std::size_t k = 0; k < n; ++k, cursor = (cursor+1) % n) {
+				Entry& e = *_graphs[cursor];
+				deficit[cursor] += std::max<std::int64_t>(1, static_cast<std::int64_t>(_quantum.count() * e.weight));
+				while (deficit[cursor] > 0) {
+					auto t0 = Clock::now();
+					if (!e.engine->TryRunOne(index)) {
+						deficit[cursor] = 0;
+						break;
+					}
+					if (idle) {
+						SetIdle(false);
+						idle = false;
+					}
+					std::int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t0).count();
+					deficit[cursor] -= ns;
+					busy[cursor] += ns;
+					tasks[cursor]++;
+					ran = true;
+				}
+			}
+			if (!ran) {
+				if (!idle) {
+					SetIdle(true);
+					idle = true;
+				}
+				bool finished = true;
+				for (auto& e : _graphs)
+					finished = finished && e->engine->Finished();
+				if (finished)
+					break;
+				std::this_thread::yield();
+			}
+		}
+
+		for (std::size_t k = 0; k < n; ++k) {
+			_graphs[k]->engine->Detach(index);
+			_graphs[k]->tasks += tasks[k];
+			_graphs[k]->busy += busy[k];
+		}
+	}
+
+	void SetIdle(bool idle)
+	{
+		for (auto& e : _graphs)
+			e->engine->SetIdle(idle);
+	}
+
+};
+
+// Prints the share of execution time of each graph against the share of its weight
+inline void PrintRuntime(const RuntimeReport& r)
+{
+	double totalWeight = 0;
+	std::int64_t totalBusy = 0;
+	for (auto& g : r.graphs) {
+		totalWeight += g.weight;
+		totalBusy += g.busy.count();
+	}
+	out.Println("Runtime: ", r.graphs.size(), " graphs on ", r.workers, " workers, ", r.elapsed.count() / 1e9, " s");
+	for (auto& g : r.graphs) {
+		out.Println("  ", g.name, ": weight ", g.weight / totalWeight, ", time ",
+				totalBusy > 0 ? static_cast<double>(g.busy.count()) / totalBusy : 0.0, ", ", g.tasks, " tasks, busy ",
+				g.busy.count() / 1e9, " s");
+	}
+}
+
+} // mdf namespace
+
+#endif
@@ -0,0 +1,339 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+#ifndef MDF_SIMULATOR_HPP
+#define MDF_SIMULATOR_HPP
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <chrono>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+
+#include "Mdf.hpp"
+#include "Statistics.hpp"
+#include "Latency.hpp"
+#include "Printer.hpp"
+
+namespace mdf {
+
+/*
+ * Offline scheduling simulator
+ * Predicts how a graph runs on a given number of workers from the cost of
+ * each node, without running it. Costs are either recorded by the engine
+ * (see CostProfile::FromStatistics) or given as hints. The simulator
+ * replays the scheduler of Mdf: instances are ingested into the global
+ * queue, every task that becomes fireable is queued on the worker that
+ * completed its last input, and idle workers take tasks from their own
+ * queue, then from the global queue, then steal from the others. Map
+ * instructions are not split and batch instructions run one instance at a
+ * time, so predictions for them are pessimistic.
+ */
+
+struct CostProfile {
+	std::vector<std::chrono::nanoseconds> nodes; // Cost of each node for one instance, indexed by NodeId
+	std::chrono::nanoseconds taskOverhead; // Scheduling cost added to every task
+	std::chrono::nanoseconds stealOverhead; // Added to stolen tasks
+	std::chrono::nanoseconds ingestion; // Cost of creating an instance on the ingestion thread
+
+	// Every node costs the same
+	static CostProfile Uniform(std::size_t numNodes, std::chrono::nanoseconds cost)
+	{
+		return CostProfile{std::vector<std::chrono::nanoseconds>(numNodes, cost), std::chrono::nanoseconds{0},
+				std::chrono::nanoseconds{0}, std::chrono::nanoseconds{0}};
+	}
+
+	/*
+	 * Costs recorded by an interpreter built with MDF_ENABLE_STATS after
+	 * running the given number of instances: the time spent in each node
+	 * divided by the instances, so map chunks and batches are accounted for
+	 */
+	static CostProfile FromStatistics(const EngineStatistics& s, std::size_t instances)
+	{
+		if (!s.enabled)
+			throw std::invalid_argument("CostProfile::FromStatistics: statistics are disabled (define MDF_ENABLE_STATS)");
+		CostProfile p = Uniform(s.nodes.size(), std::chrono::nanoseconds{0});
+		for (NodeId id = 0; id < s.nodes.size(); ++id) {
+			std::size_t n = instances > 0 ? instances : s.nodes[id].executions;
+			if (n > 0)
+				p.nodes[id] = s.nodes[id].latency.total / static_cast<std::int64_t>(n);
+		}
+		return p;
+	}
+};
+
+// Work and span of one instance of a graph
+struct GraphAnalysis {
+	std::chrono::nanoseconds work; // Sum of the node costs
+	std::chrono::nanoseconds span; // Cost of the critical path, a lower bound of the latency of an instance
+	double parallelism; // work / span, an upper bound of the speedup on a single instance
+	std::vector<NodeId> criticalPath; // From an entry node to an exit node
+};
+
+enum class SimPolicy {
+	WorkStealing, // The scheduler of Mdf: FIFO local queues, global queue, stealing
+	LifoWorkStealing, // Workers take the newest task of their own queue, steal the oldest
+	SharedQueue // Every task goes through the global queue
+};
+
+inline const char *SimPolicyName(SimPolicy p)
+{
+	switch (p) {
+	case SimPolicy::LifoWorkStealing: return "lifo-work-stealing";
+	case SimPolicy::SharedQueue: return "shared-queue";
+	default: return "work-stealing";
+	}
+}
+
+struct SimulationConfig {
+	std::size_t workers;
+	std::size_t instances;
+	std::chrono::nanoseconds arrivalInterval; // Between instances, 0 streams them as fast as they are accepted
+	SimPolicy policy;
+	std::size_t queueCapacity; // Global queue size that blocks ingestion, 0 for unbounded
+};
+
+struct SimulationResult {
+	std::size_t workers;
+	SimPolicy policy;
+	std::chrono::nanoseconds makespan; // From the first ingestion to the last completion
+	double throughput; // Instances per second
+	double utilization; // Fraction of the worker time spent on tasks
+	std::size_t stolenTasks;
+	LatencyDistribution latency; // From the ingestion to the completion of each instance
+};
+
+namespace detail {
+
+/*
+ * Predecessor counts and successors of every node, with the topological
+ * order and the exit node computed by Graph::Finalize (on a copy, the
+ * analysis of a finalized graph is shared and not computed again)
+ */
+struct GraphShape {
+	std::vector<std::vector<NodeId>> successors;
+	std::vector<unsigned> predecessors;
+	std::vector<NodeId> order;
+	std::vector<NodeId> entries;
+	NodeId exit;
+
+	explicit GraphShape(const Graph& g) : successors(g.N()), predecessors(g.N(), 0), order{}, entries{}, exit{0}
+	{
+		Graph checked{g};
+		checked.Finalize();
+		for (NodeId id = 0; id < g.N(); ++id) {
+			successors[id] = g.GetNode(id)->Successors();
+			for (NodeId s : successors[id])
+				predecessors[s]++;
+		}
+		order = checked.TopologicalOrder();
+		for (NodeId id : order)
+			if (checked.Depth(id) == 0) entries.push_back(id);
+		exit = checked.ExitNode();
+	}
+};
+
+} // detail namespace
+
+inline GraphAnalysis AnalyzeGraph(const Graph& g, const CostProfile& profile)
+{
+	if (profile.nodes.size() != g.N())
+		throw std::invalid_argument("mdf::AnalyzeGraph: the profile does not match the graph");
+	detail::GraphShape shape{g};
+
+	// Earliest start and finish of each node with unlimited workers
+	std::vector<std::chrono::nanoseconds> start(g.N(), std::chrono::nanoseconds{0});
+	std::vector<std::chrono::nanoseconds> finish(g.N(), std::chrono::nanoseconds{0});
+	std::vector<NodeId> parent(g.N(), g.N()); // Predecessor that finishes last
+	GraphAnalysis a{std::chrono::nanoseconds{0}, std::chrono::nanoseconds{0}, 0, std::vector<NodeId>{}};
+	for (NodeId id : shape.order) {
+		finish[id] = start[id] + profile.nodes[id];
+		a.work += profile.nodes[id];
+		for (NodeId s : shape.successors[id]) {
+			if (parent[s] == g.N() || finish[id] > start[s]) {
+				start[s] = finish[id];
+				parent[s] = id;
+			}
+		}
+	}
+	// Every node reaches the exit, which finishes last
+	for (NodeId id = shape.exit; id != g.N(); id = parent[id])
+		a.criticalPath.insert(a.criticalPath.begin(), id);
+	a.span = finish[shape.exit];
+	a.parallelism = a.span.count() > 0 ? static_cast<double>(a.work.count()) / a.span.count() : 0;
+	return a;
+}
+
+inline SimulationResult Simulate(const Graph& g, const CostProfile& profile, const SimulationConfig& config)
+{
+	using Time = std::int64_t; // Nanoseconds
+
+	struct Task {
+		std::size_t instance;
+		NodeId node;
+	};
+
+	if (profile.nodes.size() != g.N())
+		throw std::invalid_argument("mdf::Simulate: the profile does not match the graph");
+	if (config.workers == 0 || config.instances == 0 || g.N() == 0)
+		throw std::invalid_argument("mdf::Simulate: no workers, instances or nodes");
+
+	detail::GraphShape shape{g};
+	const std::size_t tn = config.workers;
+	const Time never = std::numeric_limits<Time>::max();
+
+	std::vector<std::vector<unsigned>> missing(config.instances); // Created on ingestion
+	std::vector<std::size_t> remaining(config.instances, g.N());
+	std::vector<Time> ingested(config.instances, 0);
+
+	std::deque<Task> global;
+	std::vector<std::deque<Task>> local(tn);
+	std::vector<Task> running(tn);
+	std::vector<Time> busyUntil(tn, never); // never if idle
+
+	LatencyHistogram latency;
+	std::size_t next = 0, completed = 0, stolen = 0;
+	Time now = 0, lastIngestion = -profile.ingestion.count(), busy = 0, end = 0;
+
+	auto push = [&](std::size_t w, const Task& t) {
+		if (config.policy == SimPolicy::SharedQueue) global.push_back(t);
+		else local[w].push_back(t);
+	};
+
+	while (completed < config.instances) {
+		// Completions
+		for (std::size_t w = 0; w < tn; ++w) {
+			if (busyUntil[w] > now) continue;
+			Task t = running[w];
+			busyUntil[w] = never;
+			for (NodeId s : shape.successors[t.node]) {
+				if (--missing[t.instance][s] == 0) push(w, Task{t.instance, s});
+			}
+			if (--remaining[t.instance] == 0) {
+				latency.Record(now - ingested[t.instance]);
+				missing[t.instance].clear();
+				missing[t.instance].shrink_to_fit();
+				++completed;
+				end = now;
+			}
+		}
+
+		// Ingestion, blocked while the global queue is full
+		Time nextArrival = never;
+		while (next < config.instances) {
+			Time arrival = std::max<Time>(next * config.arrivalInterval.count(), lastIngestion + profile.ingestion.count());
+			if (arrival > now) {
+				nextArrival = arrival;
+				break;
+			}
+			if (config.queueCapacity > 0 && global.size() >= config.queueCapacity)
+				break;
+			missing[next] = shape.predecessors;
+			ingested[next] = now;
+			lastIngestion = now;
+			for (NodeId id : shape.entries)
+				global.push_back(Task{next, id});
+			++next;
+		}
+
+		// Idle workers take a task: local queue, global queue, steal
+		for (std::size_t w = 0; w < tn; ++w) {
+			if (busyUntil[w] != never) continue;
+			Task t;
+			bool found = false, steal = false;
+			if (!local[w].empty()) {
+				if (config.policy == SimPolicy::LifoWorkStealing) {
+					t = local[w].back();
+					local[w].pop_back();
+				} else {
+					t = local[w].front();
+					local[w].pop_front();
+				}
+				found = true;
+			} else if (!global.empty()) {
+				t = global.front();
+				global.pop_front();
+				found = true;
+			} else {
+				for (std::size_t i = 0; i < tn && !found; ++i) {
+					std::deque<Task>& victim = local[(w+i+1)%tn];
+					if (!victim.empty()) {
+						t = victim.front();
+						victim.pop_front();
+						found = steal = true;
+					}
+				}
+			}
+			if (found) {
+				Time cost = profile.nodes[t.node].count() + profile.taskOverhead.count()
+						+ (steal ? profile.stealOverhead.count() : 0);
+				running[w] = t;
+				busyUntil[w] = now + cost;
+				busy += cost;
+				stolen += steal ? 1 : 0;
+			}
+		}
+
+		// Next event
+		Time t = nextArrival;
+		for (std::size_t w = 0; w < tn; ++w)
+			t = std::min(t, busyUntil[w]);
+		if (t == never) {
+			if (completed < config.instances)
+				throw std::logic_error("mdf::Simulate: the simulation stalled");
+			break;
+		}
+		now = std::max(now, t);
+	}
+
+	double seconds = end / 1e9;
+	return SimulationResult{tn, config.policy, std::chrono::nanoseconds{end},
+			seconds > 0 ? config.instances / seconds : 0,
+			end > 0 ? static_cast<double>(busy) / (static_cast<double>(end) * tn) : 0,
+			stolen, latency.Snapshot()};
+}
+
+// Simulates the stream with each number of workers
+inline std::vector<SimulationResult> PredictScaling(const Graph& g, const CostProfile& profile, SimulationConfig config,
+		const std::vector<std::size_t>& workers)
+{
+	std::vector<SimulationResult> results;
+	for (std::size_t tn : workers) {
+		config.workers = tn;
+		results.push_back(Simulate(g, profile, config));
+	}
+	return results;
+}
+
+inline void PrintAnalysis(const GraphAnalysis& a, const Graph& g)
+{
+	std::string path;
+	for (NodeId id : a.criticalPath)
+		path += (path.empty() ? "" : " -> ") + g.Label(id);
+	out.Println("Work ", a.work.count() / 1000.0, " us, span ", a.span.count() / 1000.0, " us, parallelism ", a.parallelism);
+	out.Println("Critical path: ", path);
+}
+
+// Speedup is relative to the first result
+inline void PrintSimulation(const std::vector<SimulationResult>& results)
+{
+	for (auto& r : results) {
+		out.Println(SimPolicyName(r.policy), " ", r.workers, " workers: ", r.throughput, " instances/s, speedup ",
+				r.throughput / results.front().throughput, ", utilization ", r.utilization,
+				", latency p50 ", r.latency.Percentile(0.5).count() / 1000.0, " us, p99 ",
+				r.latency.Percentile(0.99).count() / 1000.0, " us, stolen tasks ", r.stolenTasks);
+	}
+}
+
+} // mdf namespace
+
+#endif
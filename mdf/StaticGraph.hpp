@@ -0,0 +1,241 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+#ifndef MDF_STATIC_GRAPH_HPP
+#define MDF_STATIC_GRAPH_HPP
+
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace mdf {
+
+/*
+ * Compile-time typed graphs
+ * The topology of a StaticGraph is entirely encoded in its type: each
+ * instruction declares where its parameters come from with a list of ports,
+ * either Input<K> (the K-th element of the tuple produced by the streamer)
+ * or From<J> (the result of the J-th instruction of the graph). Since an
+ * instruction can only refer to previously declared instructions the graph
+ * is acyclic by construction, and the last instruction is its exit node.
+ * Every connection is checked against the parameter types of the callable,
+ * so a mismatched connection is a compile time error.
+ */
+
+template<typename... T> struct StreamTypes { };
+
+template<std::size_t K> struct Input { };
+template<std::size_t J> struct From { };
+
+namespace detail {
+
+template<std::size_t... I> struct IndexSequence { };
+
+template<std::size_t N, std::size_t... I> struct MakeIndexSequence : MakeIndexSequence<N-1, N-1, I...> { };
+
+template<std::size_t... I> struct MakeIndexSequence<0, I...>
+{
+	using Type = IndexSequence<I...>;
+};
+
+/*
+ * Result and parameter types of a callable (functions, function pointers,
+ * lambdas and other non-overloaded function objects)
+ */
+template<typename F> struct FunctionTraits : FunctionTraits<decltype(&F::operator())> { };
+
+template<typename R, typename... A> struct FunctionTraits<R(A...)>
+{
+	using Result = typename std::decay<R>::type;
+	using Params = std::tuple<typename std::decay<A>::type...>;
+};
+
+template<typename R, typename... A> struct FunctionTraits<R(*)(A...)> : FunctionTraits<R(A...)> { };
+template<typename C, typename R, typename... A> struct FunctionTraits<R(C::*)(A...)> : FunctionTraits<R(A...)> { };
+template<typename C, typename R, typename... A> struct FunctionTraits<R(C::*)(A...) const> : FunctionTraits<R(A...)> { };
+
+template<typename Port> struct IsInputPort : std::false_type { };
+template<std::size_t K> struct IsInputPort<Input<K>> : std::true_type { };
+
+template<typename Port> struct IsFromPort : std::false_type { };
+template<std::size_t J> struct IsFromPort<From<J>> : std::true_type { };
+
+// Number of ports in the list that refer to the output of instruction J
+template<std::size_t J, typename... Ports> struct CountFrom;
+
+template<std::size_t J> struct CountFrom<J>
+{
+	static constexpr unsigned value = 0;
+};
+
+template<std::size_t J, typename P, typename... Ports> struct CountFrom<J, P, Ports...>
+{
+	static constexpr unsigned value = (std::is_same<P, From<J>>::value ? 1 : 0) + CountFrom<J, Ports...>::value;
+};
+
+template<typename... Ports> struct CountFromPorts;
+
+template<> struct CountFromPorts<>
+{
+	static constexpr unsigned value = 0;
+};
+
+template<typename P, typename... Ports> struct CountFromPorts<P, Ports...>
+{
+	static constexpr unsigned value = (IsFromPort<P>::value ? 1 : 0) + CountFromPorts<Ports...>::value;
+};
+
+} // detail namespace
+
+template<typename F, typename... Ports>
+class StaticInstruction {
+
+	static_assert(sizeof...(Ports) == std::tuple_size<typename detail::FunctionTraits<F>::Params>::value,
+			"mdf::StaticInstruction: the number of ports does not match the arity of the instruction");
+
+public:
+
+	using Function = F;
+	using Result = typename detail::FunctionTraits<F>::Result;
+	using Params = typename detail::FunctionTraits<F>::Params;
+	using PortList = std::tuple<Ports...>;
+
+	static_assert(!std::is_void<Result>::value, "mdf::StaticInstruction: instructions must return a value");
+
+	// Number of incoming connections from other instructions
+	static constexpr unsigned numFromPorts = detail::CountFromPorts<Ports...>::value;
+
+	// Number of ports connected to the result of instruction J
+	template<std::size_t J> struct Uses
+	{
+		static constexpr unsigned value = detail::CountFrom<J, Ports...>::value;
+	};
+
+	F fct;
+
+	explicit StaticInstruction(F f) : fct(f) { }
+
+};
+
+template<typename F, typename... Ports>
+StaticInstruction<F, Ports...> MakeStaticInstruction(F f, Ports...)
+{
+	return StaticInstruction<F, Ports...>{f};
+}
+
+namespace detail {
+
+template<typename Streams, typename Nodes, std::size_t I, typename Port> struct PortType;
+
+template<typename... S, typename Nodes, std::size_t I, std::size_t K>
+struct PortType<std::tuple<S...>, Nodes, I, Input<K>>
+{
+	static_assert(K < sizeof...(S), "mdf::StaticGraph: Input<K> refers to a missing stream element");
+	using Type = typename std::tuple_element<K, std::tuple<S...>>::type;
+};
+
+template<typename Streams, typename Nodes, std::size_t I, std::size_t J>
+struct PortType<Streams, Nodes, I, From<J>>
+{
+	static_assert(J < I, "mdf::StaticGraph: From<J> must refer to a previously declared instruction");
+	using Type = typename std::tuple_element<J, Nodes>::type::Result;
+};
+
+// Checks the connections of the P-th parameter onwards of instruction I
+template<typename Streams, typename Nodes, std::size_t I, std::size_t P = 0,
+	bool Done = (P == std::tuple_size<typename std::tuple_element<I, Nodes>::type::Params>::value)>
+struct CheckPorts
+{
+	using Node = typename std::tuple_element<I, Nodes>::type;
+	using Param = typename std::tuple_element<P, typename Node::Params>::type;
+	using Source = typename PortType<Streams, Nodes, I, typename std::tuple_element<P, typename Node::PortList>::type>::Type;
+
+	static_assert(std::is_same<Param, Source>::value,
+			"mdf::StaticGraph: Connect type mismatch, the source type differs from the parameter type");
+
+	static constexpr bool value = CheckPorts<Streams, Nodes, I, P+1>::value;
+};
+
+template<typename Streams, typename Nodes, std::size_t I, std::size_t P>
+struct CheckPorts<Streams, Nodes, I, P, true>
+{
+	static constexpr bool value = true;
+};
+
+// Number of ports of instructions J, J+1, ... that use the result of instruction I
+template<typename Nodes, std::size_t I, std::size_t J = I+1, bool Done = (J == std::tuple_size<Nodes>::value)>
+struct CountUses
+{
+	static constexpr unsigned value = std::tuple_element<J, Nodes>::type::template Uses<I>::value
+			+ CountUses<Nodes, I, J+1>::value;
+};
+
+template<typename Nodes, std::size_t I, std::size_t J>
+struct CountUses<Nodes, I, J, true>
+{
+	static constexpr unsigned value = 0;
+};
+
+// Checks every instruction, and that only the last one has unused results
+template<typename Streams, typename Nodes, std::size_t I = 0, bool Done = (I == std::tuple_size<Nodes>::value)>
+struct CheckGraph
+{
+	static_assert(CheckPorts<Streams, Nodes, I>::value, "");
+	static_assert(I+1 == std::tuple_size<Nodes>::value || CountUses<Nodes, I>::value > 0,
+			"mdf::StaticGraph: only the last instruction can be an exit node");
+
+	static constexpr bool value = CheckGraph<Streams, Nodes, I+1>::value;
+};
+
+template<typename Streams, typename Nodes, std::size_t I>
+struct CheckGraph<Streams, Nodes, I, true>
+{
+	static constexpr bool value = true;
+};
+
+} // detail namespace
+
+template<typename Streams, typename... Nodes> class StaticGraph;
+
+template<typename... S, typename... Nodes>
+class StaticGraph<StreamTypes<S...>, Nodes...> {
+
+public:
+
+	using Inputs = std::tuple<S...>;
+	using NodeList = std::tuple<Nodes...>;
+	using Results = std::tuple<typename Nodes::Result...>;
+	using Result = typename std::tuple_element<sizeof...(Nodes)-1, Results>::type;
+
+	static constexpr std::size_t N = sizeof...(Nodes);
+
+	static_assert(N > 0, "mdf::StaticGraph: the graph must contain at least one instruction");
+	static_assert(detail::CheckGraph<Inputs, NodeList>::value, "");
+
+	NodeList nodes;
+
+	explicit StaticGraph(Nodes... n) : nodes{n...} { }
+
+	template<std::size_t I> const typename std::tuple_element<I, NodeList>::type& Get() const
+	{
+		return std::get<I>(nodes);
+	}
+
+};
+
+template<typename... S, typename... Nodes>
+StaticGraph<StreamTypes<S...>, Nodes...> MakeStaticGraph(StreamTypes<S...>, Nodes... nodes)
+{
+	return StaticGraph<StreamTypes<S...>, Nodes...>{nodes...};
+}
+
+} // mdf namespace
+
+#endif
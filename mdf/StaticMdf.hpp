@@ -0,0 +1,296 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+#ifndef MDF_STATIC_MDF_HPP
+#define MDF_STATIC_MDF_HPP
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <cassert>
+
+#include "StaticGraph.hpp"
+#include "ConcurrentQueue.hpp"
+#include "Printer.hpp"
+
+namespace mdf {
+
+/*
+ * Interpreter for StaticGraph models
+ * The scheduling policy is the same of mdf::Mdf, but since the topology is
+ * known at compile time the state of an instance is a plain struct (the
+ * stream tuple, the tuple of results and one counter of missing inputs per
+ * instruction) and both the execution of an instruction and the propagation
+ * of its result are generated for each node, without virtual calls or
+ * type erased tokens.
+ * Streamers define a 'bool Next(std::tuple<S...>& item)' method that returns
+ * false at the end of the stream, drainers are invoked on the typed result
+ * of the exit node.
+ */
+template<typename G, typename D>
+class StaticMdf {
+
+private:
+
+	using Graph = G;
+
+	struct Instance {
+		const std::size_t instanceId;
+		typename Graph::Inputs inputs;
+		typename Graph::Results results;
+		std::atomic<unsigned> pending[Graph::N];
+
+		Instance(std::size_t iid) : instanceId{iid}, inputs{}, results{} { }
+	};
+
+	struct TaskData {
+		std::shared_ptr<Instance> inst;
+		std::size_t id;
+	};
+
+	using TaskQueue = mdf::ConcurrentQueue<TaskData>;
+
+	const Graph _model;
+
+	std::size_t _tn; // Number of active threads
+	TaskQueue _tasks;
+	std::vector<std::thread> _threads;
+	std::vector<std::unique_ptr<TaskQueue>> _localTasks;
+
+	std::atomic<long> _numInstances; // Number of active graph instances
+	std::atomic<bool> _endOfStream;
+
+	std::unique_ptr<D> _drainer;
+	std::mutex _drainerMutex;
+
+public:
+
+	StaticMdf(const Graph& model, std::size_t tn, std::unique_ptr<D> drainer);
+	StaticMdf(const StaticMdf& other) = delete;
+	StaticMdf& operator=(const StaticMdf& other) = delete;
+
+	template<typename S>
+		std::unique_ptr<S> Start(std::unique_ptr<S> streamer);
+
+private:
+
+	void Worker(std::size_t index);
+	bool Steal(TaskData& t, std::size_t shuffle);
+
+	template<std::size_t I, bool Last = (I+1 == Graph::N)> struct Node;
+	template<std::size_t I, bool Done = (I == Graph::N)> struct Dispatch;
+	template<std::size_t I, std::size_t J = I+1, bool Done = (J == Graph::N)> struct Notify;
+	template<std::size_t I, bool Done = (I == Graph::N)> struct Init;
+
+	// Reads the value bound to a port of an instance
+	template<std::size_t K> static const typename std::tuple_element<K, typename Graph::Inputs>::type&
+		Fetch(const Instance& inst, Input<K>) { return std::get<K>(inst.inputs); }
+
+	template<std::size_t J> static const typename std::tuple_element<J, typename Graph::Results>::type&
+		Fetch(const Instance& inst, From<J>) { return std::get<J>(inst.results); }
+
+	template<typename N, std::size_t... P>
+	static typename N::Result Call(const N& node, const Instance& inst, detail::IndexSequence<P...>)
+	{
+		return node.fct(Fetch(inst, typename std::tuple_element<P, typename N::PortList>::type{})...);
+	}
+
+};
+
+// Executes instruction I and propagates its result
+template<typename G, typename D> template<std::size_t I, bool Last>
+struct StaticMdf<G,D>::Node {
+
+	using Instr = typename std::tuple_element<I, typename G::NodeList>::type;
+
+	static void Run(StaticMdf& engine, const TaskData& t, TaskQueue& queue)
+	{
+		const Instr& node = engine._model.template Get<I>();
+		std::get<I>(t.inst->results) = Call(node, *t.inst,
+				typename detail::MakeIndexSequence<std::tuple_size<typename Instr::PortList>::value>::Type{});
+		Notify<I>::Run(t, queue);
+	}
+
+};
+
+template<typename G, typename D> template<std::size_t I>
+struct StaticMdf<G,D>::Node<I, true> {
+
+	using Instr = typename std::tuple_element<I, typename G::NodeList>::type;
+
+	static void Run(StaticMdf& engine, const TaskData& t, TaskQueue&)
+	{
+		const Instr& node = engine._model.template Get<I>();
+		typename Instr::Result res = Call(node, *t.inst,
+				typename detail::MakeIndexSequence<std::tuple_size<typename Instr::PortList>::value>::Type{});
+		{
+			std::lock_guard<std::mutex> lock{engine._drainerMutex};
+			(*engine._drainer)(res);
+		}
+		long n = --engine._numInstances;
+		assert(n >= 0);
+	}
+
+};
+
+// Decrements the counters of the successors J, J+1, ... of instruction I
+template<typename G, typename D> template<std::size_t I, std::size_t J, bool Done>
+struct StaticMdf<G,D>::Notify {
+
+	static void Run(const TaskData& t, TaskQueue& queue)
+	{
+		constexpr unsigned uses = std::tuple_element<J, typename G::NodeList>::type::template Uses<I>::value;
+		if (uses > 0 && t.inst->pending[J].fetch_sub(uses) == uses)
+			queue.Put(TaskData{t.inst, J});
+		Notify<I, J+1>::Run(t, queue);
+	}
+
+};
+
+template<typename G, typename D> template<std::size_t I, std::size_t J>
+struct StaticMdf<G,D>::Notify<I, J, true> {
+
+	static void Run(const TaskData&, TaskQueue&) { }
+
+};
+
+template<typename G, typename D> template<std::size_t I, bool Done>
+struct StaticMdf<G,D>::Dispatch {
+
+	static void Run(StaticMdf& engine, const TaskData& t, TaskQueue& queue)
+	{
+		if (t.id == I)
+			Node<I>::Run(engine, t, queue);
+		else
+			Dispatch<I+1>::Run(engine, t, queue);
+	}
+
+};
+
+template<typename G, typename D> template<std::size_t I>
+struct StaticMdf<G,D>::Dispatch<I, true> {
+
+	static void Run(StaticMdf&, const TaskData&, TaskQueue&) { assert(false); }
+
+};
+
+// Sets up the counters of a new instance and schedules its entry nodes. Every
+// counter is stored before the first entry node is put, so that no worker can
+// decrement a counter that has not been initialized yet
+template<typename G, typename D> template<std::size_t I, bool Done>
+struct StaticMdf<G,D>::Init {
+
+	static void Run(const std::shared_ptr<Instance>& inst, TaskQueue& queue)
+	{
+		constexpr unsigned deps = std::tuple_element<I, typename G::NodeList>::type::numFromPorts;
+		inst->pending[I].store(deps, std::memory_order_relaxed);
+		Init<I+1>::Run(inst, queue);
+		if (deps == 0)
+			queue.Put(TaskData{inst, I});
+	}
+
+};
+
+template<typename G, typename D> template<std::size_t I>
+struct StaticMdf<G,D>::Init<I, true> {
+
+	static void Run(const std::shared_ptr<Instance>&, TaskQueue&) { }
+
+};
+
+template<typename G, typename D>
+inline StaticMdf<G,D>::StaticMdf(const Graph& model, std::size_t tn, std::unique_ptr<D> drainer)
+		: _model(model),
+		  _tn{tn},
+		  _tasks{100},
+		  _threads{},
+		  _localTasks{},
+		  _numInstances{0},
+		  _endOfStream{true},
+		  _drainer{std::move(drainer)},
+		  _drainerMutex{}
+{
+	_threads.reserve(_tn);
+	_localTasks.reserve(_tn);
+
+	for (std::size_t i = 0; i < _tn; ++i) {
+		_localTasks.emplace_back(std::unique_ptr<TaskQueue>(new TaskQueue{}));
+	}
+}
+
+template<typename G, typename D> template<typename S>
+inline std::unique_ptr<S> StaticMdf<G,D>::Start(std::unique_ptr<S> streamer)
+{
+	_endOfStream = false;
+
+	out.Println("Starting threads...");
+
+	for (std::size_t i = 0; i < _tn; ++i) {
+		_threads.emplace_back(std::thread{&StaticMdf::Worker, this, i});
+	}
+
+	std::size_t count = 0;
+
+	while (!_endOfStream) {
+		std::shared_ptr<Instance> inst = std::make_shared<Instance>(count);
+		if (streamer->Next(inst->inputs)) {
+			++count;
+			++_numInstances;
+			Init<0>::Run(inst, _tasks);
+		} else {
+			_endOfStream = true;
+		}
+	}
+
+	out.Println("Joining threads...");
+
+	for (std::size_t i = 0; i < _tn; ++i) {
+		if (_threads[i].joinable()) _threads[i].join();
+	}
+	_threads.clear();
+
+	out.Println("Finished.");
+
+	return streamer;
+}
+
+template<typename G, typename D>
+inline bool StaticMdf<G,D>::Steal(TaskData& t, std::size_t shuffle)
+{
+	for (std::size_t i = 0; i < _tn; ++i) {
+		std::size_t idx = (shuffle+i+1)%_tn;
+		if (_localTasks[idx]->Get(t)) return true;
+	}
+	return false;
+}
+
+template<typename G, typename D>
+inline void StaticMdf<G,D>::Worker(std::size_t index)
+{
+	out.Println("Worker running with index ", index);
+	TaskQueue& localTasks = *_localTasks[index];
+	TaskData t;
+	while (true) {
+		if (localTasks.Get(t) || _tasks.Get(t) || Steal(t, index)) {
+			Dispatch<0>::Run(*this, t, localTasks);
+			t.inst.reset();
+		} else {
+			if (!_endOfStream || _numInstances > 0) {
+				std::this_thread::yield();
+			}
+			else return;
+		}
+	}
+}
+
+} // mdf namespace
+
+#endif
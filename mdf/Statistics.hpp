@@ -0,0 +1,278 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+#ifndef MDF_STATISTICS_HPP
+#define MDF_STATISTICS_HPP
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "Graph.hpp"
+#include "Printer.hpp"
+
+namespace mdf {
+
+/*
+ * Runtime statistics of an interpreter
+ * Collection is compiled in only when MDF_ENABLE_STATS is defined, otherwise
+ * every hook of the interpreter is an empty inline function and snapshots
+ * are empty. Each worker updates its own counters, which are merged when a
+ * snapshot is taken, so snapshots can be taken while the interpreter runs
+ * (counters are read individually, a snapshot is not an atomic cut).
+ */
+
+// Histogram of durations, bucket i counts durations in [2^i, 2^(i+1)) ns
+struct DurationHistogram {
+
+	static constexpr unsigned NumBuckets = 40;
+
+	std::uint64_t buckets[NumBuckets];
+	std::uint64_t count;
+	std::chrono::nanoseconds total;
+
+	DurationHistogram() : buckets{}, count{0}, total{0} { }
+
+	static unsigned BucketOf(std::uint64_t ns)
+	{
+		unsigned b = 0;
+		while (ns > 1 && b < NumBuckets-1) {
+			ns >>= 1;
+			++b;
+		}
+		return b;
+	}
+
+	std::chrono::nanoseconds Mean() const
+	{
+		return count > 0 ? total / static_cast<std::int64_t>(count) : std::chrono::nanoseconds{0};
+	}
+
+	// Upper bound of the bucket holding the p-th quantile, 0 <= p <= 1
+	std::chrono::nanoseconds Quantile(double p) const
+	{
+		std::uint64_t rank = static_cast<std::uint64_t>(p * count);
+		std::uint64_t seen = 0;
+		for (unsigned b = 0; b < NumBuckets; ++b) {
+			seen += buckets[b];
+			if (seen > rank || (seen == count && count > 0))
+				return std::chrono::nanoseconds{std::int64_t{2} << b};
+		}
+		return std::chrono::nanoseconds{0};
+	}
+
+};
+
+struct NodeStatistics {
+	std::uint64_t executions; // Batch tasks count each of their instances, map instructions each chunk
+	DurationHistogram latency; // Per task: one instance, one batch or one map chunk
+};
+
+struct WorkerStatistics {
+	std::chrono::nanoseconds busy;
+	std::chrono::nanoseconds idle;
+	std::uint64_t localTasks;
+	std::uint64_t globalTasks;
+	std::uint64_t stolenTasks;
+	std::uint64_t flushedBatches;
+	std::uint64_t failedSteals; // Steal attempts that found every other queue empty
+	std::size_t queueHighWater; // Largest size of the local queue
+};
+
+struct EngineStatistics {
+	bool enabled;
+	long instancesInFlight;
+	long peakInstancesInFlight;
+	std::size_t globalQueueHighWater;
+	std::vector<WorkerStatistics> workers;
+	std::vector<NodeStatistics> nodes; // Indexed by NodeId
+};
+
+inline void PrintStatistics(const EngineStatistics& s)
+{
+	if (!s.enabled) {
+		out.Println("Statistics disabled (define MDF_ENABLE_STATS).");
+		return;
+	}
+	out.Println("Instances in flight: ", s.instancesInFlight, " (peak ", s.peakInstancesInFlight,
+			"), global queue high-water: ", s.globalQueueHighWater);
+	for (std::size_t i = 0; i < s.workers.size(); ++i) {
+		const WorkerStatistics& w = s.workers[i];
+		out.Println("Worker ", i, ": busy ", w.busy.count() / 1000000, " ms, idle ", w.idle.count() / 1000000,
+				" ms, tasks local/global/stolen ", w.localTasks, "/", w.globalTasks, "/", w.stolenTasks,
+				", flushed batches ", w.flushedBatches, ", failed steals ", w.failedSteals, ", queue high-water ", w.queueHighWater);
+	}
+	for (NodeId id = 0; id < s.nodes.size(); ++id) {
+		const NodeStatistics& n = s.nodes[id];
+		if (n.executions == 0) continue;
+		out.Println("Node ", id, ": ", n.executions, " executions, ", n.latency.count, " tasks, mean ", n.latency.Mean().count(),
+				" ns, p50 < ", n.latency.Quantile(0.5).count(), " ns, p99 < ", n.latency.Quantile(0.99).count(), " ns");
+	}
+}
+
+namespace detail {
+
+enum class TaskSource { Local, Global, Stolen, Flushed };
+
+#ifdef MDF_ENABLE_STATS
+
+/*
+ * Counters written by a single thread, relaxed loads and stores are enough
+ * for them to be read concurrently by a snapshot
+ */
+inline void Bump(std::atomic<std::uint64_t>& c, std::uint64_t v = 1)
+{
+	c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+}
+
+class StatsCollector {
+
+public:
+
+	using Stamp = std::chrono::steady_clock::time_point;
+
+private:
+
+	struct NodeCounters {
+		std::atomic<std::uint64_t> executions;
+		std::atomic<std::uint64_t> tasks;
+		std::atomic<std::uint64_t> total;
+		std::atomic<std::uint64_t> buckets[DurationHistogram::NumBuckets];
+
+		NodeCounters() : executions{0}, tasks{0}, total{0}
+		{
+			for (auto& b : buckets) b.store(0, std::memory_order_relaxed);
+		}
+	};
+
+	struct WorkerCounters {
+		std::atomic<std::uint64_t> busy;
+		std::atomic<std::uint64_t> idle;
+		std::atomic<std::uint64_t> tasks[4]; // Indexed by TaskSource
+		std::atomic<std::uint64_t> failedSteals;
+		std::unique_ptr<NodeCounters[]> nodes;
+		char pad[64]; // Keeps the counters of different workers on different cache lines
+
+		WorkerCounters() : busy{0}, idle{0}, failedSteals{0}, nodes{}
+		{
+			for (auto& t : tasks) t.store(0, std::memory_order_relaxed);
+		}
+	};
+
+	const std::size_t _numNodes;
+	std::unique_ptr<WorkerCounters[]> _workers;
+	std::atomic<long> _peakInstances;
+
+public:
+
+	StatsCollector(std::size_t tn, std::size_t numNodes)
+			: _numNodes{numNodes}, _workers{new WorkerCounters[tn]}, _peakInstances{0}
+	{
+		for (std::size_t i = 0; i < tn; ++i)
+			_workers[i].nodes.reset(new NodeCounters[numNodes]);
+	}
+
+	static Stamp Now() { return std::chrono::steady_clock::now(); }
+
+	static std::uint64_t Since(Stamp t0)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(Now() - t0).count();
+	}
+
+	void Task(std::size_t worker, TaskSource source, Stamp t0)
+	{
+		Bump(_workers[worker].tasks[static_cast<unsigned>(source)]);
+		Bump(_workers[worker].busy, Since(t0));
+	}
+
+	void Idle(std::size_t worker, Stamp t0) { Bump(_workers[worker].idle, Since(t0)); }
+
+	void FailedSteal(std::size_t worker) { Bump(_workers[worker].failedSteals); }
+
+	void Executed(std::size_t worker, NodeId id, std::size_t instances, Stamp t0)
+	{
+		std::uint64_t ns = Since(t0);
+		NodeCounters& n = _workers[worker].nodes[id];
+		Bump(n.executions, instances);
+		Bump(n.tasks);
+		Bump(n.total, ns);
+		Bump(n.buckets[DurationHistogram::BucketOf(ns)]);
+	}
+
+	void InFlight(long n)
+	{
+		long peak = _peakInstances.load(std::memory_order_relaxed);
+		while (n > peak && !_peakInstances.compare_exchange_weak(peak, n, std::memory_order_relaxed))
+			;
+	}
+
+	// Merges the counters of the workers, queue sizes are filled in by the interpreter
+	EngineStatistics Snapshot(std::size_t tn, long inFlight) const
+	{
+		EngineStatistics s{true, inFlight, _peakInstances.load(std::memory_order_relaxed), 0,
+				std::vector<WorkerStatistics>(tn), std::vector<NodeStatistics>(_numNodes)};
+		for (std::size_t i = 0; i < tn; ++i) {
+			const WorkerCounters& w = _workers[i];
+			s.workers[i] = WorkerStatistics{
+					std::chrono::nanoseconds{w.busy.load(std::memory_order_relaxed)},
+					std::chrono::nanoseconds{w.idle.load(std::memory_order_relaxed)},
+					w.tasks[static_cast<unsigned>(TaskSource::Local)].load(std::memory_order_relaxed),
+					w.tasks[static_cast<unsigned>(TaskSource::Global)].load(std::memory_order_relaxed),
+					w.tasks[static_cast<unsigned>(TaskSource::Stolen)].load(std::memory_order_relaxed),
+					w.tasks[static_cast<unsigned>(TaskSource::Flushed)].load(std::memory_order_relaxed),
+					w.failedSteals.load(std::memory_order_relaxed), 0};
+			for (NodeId id = 0; id < _numNodes; ++id) {
+				const NodeCounters& n = w.nodes[id];
+				NodeStatistics& ns = s.nodes[id];
+				ns.executions += n.executions.load(std::memory_order_relaxed);
+				ns.latency.count += n.tasks.load(std::memory_order_relaxed);
+				ns.latency.total += std::chrono::nanoseconds{n.total.load(std::memory_order_relaxed)};
+				for (unsigned b = 0; b < DurationHistogram::NumBuckets; ++b)
+					ns.latency.buckets[b] += n.buckets[b].load(std::memory_order_relaxed);
+			}
+		}
+		return s;
+	}
+
+};
+
+#else
+
+// Statistics disabled, every hook compiles to nothing
+class StatsCollector {
+
+public:
+
+	struct Stamp { };
+
+	StatsCollector(std::size_t, std::size_t) { }
+
+	static Stamp Now() { return Stamp{}; }
+	void Task(std::size_t, TaskSource, Stamp) { }
+	void Idle(std::size_t, Stamp) { }
+	void FailedSteal(std::size_t) { }
+	void Executed(std::size_t, NodeId, std::size_t, Stamp) { }
+	void InFlight(long) { }
+
+	EngineStatistics Snapshot(std::size_t, long) const
+	{
+		return EngineStatistics{false, 0, 0, 0, std::vector<WorkerStatistics>{}, std::vector<NodeStatistics>{}};
+	}
+
+};
+
+#endif
+
+} // detail namespace
+
+} // mdf namespace
+
+#endif
@@ -0,0 +1,221 @@
+/***********************************************
+
+   Distributed Systems: Paradigms and models
+   2015/2016 Final project source code
+   Micro MDF
+   Author: Andrea Maggiordomo
+
+************************************************/
+
+#ifndef MDF_TRACE_HPP
+#define MDF_TRACE_HPP
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <algorithm>
+
+#include "Graph.hpp"
+#include "Statistics.hpp"
+
+#ifndef MDF_TRACE_BUFFER_SIZE
+#define MDF_TRACE_BUFFER_SIZE (1 << 16) // Events kept by each worker
+#endif
+
+namespace mdf {
+
+/*
+ * Scheduling traces
+ * When MDF_ENABLE_TRACE is defined every worker records one event per task
+ * in its own ring buffer, keeping the last MDF_TRACE_BUFFER_SIZE events.
+ * Recording is a few stores by the owner of the buffer, without locks or
+ * shared counters. Traces are meant to be written after Start() returns
+ * (see Mdf::WriteTrace), in the Chrome trace event format that is also
+ * read by Perfetto.
+ */
+
+enum class TraceKind : std::uint8_t { Task, Batch, Chunk, Ingestion, Resume };
+
+struct TraceEvent {
+	std::int64_t enqueued; // Nanoseconds on the steady clock
+	std::int64_t start;
+	std::int64_t end;
+	std::uint64_t instanceId; // First instance of batches
+	std::uint32_t node;
+	std::uint32_t instances; // Instances in the task (batches and ingestion of instance batches)
+	std::uint16_t worker;
+	TraceKind kind;
+	bool stolen;
+};
+
+namespace detail {
+
+inline std::int64_t TraceClock()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#ifdef MDF_ENABLE_TRACE
+
+class Tracer {
+
+public:
+
+	using Stamp = std::int64_t;
+
+private:
+
+	struct Ring {
+		std::unique_ptr<TraceEvent[]> events;
+		std::atomic<std::uint64_t> head; // Number of events ever recorded
+		char pad[64];
+
+		Ring() : events{new TraceEvent[MDF_TRACE_BUFFER_SIZE]}, head{0} { }
+	};
+
+	std::unique_ptr<Ring[]> _rings;
+	const std::size_t _tn;
+
+public:
+
+	explicit Tracer(std::size_t tn) : _rings{new Ring[tn]}, _tn{tn} { }
+
+	static Stamp Now() { return TraceClock(); }
+
+	// Describes the task that a worker is about to run
+	template<typename T>
+	TraceEvent Begin(std::size_t worker, const T& t, TaskSource source) const
+	{
+		TraceEvent e{t.enqueued, Now(), 0, 0, static_cast<std::uint32_t>(t.id), 1,
+				static_cast<std::uint16_t>(worker), TraceKind::Task, source == TaskSource::Stolen};
+		if (t.input) {
+			e.kind = TraceKind::Ingestion;
+			e.instanceId = t.input->instanceId;
+			e.instances = t.input->batch.Size() > 0 ? static_cast<std::uint32_t>(t.input->batch.Size()) : 1;
+		} else if (t.batch) {
+			e.kind = TraceKind::Batch;
+			e.instanceId = t.batch->empty() ? 0 : t.batch->front()->instanceId;
+			e.instances = static_cast<std::uint32_t>(t.batch->size());
+		} else {
+			e.kind = t.map ? TraceKind::Chunk : t.result ? TraceKind::Resume : TraceKind::Task;
+			e.instanceId = t.gh->instanceId;
+		}
+		return e;
+	}
+
+	void End(std::size_t worker, TraceEvent& e)
+	{
+		e.end = Now();
+		Ring& r = _rings[worker];
+		std::uint64_t h = r.head.load(std::memory_order_relaxed);
+		r.events[h % MDF_TRACE_BUFFER_SIZE] = e;
+		r.head.store(h + 1, std::memory_order_release);
+	}
+
+	// Events still in the buffers, sorted by start time
+	std::vector<TraceEvent> Events() const
+	{
+		std::vector<TraceEvent> events;
+		for (std::size_t w = 0; w < _tn; ++w) {
+			const Ring& r = _rings[w];
+			std::uint64_t h = r.head.load(std::memory_order_acquire);
+			std::uint64_t first = h > MDF_TRACE_BUFFER_SIZE ? h - MDF_TRACE_BUFFER_SIZE : 0;
+			for (std::uint64_t i = first; i < h; ++i)
+				events.push_back(r.events[i % MDF_TRACE_BUFFER_SIZE]);
+		}
+		std::sort(events.begin(), events.end(), [](const TraceEvent& a, const TraceEvent& b) { return a.start < b.start; });
+		return events;
+	}
+
+};
+
+#else
+
+// Tracing disabled, every hook compiles to nothing
+class Tracer {
+
+public:
+
+	struct Stamp { };
+
+	explicit Tracer(std::size_t) { }
+
+	static Stamp Now() { return Stamp{}; }
+
+	template<typename T>
+	Stamp Begin(std::size_t, const T&, TaskSource) const { return Stamp{}; }
+
+	void End(std::size_t, Stamp&) { }
+
+	std::vector<TraceEvent> Events() const { return std::vector<TraceEvent>{}; }
+
+};
+
+#endif
+
+inline const char *TraceKindName(TraceKind k)
+{
+	switch (k) {
+	case TraceKind::Batch: return "batch";
+	case TraceKind::Chunk: return "chunk";
+	case TraceKind::Ingestion: return "ingestion";
+	case TraceKind::Resume: return "resume";
+	default: return "task";
+	}
+}
+
+inline void JsonString(std::ostream& os, const std::string& s)
+{
+	os << '"';
+	for (char c : s) {
+		if (c == '"' || c == '\\') os << '\\' << c;
+		else if (static_cast<unsigned char>(c) < 0x20) os << ' ';
+		else os << c;
+	}
+	os << '"';
+}
+
+} // detail namespace
+
+/*
+ * Writes events in the Chrome trace event format: one complete event per
+ * task on the timeline of its worker, named after the label of the node,
+ * with the instance id, the queueing delay and the steal flag as arguments
+ */
+inline void WriteChromeTrace(std::ostream& os, const std::vector<TraceEvent>& events, const Graph& g, std::size_t tn)
+{
+	std::int64_t t0 = events.empty() ? 0 : events.front().start;
+	for (auto& e : events)
+		t0 = std::min(t0, std::min(e.enqueued, e.start));
+
+	os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+	bool first = true;
+	for (std::size_t w = 0; w < tn; ++w) {
+		if (!first) os << ",\n";
+		first = false;
+		os << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << w
+		   << ",\"args\":{\"name\":\"worker " << w << "\"}}";
+	}
+	for (auto& e : events) {
+		if (!first) os << ",\n";
+		first = false;
+		std::string name = e.kind == TraceKind::Ingestion ? std::string{"ingestion"} : g.Label(e.node);
+		os << "{\"name\":";
+		detail::JsonString(os, name);
+		os << ",\"cat\":\"" << detail::TraceKindName(e.kind) << (e.stolen ? ",stolen" : "") << "\""
+		   << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.worker
+		   << ",\"ts\":" << (e.start - t0) / 1000.0 << ",\"dur\":" << (e.end - e.start) / 1000.0
+		   << ",\"args\":{\"instance\":" << e.instanceId << ",\"instances\":" << e.instances
+		   << ",\"node\":" << e.node << ",\"queued_us\":" << (e.start - e.enqueued) / 1000.0
+		   << ",\"stolen\":" << (e.stolen ? "true" : "false") << "}}";
+	}
+	os << "\n]}\n";
+}
+
+} // mdf namespace
+
+#endif